@@ -0,0 +1,127 @@
+--
+-- pgchess throughput benchmark, run by "make bench" in a database of
+-- its own. Each benchmark runs its query five times over a fixed set
+-- of positions, and reports the fastest run as tab-separated values:
+-- operations, nodes (for perft and searches), elapsed milliseconds,
+-- operations per second, nanoseconds per operation and nodes per
+-- second. Searches start from an empty transposition table. The
+-- bench_positions table is kept for bench/pgbench.sql.
+--
+
+\set ON_ERROR_STOP 1
+SET client_min_messages = warning;
+
+CREATE EXTENSION IF NOT EXISTS pgchess;
+
+DROP TABLE IF EXISTS bench_positions;
+CREATE TABLE bench_positions
+( id int PRIMARY KEY
+, category text
+, name text
+, g game
+, b chessboard
+);
+
+INSERT INTO bench_positions (id, category, name, g, b)
+SELECT id, category, name, %% fen, fen :: chessboard
+FROM (VALUES
+  (1, 'opening', 'initial position', 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1')
+, (2, 'opening', 'Ruy Lopez', 'r1bqkbnr/1ppp1ppp/p1n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 0 4')
+, (3, 'middlegame', 'Kiwipete', 'r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1')
+, (4, 'middlegame', 'perft position 5', 'rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8')
+, (5, 'tactical', 'perft position 4', 'r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1')
+, (6, 'tactical', 'mate in one', 'r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4')
+, (7, 'endgame', 'perft position 3', '8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1')
+, (8, 'endgame', 'king and pawns', '8/5pk1/6p1/8/3P4/6P1/5PK1/8 w - - 0 1')
+) AS t(id, category, name, fen);
+
+ANALYZE bench_positions;
+
+CREATE FUNCTION pg_temp.bench
+( IN name text
+, IN query text
+, OUT benchmark text
+, OUT ops int8
+, OUT nodes int8
+, OUT ms numeric
+, OUT ops_per_sec numeric
+, OUT ns_per_op numeric
+, OUT nodes_per_sec numeric
+) LANGUAGE plpgsql AS $$
+DECLARE
+	t0 timestamptz;
+	elapsed double precision;
+	best double precision;
+BEGIN
+	benchmark := name;
+	FOR i IN 1 .. 5 LOOP
+		t0 := clock_timestamp();
+		EXECUTE query INTO ops, nodes;
+		elapsed := 1000 * extract(epoch FROM clock_timestamp() - t0);
+		best := least(best, elapsed);
+	END LOOP;
+	best := greatest(best, 0.001);
+	ms := round(best :: numeric, 3);
+	ops_per_sec := round((ops * 1000 / best) :: numeric);
+	ns_per_op := round((best * 1000000 / ops) :: numeric, 1);
+	nodes_per_sec := round((nodes * 1000 / best) :: numeric);
+END;
+$$;
+
+\pset format unaligned
+\pset fieldsep '\t'
+\pset footer off
+
+SELECT r.*
+FROM (VALUES
+  (1, 'valid_moves', $q$
+	SELECT count(*), NULL :: int8
+	FROM bench_positions, generate_series(1, 500),
+	LATERAL (SELECT count(*) FROM valid_moves(g)) v
+  $q$)
+, (2, 'valid_moves_array', $q$
+	SELECT count(valid_moves_array(g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 2000)
+  $q$)
+, (3, 'count_valid_moves', $q$
+	SELECT count(count_valid_moves(g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (4, 'is_king_safe', $q$
+	SELECT count(is_king_safe(g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (5, 'is_game_ended', $q$
+	SELECT count(is_game_ended(g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (6, 'c_score', $q$
+	SELECT count(c_score(g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (7, 'c_score_chessboard', $q$
+	SELECT count(c_score(b)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (8, 'fen_round_trip', $q$
+	SELECT count(%% (%% g)), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (9, 'chessboard_round_trip', $q$
+	SELECT count(b :: text :: chessboard), NULL :: int8
+	FROM bench_positions, generate_series(1, 5000)
+  $q$)
+, (10, 'apply_moves', $q$
+	SELECT count(g ^ valid_moves_array(g)[1:1]), NULL :: int8
+	FROM bench_positions, generate_series(1, 2000)
+  $q$)
+, (11, 'perft', $q$
+	SELECT count(*), sum(perft(g, 3)) :: int8
+	FROM bench_positions
+  $q$)
+, (12, 'best_move', $q$
+	SELECT count(*), sum((best_move(g, 3)).nodes) :: int8
+	FROM (SELECT tt_clear()) c, bench_positions
+  $q$)
+) AS t(n, name, query), LATERAL pg_temp.bench(name, query) r
+ORDER BY n;
@@ -0,0 +1,15 @@
+--
+-- Concurrent load for pgbench, on the positions loaded by
+-- bench/bench.sql ("make bench"):
+--
+--   pgbench -n -f bench/pgbench.sql -c 8 -j 8 -T 60 pgchess_bench
+--
+-- Each transaction takes a random position, generates and checks its
+-- moves, scores it, converts it to FEN and back, and searches it.
+--
+
+\set id random(1, 8)
+SELECT count_valid_moves(g), is_king_safe(g), is_game_ended(g), c_score(g), %% (%% g)
+FROM bench_positions WHERE id = :id;
+SELECT count(*) FROM bench_positions, valid_moves(g) WHERE id = :id;
+SELECT (best_move(g, 2)).move FROM bench_positions WHERE id = :id;
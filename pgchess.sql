@@ -303,73 +303,8 @@ CREATE OPERATOR ##
 CREATE FUNCTION fen_to_game
 ( fen IN text
 , g OUT game
-) LANGUAGE plpgsql
-IMMUTABLE STRICT
-AS $BODY$
-DECLARE
-	a text[];
-	x text;
-	y text;
-	i int;
-BEGIN
-	--
-	-- TODO: regexp-based sanity check?
-	--
-	-- (1) piece placement
-	a := regexp_split_to_array(fen, ' ');
-	x := a[1];
-	x := regexp_replace(x,'1',' ','g');
-	x := regexp_replace(x,'2','  ','g');
-	x := regexp_replace(x,'3','   ','g');
-	x := regexp_replace(x,'4','    ','g');
-	x := regexp_replace(x,'5','     ','g');
-	x := regexp_replace(x,'6','      ','g');
-	x := regexp_replace(x,'7','       ','g');
-	x := regexp_replace(x,'8','        ','g');
-	x := regexp_replace(x,'/','','g');
-	IF length(x) != 64 THEN
-		RAISE EXCEPTION 'parsing error in FEN component 1: "%" ==> "%")', a[1], x;
-	END IF;
-	x := substr(x,57,8)
-	  || substr(x,49,8)
-	  || substr(x,41,8)
-	  || substr(x,33,8)
-	  || substr(x,25,8)
-	  || substr(x,17,8)
-	  || substr(x, 9,8)
-	  || substr(x, 1,8)
-	  ;
-	-- (2) active colour
-	CASE a[2]
-	WHEN 'w' THEN
-		g.moves := '{}' :: int2[];
-	WHEN 'b' THEN
-		g.moves := '{0}' :: int2[];
-	ELSE
-		RAISE EXCEPTION 'parsing error in FEN component 2: "%")', a[2];
-	END CASE;	
-	-- (3) castling availability
-	IF a[3] = '-' THEN
-		x := x || 'nnnn';
-	ELSE
-		x := x ||
-		     CASE WHEN a[3] ~ 'K' THEN 'y' ELSE 'n' END ||
-		     CASE WHEN a[3] ~ 'Q' THEN 'y' ELSE 'n' END ||
-		     CASE WHEN a[3] ~ 'k' THEN 'y' ELSE 'n' END ||
-		     CASE WHEN a[3] ~ 'q' THEN 'y' ELSE 'n' END ;
-	END IF;
-	g.board := x || ' ';	
-	-- (4) en-passant target square
-	-- TODO
-	-- (5) halfmove clock
-	g.halfmove_counter := a[5] :: int2;
-	-- TODO
-	-- (6) fullmove number
-	FOR i IN 2 .. a[6] LOOP
-		g.moves := g.moves || ('{0,0}' :: int2[]);
-	END LOOP;
-END;
-$BODY$;
+) IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_fen_to_game';
 
 CREATE OPERATOR %%
 ( PROCEDURE = fen_to_game
@@ -387,6 +322,93 @@ CREATE OPERATOR %%
 , RIGHTARG = game
 );
 
+--
+-- Array variants, for bulk loads
+--
+
+CREATE FUNCTION fen_to_game
+( fen IN text[]
+) RETURNS game[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_fen_to_game_array';
+
+CREATE FUNCTION game_to_fen
+( g IN game[]
+) RETURNS text[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_game_to_fen_array';
+
+--
+-- The chessboard type: a position in a compact fixed-size binary
+-- format, with explicit side to move, castling rights, en passant
+-- target square and halfmove/fullmove counters. Its text
+-- representation is FEN.
+--
+
+CREATE TYPE chessboard;
+
+CREATE FUNCTION chessboard_in(cstring)
+RETURNS chessboard
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_in';
+
+CREATE FUNCTION chessboard_out(chessboard)
+RETURNS cstring
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_out';
+
+CREATE FUNCTION chessboard_recv(internal)
+RETURNS chessboard
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_recv';
+
+CREATE FUNCTION chessboard_send(chessboard)
+RETURNS bytea
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_send';
+
+CREATE TYPE chessboard
+( INTERNALLENGTH = 40
+, INPUT = chessboard_in
+, OUTPUT = chessboard_out
+, RECEIVE = chessboard_recv
+, SEND = chessboard_send
+, ALIGNMENT = int2
+);
+
+CREATE FUNCTION chessboard(game)
+RETURNS chessboard
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_game_to_chessboard';
+
+CREATE FUNCTION game(chessboard)
+RETURNS game
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_to_game';
+
+CREATE CAST (game AS chessboard)
+WITH FUNCTION chessboard(game);
+
+CREATE CAST (chessboard AS game)
+WITH FUNCTION game(chessboard);
+
+CREATE CAST (text AS chessboard)
+WITH INOUT;
+
+CREATE CAST (chessboard AS text)
+WITH INOUT;
+
+CREATE FUNCTION game_to_fen
+( g IN chessboard
+, fen OUT text
+) IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_game_to_fen';
+
+CREATE OPERATOR %%
+( PROCEDURE = game_to_fen
+, RIGHTARG = chessboard
+);
+
 --
 --
 --
@@ -464,96 +486,17 @@ $BODY$;
 --
 
 CREATE FUNCTION apply_move
-(IN b game
-,IN m move
-,OUT o game
-) LANGUAGE plpgsql AS
-$BODY$
---
--- Caveat: apply_move does NOT check whether the move is admissible in
--- any sense; it just applies the move as it is. Castling is detected
--- by the movement of the King; in that case the corresponding
--- movement of the Rook is performed.
---
-DECLARE
-	i1 int := (m).x1 + 8 * ((m).y1 - 1);
-	i2 int := (m).x2 + 8 * ((m).y2 - 1);
-	square1	character(1) := substr(b.board, i1, 1);
-	square2	character(1) := substr(b.board, i2, 1);
-BEGIN
-	o.halfmove_counter := b.halfmove_counter + 1;
-	IF square1 = 'P' AND (m).y1 = 7 AND (m).y2 = 8 THEN
-		square1 := CASE (m).ppc
-			   WHEN 0 THEN 'Q'
-			   WHEN 1 THEN 'B'
-			   WHEN 2 THEN 'N'
-			   WHEN 3 THEN 'R'
-			   END;
-	END IF;
-	IF square1 = 'p' AND (m).y1 = 2 AND (m).y2 = 1 THEN
-		square1 := CASE (m).ppc
-			   WHEN 0 THEN 'q'
-			   WHEN 1 THEN 'b'
-			   WHEN 2 THEN 'n'
-			   WHEN 3 THEN 'r'
-			   END;
-	END IF;
+( IN b game
+, IN m move
+) RETURNS game
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_apply_move';
 
-	o.board := b.board;
-	o.moves := b.moves || %% m;
-	o.board := overlay(o.board placing square2 from 69 for 1);
-	o.board := overlay(o.board placing square1 from i2 for 1);
-	o.board := overlay(o.board placing ' ' from i1 for 1);
-		
-	
-	CASE
-	-- castling check 1
-	WHEN	square1 = 'K'
-	AND	(m).y1 = 1
-	AND	(m).y2 = 1
-	AND	(m).x1 = 5
-	AND	(m).x2 = 3
-	AND	substr(b.board,66,1) = 'y'
-	THEN	o.board := overlay(o.board placing ' ' from 1 for 1);
-		o.board := overlay(o.board placing 'R' from 4 for 1);
-		o.board := overlay(o.board placing 'n' from 65 for 1);
-	-- castling check 1
-	WHEN	square1 = 'K'
-	AND	(m).y1 = 1
-	AND	(m).y2 = 1
-	AND	(m).x1 = 5
-	AND	(m).x2 = 7
-	AND	substr(b.board,65,1) = 'y'
-	THEN	o.board := overlay(o.board placing ' ' from 8 for 1);
-		o.board := overlay(o.board placing 'R' from 6 for 1);
-		o.board := overlay(o.board placing 'n' from 66 for 1);
-	-- castling check 1
-	WHEN	square1 = 'k'
-	AND	(m).y1 = 8
-	AND	(m).y2 = 8
-	AND	(m).x1 = 5
-	AND	(m).x2 = 3
-	AND	substr(b.board,68,1) = 'y'
-	THEN	o.board := overlay(o.board placing ' ' from 57 for 1);
-		o.board := overlay(o.board placing 'r' from 60 for 1);
-		o.board := overlay(o.board placing 'n' from 67 for 1);
-	-- castling check 1
-	WHEN	square1 = 'k'
-	AND	(m).y1 = 8
-	AND	(m).y2 = 8
-	AND	(m).x1 = 5
-	AND	(m).x2 = 7
-	AND	substr(b.board,67,1) = 'y'
-	THEN	o.board := overlay(o.board placing ' ' from 64 for 1);
-		o.board := overlay(o.board placing 'r' from 62 for 1);
-		o.board := overlay(o.board placing 'n' from 68 for 1);
-	ELSE NULL;
-	END CASE;
-	IF square1 = 'p' OR square1 = 'P' OR square2 != ' ' THEN
-		o.halfmove_counter := 0;
-	END IF;
-END;
-$BODY$;
+COMMENT ON FUNCTION apply_move(game, move) IS
+'Caveat: apply_move does NOT check whether the move is admissible in
+any sense; it just applies the move as it is. Castling is detected by
+the movement of the King; in that case the corresponding movement of
+the Rook is performed.';
 
 CREATE OPERATOR ^
 ( PROCEDURE = apply_move
@@ -561,12 +504,79 @@ CREATE OPERATOR ^
 , rightarg = move
 );
 
+--
+-- apply a list of moves (encoded as by the %% operator) in one call
+--
+
+CREATE FUNCTION apply_moves
+( IN b game
+, IN m int2[]
+) RETURNS game
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_apply_moves';
+
+CREATE OPERATOR ^
+( PROCEDURE = apply_moves
+, leftarg = game
+, rightarg = int2[]
+);
+
 CREATE FUNCTION valid_moves
 ( IN b game
 ) RETURNS SETOF move
 IMMUTABLE STRICT LANGUAGE C AS
 'chess', 'chess_valid_moves';
 
+--
+-- valid_moves(b, ordered) also returns the ordering key of each move:
+-- captures first, by Most Valuable Victim / Least Valuable Aggressor,
+-- then promotions, then checks, then the others (sort_key 0). When
+-- ordered is true, the moves are sorted by decreasing sort_key.
+--
+
+CREATE FUNCTION valid_moves
+( IN b game
+, IN ordered boolean
+, OUT x1 int2
+, OUT y1 int2
+, OUT x2 int2
+, OUT y2 int2
+, OUT ppc int2
+, OUT sort_key int
+) RETURNS SETOF record
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_valid_moves_ordered';
+
+--
+-- see(b, m) is the static exchange evaluation of a valid move: the
+-- material (in pawns) won by the side to move, if both sides go on
+-- capturing on the target square with their least valuable piece.
+--
+
+CREATE FUNCTION see
+( IN b game
+, IN m move
+) RETURNS int
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_see';
+
+--
+-- valid_moves_array and count_valid_moves do not build a tuple for
+-- each move; the moves are encoded as by the %% operator.
+--
+
+CREATE FUNCTION valid_moves_array
+( IN b game
+) RETURNS int2[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_valid_moves_array';
+
+CREATE FUNCTION count_valid_moves
+( IN b game
+) RETURNS int
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_count_valid_moves';
+
 CREATE FUNCTION is_king_safe
 ( IN b game
 ) RETURNS boolean
@@ -585,6 +595,673 @@ CREATE FUNCTION c_score
 IMMUTABLE STRICT LANGUAGE C AS
 'chess', 'chess_game_score';
 
+--
+-- The same functions, on the chessboard type
+--
+
+CREATE FUNCTION valid_moves
+( IN b chessboard
+) RETURNS SETOF move
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_valid_moves';
+
+CREATE FUNCTION valid_moves
+( IN b chessboard
+, IN ordered boolean
+, OUT x1 int2
+, OUT y1 int2
+, OUT x2 int2
+, OUT y2 int2
+, OUT ppc int2
+, OUT sort_key int
+) RETURNS SETOF record
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_valid_moves_ordered';
+
+CREATE FUNCTION see
+( IN b chessboard
+, IN m move
+) RETURNS int
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_see';
+
+CREATE FUNCTION valid_moves_array
+( IN b chessboard
+) RETURNS int2[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_valid_moves_array';
+
+CREATE FUNCTION count_valid_moves
+( IN b chessboard
+) RETURNS int
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_count_valid_moves';
+
+CREATE FUNCTION is_king_safe
+( IN b chessboard
+) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_is_king_safe';
+
+CREATE FUNCTION is_game_ended
+( IN b chessboard
+) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_is_game_ended';
+
+CREATE FUNCTION c_score
+( IN b chessboard
+) RETURNS double precision
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_game_score';
+
+CREATE FUNCTION apply_move
+( IN b chessboard
+, IN m move
+) RETURNS chessboard
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_apply_move';
+
+CREATE OPERATOR ^
+( PROCEDURE = apply_move
+, leftarg = chessboard
+, rightarg = move
+);
+
+CREATE FUNCTION apply_moves
+( IN b chessboard
+, IN m int2[]
+) RETURNS chessboard
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_apply_moves';
+
+CREATE OPERATOR ^
+( PROCEDURE = apply_moves
+, leftarg = chessboard
+, rightarg = int2[]
+);
+
+--
+-- Positions: a 64-bit Zobrist hash, and operator classes comparing
+-- games and chessboards by position only (pieces, side to move,
+-- castling rights and en passant target square). They are the default
+-- for chessboard, so that GROUP BY, DISTINCT, hash joins and unique
+-- indexes work by position; for game they must be asked for, as in
+--
+--   CREATE UNIQUE INDEX ON node (g game_position_ops);
+--
+
+CREATE FUNCTION position_hash
+( IN b game
+) RETURNS int8
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_position_hash';
+
+CREATE FUNCTION position_hash
+( IN b chessboard
+) RETURNS int8
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_chessboard_position_hash';
+
+CREATE FUNCTION position_hash32(game) RETURNS int4
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_hash32';
+CREATE FUNCTION position_hash32(chessboard) RETURNS int4
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_hash32';
+
+CREATE FUNCTION position_cmp(game, game) RETURNS int4
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_cmp';
+CREATE FUNCTION position_eq(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_eq';
+CREATE FUNCTION position_ne(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_ne';
+CREATE FUNCTION position_lt(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_lt';
+CREATE FUNCTION position_le(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_le';
+CREATE FUNCTION position_gt(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_gt';
+CREATE FUNCTION position_ge(game, game) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_position_ge';
+
+CREATE FUNCTION position_cmp(chessboard, chessboard) RETURNS int4
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_cmp';
+CREATE FUNCTION position_eq(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_eq';
+CREATE FUNCTION position_ne(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_ne';
+CREATE FUNCTION position_lt(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_lt';
+CREATE FUNCTION position_le(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_le';
+CREATE FUNCTION position_gt(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_gt';
+CREATE FUNCTION position_ge(chessboard, chessboard) RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_position_ge';
+
+--
+-- game operators are named as for text_pattern_ops, so that the
+-- usual = on game (which compares whole records) is not affected
+--
+
+CREATE OPERATOR ~=~
+( PROCEDURE = position_eq
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~=~
+, NEGATOR = ~<>~
+, RESTRICT = eqsel
+, JOIN = eqjoinsel
+, HASHES
+, MERGES
+);
+
+CREATE OPERATOR ~<>~
+( PROCEDURE = position_ne
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~<>~
+, NEGATOR = ~=~
+, RESTRICT = neqsel
+, JOIN = neqjoinsel
+);
+
+CREATE OPERATOR ~<~
+( PROCEDURE = position_lt
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~>~
+, NEGATOR = ~>=~
+, RESTRICT = scalarltsel
+, JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR ~<=~
+( PROCEDURE = position_le
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~>=~
+, NEGATOR = ~>~
+, RESTRICT = scalarltsel
+, JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR ~>~
+( PROCEDURE = position_gt
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~<~
+, NEGATOR = ~<=~
+, RESTRICT = scalargtsel
+, JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR ~>=~
+( PROCEDURE = position_ge
+, LEFTARG = game
+, RIGHTARG = game
+, COMMUTATOR = ~<=~
+, NEGATOR = ~<~
+, RESTRICT = scalargtsel
+, JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR CLASS game_position_ops
+FOR TYPE game USING btree AS
+	OPERATOR 1 ~<~ ,
+	OPERATOR 2 ~<=~ ,
+	OPERATOR 3 ~=~ ,
+	OPERATOR 4 ~>=~ ,
+	OPERATOR 5 ~>~ ,
+	FUNCTION 1 position_cmp(game, game);
+
+CREATE OPERATOR CLASS game_position_ops
+FOR TYPE game USING hash AS
+	OPERATOR 1 ~=~ ,
+	FUNCTION 1 position_hash32(game);
+
+CREATE OPERATOR =
+( PROCEDURE = position_eq
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = =
+, NEGATOR = <>
+, RESTRICT = eqsel
+, JOIN = eqjoinsel
+, HASHES
+, MERGES
+);
+
+CREATE OPERATOR <>
+( PROCEDURE = position_ne
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = <>
+, NEGATOR = =
+, RESTRICT = neqsel
+, JOIN = neqjoinsel
+);
+
+CREATE OPERATOR <
+( PROCEDURE = position_lt
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = >
+, NEGATOR = >=
+, RESTRICT = scalarltsel
+, JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR <=
+( PROCEDURE = position_le
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = >=
+, NEGATOR = >
+, RESTRICT = scalarltsel
+, JOIN = scalarltjoinsel
+);
+
+CREATE OPERATOR >
+( PROCEDURE = position_gt
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = <
+, NEGATOR = <=
+, RESTRICT = scalargtsel
+, JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR >=
+( PROCEDURE = position_ge
+, LEFTARG = chessboard
+, RIGHTARG = chessboard
+, COMMUTATOR = <=
+, NEGATOR = <
+, RESTRICT = scalargtsel
+, JOIN = scalargtjoinsel
+);
+
+CREATE OPERATOR CLASS chessboard_position_ops
+DEFAULT FOR TYPE chessboard USING btree AS
+	OPERATOR 1 < ,
+	OPERATOR 2 <= ,
+	OPERATOR 3 = ,
+	OPERATOR 4 >= ,
+	OPERATOR 5 > ,
+	FUNCTION 1 position_cmp(chessboard, chessboard);
+
+CREATE OPERATOR CLASS chessboard_position_ops
+DEFAULT FOR TYPE chessboard USING hash AS
+	OPERATOR 1 = ,
+	FUNCTION 1 position_hash32(chessboard);
+
+--
+-- The shared transposition table, which is available when the library
+-- is in shared_preload_libraries; see the pgchess.tt_size setting.
+--
+
+CREATE FUNCTION tt_stats
+( OUT entries int8
+, OUT hits int8
+, OUT misses int8
+, OUT stores int8
+, OUT replacements int8
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_tt_stats';
+
+CREATE FUNCTION tt_clear()
+RETURNS void
+VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_tt_clear';
+
+REVOKE ALL ON FUNCTION tt_clear() FROM PUBLIC;
+
+--
+-- Engine statistics: what move generation, evaluation and search have
+-- done, and how long they took, in nanoseconds; clones are the game
+-- values built from positions of the engine. The totals include all
+-- backends when the library is in shared_preload_libraries, and only
+-- the current one otherwise; the times of move generation and
+-- evaluation are only collected when pgchess.track_timing is on.
+--
+
+CREATE FUNCTION pgchess_stats
+( OUT formal_moves int8
+, OUT legality_checks int8
+, OUT clones int8
+, OUT evaluations int8
+, OUT tt_probes int8
+, OUT tt_hits int8
+, OUT search_nodes int8
+, OUT movegen_ns int8
+, OUT eval_ns int8
+, OUT search_ns int8
+, OUT perft_ns int8
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_pgchess_stats';
+
+CREATE FUNCTION pgchess_stats_reset()
+RETURNS void
+VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_pgchess_stats_reset';
+
+REVOKE ALL ON FUNCTION pgchess_stats_reset() FROM PUBLIC;
+
+CREATE VIEW pgchess_stats AS
+SELECT * FROM pgchess_stats();
+
+--
+-- The terms of c_score, from the point of view of the side to move:
+-- material (in pawns), piece placement (in centipawns), mobility (the
+-- squares our pieces other than Pawns attack and we do not occupy,
+-- minus theirs), attacked (the value of their pieces attacked more
+-- than defended, minus ours) and king_safety (the attacks near their
+-- King minus those near ours).
+--
+
+CREATE FUNCTION score_breakdown
+( IN b game
+, OUT material int
+, OUT piece_square int
+, OUT mobility int
+, OUT attacked int
+, OUT king_safety int
+, OUT score double precision
+) IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_score_breakdown';
+
+CREATE FUNCTION score_breakdown
+( IN b chessboard
+, OUT material int
+, OUT piece_square int
+, OUT mobility int
+, OUT attacked int
+, OUT king_safety int
+, OUT score double precision
+) IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_score_breakdown';
+
+--
+-- attack_map(b)[side][square] is the number of pieces of side (1 for
+-- White, 2 for Black) attacking square (1 for a1, 2 for b1, ..., 64
+-- for h8).
+--
+
+CREATE FUNCTION attack_map
+( IN b game
+) RETURNS int2[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_attack_map';
+
+CREATE FUNCTION attack_map
+( IN b chessboard
+) RETURNS int2[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_attack_map';
+
+--
+-- Search the best move with an iterative-deepening alpha-beta search,
+-- up to the given depth in plies. The move and the principal variation
+-- are encoded as by the %% operator; move is null when there are no
+-- valid moves. The score is from the point of view of the side to
+-- move, as for c_score; being checkmated in n plies scores
+-- -(10000 - n). completed_depth is the deepest iteration completed.
+--
+-- time_ms is a soft limit in milliseconds: no iteration starts after
+-- half of it, and once it is over the search ends with the first
+-- complete iteration. hard_ms, and the statement_timeout when it is
+-- sooner, stop the search even before; then the best move found so
+-- far is returned, rather than an error. 0 means no limit.
+--
+-- When pgchess.max_workers is not 0, the root moves are split across
+-- that many background workers; between moves with the same score,
+-- the one found first is returned.
+--
+
+CREATE FUNCTION best_move
+( IN b game
+, IN depth int
+, IN time_ms int DEFAULT 0
+, IN hard_ms int DEFAULT 0
+, OUT move int2
+, OUT score double precision
+, OUT nodes int8
+, OUT pv int2[]
+, OUT completed_depth int
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_best_move';
+
+CREATE FUNCTION best_move
+( IN b chessboard
+, IN depth int
+, IN time_ms int DEFAULT 0
+, IN hard_ms int DEFAULT 0
+, OUT move int2
+, OUT score double precision
+, OUT nodes int8
+, OUT pv int2[]
+, OUT completed_depth int
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_best_move';
+
+--
+-- perft counts the leaf nodes of the tree of valid moves, up to the
+-- given depth in plies; perft_divide splits the count by first move
+-- (encoded as by the %% operator), in the same order as valid_moves.
+-- The elapsed time and the nodes per second are reported at DEBUG1
+-- level, and returned by perft_timed. As for best_move, the work is
+-- split across pgchess.max_workers background workers.
+--
+
+CREATE FUNCTION perft(b game, depth int)
+RETURNS bigint
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_perft';
+
+CREATE FUNCTION perft(b chessboard, depth int)
+RETURNS bigint
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_perft';
+
+CREATE FUNCTION perft_timed
+( IN b game
+, IN depth int
+, OUT nodes bigint
+, OUT elapsed_ms double precision
+, OUT nps bigint
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_perft_timed';
+
+CREATE FUNCTION perft_timed
+( IN b chessboard
+, IN depth int
+, OUT nodes bigint
+, OUT elapsed_ms double precision
+, OUT nps bigint
+) VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_perft_timed';
+
+CREATE FUNCTION perft_divide(b game, depth int)
+RETURNS TABLE(move int2, nodes bigint)
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_perft_divide';
+
+CREATE FUNCTION perft_divide(b chessboard, depth int)
+RETURNS TABLE(move int2, nodes bigint)
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_perft_divide';
+
+--
+-- Expand each game of an array by one ply: for each valid move of
+-- each game, the position of the game in the array (from 1), the
+-- move, the resulting game, its score (as returned by score) and
+-- whether it is ended. This is valid_moves, ^, score and
+-- is_game_ended in a single call, for the nodes of a search frontier.
+--
+
+CREATE FUNCTION expand(parents game[])
+RETURNS TABLE
+( parent_idx int
+, move int2
+, child game
+, child_score double precision
+, terminal boolean
+) IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_expand';
+
+--
+-- Opening books. book_moves returns the moves of the Polyglot book at
+-- pgchess.book_path for the given position (encoded as by the %%
+-- operator), in the order of the book, with their weights and
+-- learning values; moves which are not valid are skipped. The book
+-- is mapped in memory once per backend. polyglot_key is the key of
+-- the position in Polyglot books.
+--
+
+CREATE FUNCTION book_moves(b game)
+RETURNS TABLE(move int2, weight int, learn int)
+STABLE STRICT LANGUAGE C AS
+'chess', 'chess_book_moves';
+
+CREATE FUNCTION book_moves(b chessboard)
+RETURNS TABLE(move int2, weight int, learn int)
+STABLE STRICT LANGUAGE C AS
+'chess', 'chess_book_moves';
+
+CREATE FUNCTION polyglot_key(b game)
+RETURNS bigint
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_polyglot_key';
+
+CREATE FUNCTION polyglot_key(b chessboard)
+RETURNS bigint
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_polyglot_key';
+
+--
+-- PGN import. pgn_import returns the games of a PGN text, with their
+-- tags, their moves and the final game; moves are read as SAN, and a
+-- game with a move which is not valid is skipped with a warning.
+-- pgn_import_file reads a file on the server one line at a time, so
+-- like pg_read_file it is not granted to PUBLIC.
+--
+
+CREATE FUNCTION pgn_import(pgn text)
+RETURNS TABLE(headers jsonb, moves int2[], final game)
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_pgn_import';
+
+CREATE FUNCTION pgn_import_file(path text)
+RETURNS TABLE(headers jsonb, moves int2[], final game)
+VOLATILE STRICT LANGUAGE C AS
+'chess', 'chess_pgn_import_file';
+
+REVOKE ALL ON FUNCTION pgn_import_file(text) FROM PUBLIC;
+
+--
+-- Standard Algebraic Notation. moves_to_san converts a sequence of
+-- moves played from the given position, such as a principal
+-- variation or the moves of a game, in one pass.
+--
+
+CREATE FUNCTION move_to_san(b game, m move)
+RETURNS text
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_move_to_san';
+
+CREATE FUNCTION move_to_san(b chessboard, m move)
+RETURNS text
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_move_to_san';
+
+CREATE FUNCTION san_to_move(b game, san text)
+RETURNS move
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_san_to_move';
+
+CREATE FUNCTION san_to_move(b chessboard, san text)
+RETURNS move
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_san_to_move';
+
+CREATE FUNCTION moves_to_san(b game, m int2[])
+RETURNS text[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_moves_to_san';
+
+CREATE FUNCTION moves_to_san(b chessboard, m int2[])
+RETURNS text[]
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_moves_to_san';
+
+--
+-- Piece placement: b @> pattern tells whether a position has all the
+-- pieces of the pattern, such as 'Ne5 kg8'. Each term of a pattern is
+-- a FEN piece letter, followed by a square, a file, a rank, "light"
+-- or "dark", or by nothing for anywhere on the board. The GIN
+-- operator classes index the (piece, square) pairs of a position, as
+-- in
+--
+--   CREATE INDEX ON node USING gin (g game_placement_ops);
+--
+
+CREATE FUNCTION placement_match(b game, pattern text)
+RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_placement_match';
+
+CREATE FUNCTION placement_match(b chessboard, pattern text)
+RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS
+'chess', 'chess_placement_match';
+
+CREATE OPERATOR @>
+( PROCEDURE = placement_match
+, LEFTARG = game
+, RIGHTARG = text
+, RESTRICT = contsel
+, JOIN = contjoinsel
+);
+
+CREATE OPERATOR @>
+( PROCEDURE = placement_match
+, LEFTARG = chessboard
+, RIGHTARG = text
+, RESTRICT = contsel
+, JOIN = contjoinsel
+);
+
+CREATE FUNCTION game_gin_extract_value(game, internal, internal)
+RETURNS internal
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_game_gin_extract_value';
+CREATE FUNCTION chessboard_gin_extract_value(chessboard, internal, internal)
+RETURNS internal
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_chessboard_gin_extract_value';
+CREATE FUNCTION placement_gin_extract_query(text, internal, int2, internal, internal, internal, internal)
+RETURNS internal
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_placement_gin_extract_query';
+CREATE FUNCTION placement_gin_consistent(internal, int2, text, int4, internal, internal, internal, internal)
+RETURNS boolean
+IMMUTABLE STRICT LANGUAGE C AS 'chess', 'chess_placement_gin_consistent';
+
+CREATE OPERATOR CLASS game_placement_ops
+FOR TYPE game USING gin AS
+	OPERATOR 1 @> (game, text),
+	FUNCTION 1 btint4cmp(int4, int4),
+	FUNCTION 2 game_gin_extract_value(game, internal, internal),
+	FUNCTION 3 placement_gin_extract_query(text, internal, int2, internal, internal, internal, internal),
+	FUNCTION 4 placement_gin_consistent(internal, int2, text, int4, internal, internal, internal, internal),
+	STORAGE int4;
+
+CREATE OPERATOR CLASS chessboard_placement_ops
+DEFAULT FOR TYPE chessboard USING gin AS
+	OPERATOR 1 @> (chessboard, text),
+	FUNCTION 1 btint4cmp(int4, int4),
+	FUNCTION 2 chessboard_gin_extract_value(chessboard, internal, internal),
+	FUNCTION 3 placement_gin_extract_query(text, internal, int2, internal, internal, internal, internal),
+	FUNCTION 4 placement_gin_consistent(internal, int2, text, int4, internal, internal, internal, internal),
+	STORAGE int4;
+
 CREATE FUNCTION score
 ( IN g game
 , OUT o double precision
@@ -5,3 +5,4 @@ SELECT funcid, schemaname, funcname, calls, total_time, self_time
 FROM pg_stat_user_functions s
 WHERE schemaname IN ('public','pg2podg');
 
+SELECT pgchess_stats_reset();
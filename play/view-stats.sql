@@ -28,3 +28,6 @@ SELECT funcid
 ,      to_char(each_self_us, '99999.999') AS "each self us"
 FROM c
 ORDER BY self_ms DESC, each_self_us;
+
+-- what the engine did inside those functions
+SELECT * FROM pgchess_stats;
@@ -0,0 +1,14 @@
+--
+-- Applying moves: a game without a move history, and moves which do
+-- not encode two squares and a promotion piece
+--
+SELECT %% (ROW((g).board, 0, NULL) :: game ^ ROW(5,2,5,4,0) :: move) AS fen
+FROM (SELECT %% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' AS g) AS p;
+SELECT %% (ROW((g).board, 0, NULL) :: game ^ ARRAY[1804, 2356] :: int2[]) AS fen
+FROM (SELECT %% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' AS g) AS p;
+SELECT %% ((%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1') ^ '{-1}' :: int2[]);
+SELECT %% ((%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1') ^ '{16384}' :: int2[]);
+SELECT apply_moves('rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' :: chessboard, '{1804,-4096}');
+SELECT moves_to_san(new_game(), '{-1}');
+SELECT %% ROW((g).board, 0, '{-1}') :: game
+FROM (SELECT %% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' AS g) AS p;
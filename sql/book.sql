@@ -0,0 +1,43 @@
+--
+-- Opening books: the Polyglot keys of the positions given by the
+-- Polyglot book format, and the moves of a small book
+--
+SELECT fen, lpad(to_hex(polyglot_key(fen :: chessboard)), 16, '0') AS key
+FROM (VALUES
+  (1, 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1')
+, (2, 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1')
+, (3, 'rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2')
+, (4, 'rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2')
+, (5, 'rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3')
+, (6, 'rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3')
+, (7, 'rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4')
+, (8, 'rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3')
+, (9, 'rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4')
+) AS t(id, fen)
+ORDER BY id;
+SELECT polyglot_key(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1')
+     = polyglot_key('rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' :: chessboard) AS same;
+--
+-- A book with six entries, written in the data directory; e2e5 is
+-- not valid, and castling is encoded as e1h1
+--
+SELECT lo_from_bytea(0, decode(
+   '155b4522f72f85240107003200000003463b96181691fc9c031c006400000000'
+|| '463b96181691fc9c02db005000000007463b96181691fc9c0324000100000000'
+|| 'bf20a9115c3040844c38000a00000000bf20a9115c3040841c38000100000000', 'hex')) AS book_oid
+\gset
+SELECT lo_export(:book_oid, 'pgchess_regress_book.bin'), lo_unlink(:book_oid);
+SET pgchess.book_path = 'pgchess_regress_book.bin';
+SELECT # %% move AS move, weight, learn
+FROM book_moves(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1');
+SELECT # %% move AS move, weight, learn
+FROM book_moves('r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4' :: chessboard);
+SELECT # %% move AS move, (%% move).ppc, weight
+FROM book_moves('8/P6k/8/8/8/8/8/K7 w - - 0 1' :: chessboard);
+SELECT count(*)
+FROM book_moves(%% 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1');
+--
+-- Errors
+--
+RESET pgchess.book_path;
+SELECT * FROM book_moves(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1');
@@ -0,0 +1,54 @@
+--
+-- perft: the number of leaf nodes of the tree of valid moves, on the
+-- well-known test positions, whose node counts are published
+--
+CREATE TEMPORARY TABLE perft_positions
+( id int
+, name text
+, fen text
+, depth int
+, nodes bigint
+);
+INSERT INTO perft_positions VALUES
+  (1, 'Initial position', 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', 5, 4865609)
+, (2, 'Kiwipete', 'r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1', 4, 4085603)
+, (3, 'Position 3', '8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1', 5, 674624)
+, (4, 'Position 4', 'r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1', 4, 422333)
+, (5, 'Position 5', 'rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8', 4, 2103487)
+, (6, 'Position 6', 'r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10', 4, 3894594);
+--
+-- The first plies
+--
+SELECT name, d AS depth, perft(fen :: chessboard, d)
+FROM perft_positions, generate_series(0, 3) AS d
+ORDER BY id, d;
+--
+-- The published counts, on chessboards and on games
+--
+SELECT name, depth, nodes
+, perft(fen :: chessboard, depth) = nodes AS chessboard
+, perft(%% fen, depth) = nodes AS game
+FROM perft_positions
+ORDER BY id;
+--
+-- Node counts by first move
+--
+SELECT # %% move AS move, nodes
+FROM perft_divide(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', 3);
+SELECT sum(d.nodes)
+FROM perft_positions p, perft_divide(p.fen :: chessboard, 3) d
+WHERE p.name = 'Kiwipete';
+SELECT nodes
+FROM perft_timed('8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1' :: chessboard, 4);
+--
+-- Errors
+--
+SELECT perft(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', -1);
+SELECT * FROM perft_divide(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', 0);
+SELECT '4k3/8/8/8/4P3/8/8/4K3 w - e3 0 1' :: chessboard;
+SELECT '4k3/8/8/8/4P3/8/8/4K3 b - - 40000 1' :: chessboard;
+SELECT '4k3/8/8/8/4P3/8/8/4K3 b - - 0 40000' :: chessboard;
+SELECT '4k3/8/8/8/4P3/8/8/4K3 b - - 0 0' :: chessboard;
+SELECT '4k3/8/8/8/4P3/8/8/4K3 b - - 0 1 extra' :: chessboard;
+SELECT '8/8/8/8/4P3/8/8/4K3 b - - 0 1' :: chessboard;
+SELECT '4k3/8/8/8/4P3/8/8/3KK3 b - - 0 1' :: chessboard;
@@ -0,0 +1,60 @@
+--
+-- PGN import: tags, moves and final position of each game, with
+-- comments, variations, promotions, castling and en passant; the
+-- games with an invalid or ambiguous move are skipped
+--
+CREATE TEMP TABLE pgn AS
+SELECT n, headers, moves, final
+FROM pgn_import($pgn$
+[Event "F/S Return Match"]
+[Site "Belgrade, Serbia JUG"]
+[Date "1992.11.04"]
+[Round "29"]
+[White "Fischer, Robert J."]
+[Black "Spassky, Boris V."]
+[Result "1/2-1/2"]
+
+1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 {This opening is called the Ruy Lopez.}
+4. Ba4 Nf6 5. O-O Be7 6. Re1 b5 7. Bb3 d6 8. c3 O-O 9. h3 Nb8 10. d4 Nbd7
+11. c4 c6 12. cxb5 axb5 13. Nc3 Bb7 14. Bg5 b4 15. Nb1 h6 16. Bh4 c5 17. dxe5
+Nxe4 18. Bxe7 Qxe7 19. exd6 Qf6 20. Nbd2 Nxd6 21. Nc4 Nxc4 22. Bxc4 Nb6
+23. Ne5 Rae8 24. Bxf7+ Rxf7 25. Nxf7 Rxe1+ 26. Qxe1 Kxf7 27. Qe3 Qg5 28. Qxg5
+hxg5 29. b3 Ke6 30. a3 Kd6 31. axb4 cxb4 32. Ra5 Nd5 33. f3 Bc8 34. Kf2 Bf5
+35. Ra7 g6 36. Ra6+ Kc5 37. Ke1 Nf4 38. g3 Nxh3 39. Kd2 Kb5 40. Rd6 Kc5 41. Ra6
+Nf2 42. g4 Bd3 43. Re6 1/2-1/2
+
+[Event "Promotions"]
+[White "A \"quoted\" name"]
+[SetUp "1"]
+[FEN "8/P6k/8/8/8/8/6p1/K7 w - - 0 60"]
+
+60. a8=Q g1=N 61. Qb8 (61. Qa7+ Kg6) $1 61... Ne2!? ; to the end of the line
+62. Qb1 *
+
+[Event "Invalid"]
+
+1. e4 e5 2. Ke3 Nc6 1-0
+
+[Event "Ambiguous"]
+[FEN "4k3/8/8/8/8/8/8/1N1K1N2 w - - 0 1"]
+
+1. Nd2 *
+
+[Event "Castling and en passant"]
+
+1. e4 d5 2. e5 f5 3. exf6 Nxf6 4. d4 Bf5 5. Bd3 Qd6 6. Nc3 Nc6 7. Bd2 O-O-O
+8. Qe2 {a comment
+over two lines} Kb8 0-1
+
+1. d4 d5 2. c4 dxc4
+$pgn$) WITH ORDINALITY AS t(headers, moves, final, n);
+SELECT n, headers ->> 'Event' AS event, headers ->> 'White' AS white
+     , array_length(moves, 1) AS plies, %% final AS fen
+FROM pgn
+ORDER BY n;
+SELECT # %% m AS move, (%% m).ppc
+FROM pgn, unnest(moves) AS m
+WHERE n = 2;
+SELECT %% final = %% apply_moves(new_game(), moves) AS replayed
+FROM pgn
+WHERE n = 1;
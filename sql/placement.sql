@@ -0,0 +1,53 @@
+--
+-- Piece placement: patterns over chessboards and games, with and
+-- without a GIN index
+--
+CREATE TEMPORARY TABLE placement_positions AS
+SELECT id, fen :: chessboard AS b, %% fen AS g
+FROM (VALUES
+  (1, 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1')
+, (2, 'r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQ1RK1 w kq - 6 5')
+, (3, '8/5k2/4b3/8/3B4/8/5K2/8 w - - 0 1')
+, (4, '6k1/5ppp/8/4N3/8/8/5PPP/6K1 w - - 0 1')
+, (5, '8/5k2/3b4/8/3B4/8/5K2/8 w - - 0 1')
+, (6, '6k1/8/8/4n3/8/8/8/4K3 b - - 0 1')
+) AS t(id, fen);
+CREATE TEMPORARY TABLE placement_patterns AS
+SELECT * FROM (VALUES
+  (1, 'Ne5 kg8')
+, (2, 'Blight bdark')
+, (3, 'Bdark blight')
+, (4, 'Pe')
+, (5, 'p7')
+, (6, 'K')
+, (7, 'Qd1  qd8')
+, (8, 'n')
+, (9, 'Bd4 bdark')
+, (10, '')
+) AS t(n, pattern);
+SELECT n, pattern
+, ARRAY(SELECT id FROM placement_positions WHERE b @> pattern ORDER BY id) AS chessboards
+, ARRAY(SELECT id FROM placement_positions WHERE g @> pattern ORDER BY id) AS games
+FROM placement_patterns
+ORDER BY n;
+--
+-- The same queries, using the indexes
+--
+CREATE INDEX ON placement_positions USING gin (b);
+CREATE INDEX ON placement_positions USING gin (g game_placement_ops);
+SET enable_seqscan = off;
+SELECT n, pattern
+, ARRAY(SELECT id FROM placement_positions WHERE b @> pattern ORDER BY id) AS chessboards
+, ARRAY(SELECT id FROM placement_positions WHERE g @> pattern ORDER BY id) AS games
+FROM placement_patterns
+ORDER BY n;
+--
+-- Opposite-coloured bishops: one bishop each, on squares of different
+-- colours
+--
+SELECT id FROM placement_positions
+WHERE (b @> 'Blight bdark' OR b @> 'Bdark blight')
+  AND NOT (b @> 'Blight Bdark') AND NOT (b @> 'blight bdark')
+ORDER BY id;
+RESET enable_seqscan;
+SELECT 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1' :: chessboard @> 'Nz9';
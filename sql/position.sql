@@ -0,0 +1,75 @@
+--
+-- Positions: the same position reached by different move orders, and
+-- the position operator classes over games and chessboards
+--
+CREATE TEMPORARY TABLE position_games AS
+SELECT id, final AS g, chessboard(final) AS cb
+FROM (VALUES
+  (1, '1. e4 e5 2. Nf3 Nc6 *')
+, (2, '1. Nf3 Nc6 2. e4 e5 *')
+, (3, '1. Nf3 Nf6 2. Nc3 Nc6 *')
+, (4, '1. Nc3 Nc6 2. Nf3 Nf6 *')
+, (5, '1. e4 e5 2. Nf3 Nf6 *')
+, (6, '1. Nf3 Nf6 2. Ng1 Ng8 *')
+) AS t(id, pgn), pgn_import(pgn);
+SELECT a.id AS a, b.id AS b
+, a.g ~=~ b.g AS same
+, a.g = b.g AS same_game
+, position_hash(a.g) = position_hash(b.g) AS hash
+, position_cmp(a.g, b.g) = 0 AS cmp
+, a.cb = b.cb AS cb
+, position_hash(a.cb) = position_hash(b.cb) AS cb_hash
+, position_hash(a.cb) = position_hash(a.g) AS cb_game_hash
+, a.cb :: text = b.cb :: text AS same_fen
+FROM position_games a, position_games b
+WHERE (a.id, b.id) IN ((1, 2), (3, 4), (1, 5), (5, 6))
+ORDER BY 1, 2;
+--
+-- DISTINCT and GROUP BY over chessboards, hashed and sorted
+--
+SET enable_hashagg = on;
+SET enable_sort = off;
+SELECT count(*) FROM (SELECT DISTINCT cb FROM position_games) AS d;
+SELECT array_agg(id ORDER BY id) AS ids FROM position_games GROUP BY cb ORDER BY 1;
+RESET enable_sort;
+SET enable_hashagg = off;
+SELECT count(*) FROM (SELECT DISTINCT cb FROM position_games) AS d;
+SELECT array_agg(id ORDER BY id) AS ids FROM position_games GROUP BY cb ORDER BY 1;
+RESET enable_hashagg;
+--
+-- Hash and merge joins on chessboards
+--
+SET enable_nestloop = off;
+SET enable_mergejoin = off;
+SELECT a.id AS a, b.id AS b
+FROM position_games a JOIN position_games b ON a.cb = b.cb AND a.id < b.id
+ORDER BY 1, 2;
+SET enable_mergejoin = on;
+SET enable_hashjoin = off;
+SELECT a.id AS a, b.id AS b
+FROM position_games a JOIN position_games b ON a.cb = b.cb AND a.id < b.id
+ORDER BY 1, 2;
+RESET enable_nestloop;
+RESET enable_mergejoin;
+RESET enable_hashjoin;
+--
+-- Unique indexes, on chessboards and on games by position
+--
+\set VERBOSITY terse
+CREATE UNIQUE INDEX ON position_games (cb);
+CREATE UNIQUE INDEX ON position_games (g game_position_ops);
+\set VERBOSITY default
+CREATE TEMPORARY TABLE unique_positions AS
+SELECT id, g, cb FROM position_games WHERE id IN (1, 3, 5, 6);
+CREATE UNIQUE INDEX ON unique_positions (cb);
+CREATE UNIQUE INDEX ON unique_positions (g game_position_ops);
+INSERT INTO unique_positions (id, cb)
+VALUES (7, 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1');
+\set VERBOSITY terse
+INSERT INTO unique_positions (id, g)
+SELECT 8, final FROM pgn_import('1. Nf3 Nf6 2. e4 e5 *');
+\set VERBOSITY default
+SET enable_seqscan = off;
+SELECT u.id FROM unique_positions u, position_games p WHERE p.id = 2 AND u.cb = p.cb;
+SELECT u.id FROM unique_positions u, position_games p WHERE p.id = 4 AND u.g ~=~ p.g;
+RESET enable_seqscan;
@@ -0,0 +1,24 @@
+--
+-- Standard Algebraic Notation: the moves of a game in SAN, with
+-- captures, castling, en passant, promotions, check and mate
+--
+SELECT moves_to_san(new_game(), moves) AS san
+FROM pgn_import('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Bxc6 dxc6 5. O-O f6 6. d4 exd4
+7. Nxd4 c5 8. Nb3 Qxd1 9. Rxd1 Bg4 10. f3 Be6 11. Nc3 Bd6 12. Be3 O-O-O *');
+SELECT moves_to_san(new_game(), moves) AS san
+FROM pgn_import('1. f3 e5 2. g4 Qh4 *');
+SELECT moves_to_san(new_game(), moves) AS san
+FROM pgn_import('1. e4 d5 2. e5 f5 3. exf6 Nxf6 *');
+SELECT moves_to_san(%% '4k3/1P6/8/8/8/8/6p1/4K3 w - - 0 1', moves) AS san
+FROM pgn_import('[FEN "4k3/1P6/8/8/8/8/6p1/4K3 w - - 0 1"]
+1. b8=Q Ke7 2. Qb4 Kf7 3. Kf2 g1=N 4. Kxg1 Kg6 5. Qb6 *');
+--
+-- Disambiguation, by file, by rank or by both; over-disambiguated
+-- moves are accepted
+--
+WITH p AS (SELECT '1N2k3/8/8/1N1Q1Q2/8/1N3Q2/8/4K3 w - - 0 1' :: chessboard AS b)
+SELECT san, # san_to_move(b, san) AS move, move_to_san(b, san_to_move(b, san)) AS back
+FROM p, unnest(ARRAY['Qfd1', 'Qdd1', 'Qf5d3', 'Q3d3', 'Qd5d3', 'N3d4', 'Nb5d4', 'Qe2']) AS san;
+SELECT san_to_move(%% '1N2k3/8/8/1N1Q1Q2/8/1N3Q2/8/4K3 w - - 0 1', 'Qd3');
+SELECT san_to_move(%% '1N2k3/8/8/1N1Q1Q2/8/1N3Q2/8/4K3 w - - 0 1', 'Ke3');
+SELECT move_to_san(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', %% 2356 :: int2);
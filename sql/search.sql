@@ -0,0 +1,40 @@
+--
+-- Time-limited searches return a move, rather than an error, when
+-- they are stopped by hard_ms or by the statement_timeout
+--
+SELECT move IS NOT NULL AS has_move, array_length(pv, 1) > 0 AS has_pv
+FROM best_move(%% 'r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1', 30, 0, 50);
+SET statement_timeout = '1s';
+SELECT move IS NOT NULL AS has_move, completed_depth > 0 AS has_depth
+FROM best_move(%% 'r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1', 30);
+RESET statement_timeout;
+--
+-- Without a valid move there is nothing to return
+--
+SELECT move, pv
+FROM best_move(%% '7k/5Q2/6K1/8/8/8/8/8 b - - 0 1', 3, 0, 50);
+--
+-- Ordered moves: captures, promotions, checks, quiet moves
+--
+SELECT x1, y1, x2, y2, ppc, sort_key
+FROM valid_moves(%% '4k3/1P6/5r2/3q4/4N3/8/8/4K2R w K - 0 1', ordered => true)
+LIMIT 8;
+SELECT count(*) AS n, count(*) FILTER (WHERE sort_key > 0) AS not_quiet
+FROM valid_moves(%% '4k3/1P6/5r2/3q4/4N3/8/8/4K2R w K - 0 1', false);
+--
+-- Static exchange evaluation
+--
+WITH p(fen, san) AS (VALUES
+  ('1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1', 'Rxe5'),
+  ('1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1', 'Nxe5'),
+  ('1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1', 'Rxe5'),
+  ('4k3/8/8/3pP3/8/8/8/4K3 w - d6 0 2', 'exd6'),
+  ('3rk3/1P6/8/8/8/8/8/4K3 w - - 0 1', 'b8=Q'))
+SELECT san, see(%% fen, san_to_move(%% fen, san)) FROM p;
+--
+-- Attack maps and the evaluation terms computed from them
+--
+SELECT (attack_map(g))[1][37] AS white_e5, (attack_map(g))[2][37] AS black_e5
+FROM (SELECT %% '1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1' AS g) AS p;
+SELECT material, piece_square, mobility, attacked, king_safety, round(score :: numeric, 3) AS score
+FROM score_breakdown(%% '4k3/8/8/3n4/8/8/8/3RK3 w - - 0 1');
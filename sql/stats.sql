@@ -0,0 +1,13 @@
+--
+-- Engine statistics; other backends may add to the totals, so only
+-- whether they grow is checked
+--
+SELECT pgchess_stats_reset();
+SELECT perft(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1', 3);
+SELECT score_breakdown(%% 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1') IS NOT NULL AS evaluated;
+SELECT formal_moves > 0 AS formal_moves
+, legality_checks > 0 AS legality_checks
+, clones > 0 AS clones
+, evaluations > 0 AS evaluations
+, perft_ns > 0 AS perft_ns
+FROM pgchess_stats;
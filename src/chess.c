@@ -1,8 +1,42 @@
 #include "postgres.h"
 #include "fmgr.h"
 #include "funcapi.h"
+#include "access/gin.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
+#include "libpq/pqsignal.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+#if PG_VERSION_NUM >= 120000
+#include "utils/float.h"
+#endif
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
@@ -13,10 +47,26 @@ PG_MODULE_MAGIC;
 #include "access/htup_details.h"
 #endif
 
+#if PG_VERSION_NUM < 110000
+#define TupleDescAttr(tupdesc,i) ((tupdesc)->attrs[(i)])
+#endif
+
+#ifndef INSTR_TIME_GET_NANOSEC
+#define INSTR_TIME_GET_NANOSEC(t) (INSTR_TIME_GET_MICROSEC(t) * 1000)
+#endif
+
 /*
- * Memory context for formal_moves
+ * Sliding piece attacks are looked up with PEXT when the compiler
+ * targets BMI2 (e.g. -march=haswell), and with magic multiplication
+ * otherwise. Define CHESS_NO_PEXT to force magics: PEXT is microcoded,
+ * hence slow, on AMD processors before Zen 3.
  */
 
+#if defined(__BMI2__) && !defined(CHESS_NO_PEXT)
+#define USE_PEXT
+#include <immintrin.h>
+#endif
+
 /* 
  * a move (x1,x2) -> (y1,y2) is represented by four 3-bit integers
  * x1,x2,y1,y2 which are encoded as a single 12-bit integer. 
@@ -32,50 +82,911 @@ PG_MODULE_MAGIC;
 #define ChessMoveY1(x) (((x)/8)%8)
 #define ChessMoveX2(x) (((x)/64)%8)
 #define ChessMoveY2(x) (((x)/512)%8)
+#define ChessMoveSource(x) ((x)%64)
 #define ChessMoveTarget(x) (((x)/64)%64)
-#define ChessMoveID(x) ((x)%64)
-#define ChessMoveNextTarget(x) (((x)/64+1)*64)
 #define ChessMovePPC(x) (((x)/4096)%4)
 #define ChessMovePPCToChar(x) ((x) == 0 ? 'q' : ((x) == 1 ? 'b' : ((x) == 2 ? 'n' : 'r')))
 #define ChessMove(x1,y1,x2,y2,ppc) (x1+(y1)*8+(x2)*64+(y2)*512+(ppc)*4096)
+#define ChessMoveFromSquares(sq1,sq2,ppc) ((sq1)+(sq2)*64+(ppc)*4096)
+#define ChessMoveIsValid(x) ((x) >= 0 && (x) < 4*4096)
 #define ChessValidXY(x,y) (((x)<=7)&&((x)>=0)&&((y)<=7)&&((y)>=0))
-#define ChessIteratorFromTgId(tg,id) ((tg)*64+id)
 
 #define ChessVoidMove 0
 #define ChessFirstMove 1
 #define ChessEndOfMoves 16384
-#define ChessIteratorEnd 4096
-#define ChessMoveIDMax 29
+
+/* the results of aux_chess_san_to_move which are not moves */
+#define ChessSANInvalid (-1)
+#define ChessSANAmbiguous (-2)
+
+/* room for the longest SAN, such as "Qa1xb2+" or "exd8=Q#" */
+#define ChessSANSize 16
+
+/*
+ * Upper bound for the number of formal moves in a position. Legal
+ * positions have at most 218 legal moves; the extra room covers
+ * formal moves which leave the King in check, and positions loaded
+ * from FEN which could not arise in a real game.
+ */
+
+#define ChessMaxFormalMoves 512
+
+/*
+ * Bitboards
+ *
+ * A bitboard is a set of squares, represented as a 64-bit integer
+ * where square (x,y) is bit x + 8*y. This is the same numbering used
+ * by the "board" field of the game type and by the move encoding
+ * above, so ChessMoveSource and ChessMoveTarget are also bit indices.
+ */
+
+typedef uint64 ChessBitboard;
+
+#define ChessSquare(x,y) ((x)+(y)*8)
+#define ChessSquareX(sq) ((sq)%8)
+#define ChessSquareY(sq) ((sq)/8)
+#define ChessBit(sq) (((ChessBitboard) 1) << (sq))
+#define ChessPopCount(b) __builtin_popcountll(b)
+#define ChessFirstSquare(b) __builtin_ctzll(b)
+
+#define ChessRank1 UINT64CONST(0x00000000000000FF)
+#define ChessRank8 UINT64CONST(0xFF00000000000000)
+#define ChessFileA UINT64CONST(0x0101010101010101)
+#define ChessFileH UINT64CONST(0x8080808080808080)
+#define ChessRankOf(sq) (ChessRank1 << (8 * ChessSquareY(sq)))
+#define ChessFileOf(sq) (ChessFileA << ChessSquareX(sq))
+
+/* sides and piece types, used to index the bitboards */
+
+#define ChessWhite 0
+#define ChessBlack 1
+#define ChessPawn 0
+#define ChessKnight 1
+#define ChessBishop 2
+#define ChessRook 3
+#define ChessQueen 4
+#define ChessKing 5
+#define ChessPieceChar(side,type) ("PNBRQKpnbrqk"[(side)*6+(type)])
+
+/*
+ * Sliding attacks are precomputed for each square and each relevant
+ * occupancy of the squares between the slider and the edge of the
+ * board; the occupancy is mapped to an index either with PEXT or
+ * with a multiplication by a magic number.
+ */
+
+typedef struct
+{
+	ChessBitboard mask;
+	ChessBitboard magic;
+	ChessBitboard *attacks;
+	int shift;
+} chess_magic;
+
+#ifdef USE_PEXT
+#define ChessMagicIndex(m,occ) _pext_u64((occ), (m)->mask)
+#else
+#define ChessMagicIndex(m,occ) ((((occ) & (m)->mask) * (m)->magic) >> (m)->shift)
+#endif
+
+#define ChessRookAttacks(sq,occ)										\
+	(chess_rook_magics[sq].attacks[ChessMagicIndex(&chess_rook_magics[sq], occ)])
+#define ChessBishopAttacks(sq,occ)										\
+	(chess_bishop_magics[sq].attacks[ChessMagicIndex(&chess_bishop_magics[sq], occ)])
+
+static ChessBitboard chess_knight_attacks[64];
+static ChessBitboard chess_king_attacks[64];
+static ChessBitboard chess_pawn_attacks[2][64];
+static chess_magic chess_rook_magics[64];
+static chess_magic chess_bishop_magics[64];
+static ChessBitboard chess_rook_table[102400];
+static ChessBitboard chess_bishop_table[5248];
+static bool chess_tables_ready = false;
+
+/*
+ * Zobrist keys: the hash of a position is the XOR of the keys of its
+ * pieces, of its castling rights, of the file of its en passant target
+ * square and, when Black is to move, of chess_zobrist_black. They are
+ * pseudo-random numbers from a fixed seed, so that hashes are the same
+ * in every backend and can be stored.
+ */
+
+#define ChessZobristSeed UINT64CONST(0x9E3779B97F4A7C15)
+
+static uint64 chess_zobrist_pieces[2][6][64];
+static uint64 chess_zobrist_castling[4];
+static uint64 chess_zobrist_ep[8];
+static uint64 chess_zobrist_black;
+
+/*
+ * The transposition table lives in shared memory, so that all the
+ * backends share what they have computed. It is allocated only when
+ * the library is loaded via shared_preload_libraries; otherwise
+ * chess_tt is NULL, and every probe misses.
+ *
+ * It is lock-free: each entry stores its key XORed with its data, so
+ * that an entry torn by concurrent writers is detected as a miss
+ * (Hyatt and Mann, "A lock-less transposition table implementation
+ * for parallel search chess engines"). Buckets have two entries: the
+ * first one is replaced only by deeper results, the second one always.
+ */
+
+#define ChessTTBoundNone 0
+#define ChessTTBoundExact 1
+#define ChessTTBoundLower 2
+#define ChessTTBoundUpper 3
+
+/*
+ * Static evaluations are stored under the key of the position XORed
+ * with this, so that they do not mix with search results.
+ */
+#define ChessTTEvalKey UINT64CONST(0x5A0B3F1D7C2E6A49)
+
+typedef struct
+{
+	pg_atomic_uint64 check;		/* key ^ score ^ info */
+	pg_atomic_uint64 score;		/* the bits of a double */
+	pg_atomic_uint64 info;		/* move, depth and bound */
+} chess_tt_entry;
+
+#define ChessTTInfo(move,depth,bound)								\
+	((uint64) (move) | ((uint64) (uint8) (depth) << 16) | ((uint64) (bound) << 24))
+#define ChessTTInfoMove(i) ((int) ((i) & 0xFFFF))
+#define ChessTTInfoDepth(i) ((int) (int8) (((i) >> 16) & 0xFF))
+#define ChessTTInfoBound(i) ((int) (((i) >> 24) & 3))
+
+typedef struct
+{
+	uint64 n_buckets;
+	pg_atomic_uint64 hits;
+	pg_atomic_uint64 misses;
+	pg_atomic_uint64 stores;
+	pg_atomic_uint64 replacements;
+	chess_tt_entry entries[FLEXIBLE_ARRAY_MEMBER];	/* 2 per bucket */
+} chess_tt_shared;
+
+typedef struct
+{
+	double score;
+	int depth;
+	int bound;
+	int move;
+} chess_tt_data;
+
+/* the size in MB of the transposition table, 0 to disable it */
+static int chess_tt_size = 16;
+
+/* the number of background workers of a search or perft, 0 for none */
+static int chess_max_workers = 0;
+
+/* the path of the Polyglot opening book, empty for none */
+static char *chess_book_path = NULL;
+
+/*
+ * The opening book is mapped in memory by the first lookup of each
+ * backend, and mapped again only when the path or the file changes.
+ * Its entries are 16 bytes, sorted by key: the key, the move, the
+ * weight and a learning value, big endian.
+ */
+
+#define ChessBookEntrySize 16
+
+static char *chess_book_mapped_path = NULL;
+static struct stat chess_book_stat;
+static const unsigned char *chess_book_data = NULL;
+static Size chess_book_n = 0;
+
+static chess_tt_shared *chess_tt = NULL;
+
+/*
+ * Engine statistics. Each backend counts in chess_stats_pending, and
+ * adds its counts to the totals at the end of each transaction; the
+ * background workers of a search do it when they finish. The totals
+ * are in shared memory when the library is preloaded, and are those of
+ * the backend otherwise (then the counts of workers are lost).
+ *
+ * Move generation and evaluation are too short and too frequent to be
+ * timed always, so their times are only measured when
+ * pgchess.track_timing is on; evaluation includes the moves it
+ * generates. Searches and perft are always timed.
+ */
+
+#define ChessStatFormalMoves 0
+#define ChessStatLegalityChecks 1
+#define ChessStatClones 2
+#define ChessStatEvaluations 3
+#define ChessStatTTProbes 4
+#define ChessStatTTHits 5
+#define ChessStatSearchNodes 6
+#define ChessStatMoveGenNs 7
+#define ChessStatEvalNs 8
+#define ChessStatSearchNs 9
+#define ChessStatPerftNs 10
+#define ChessStatN 11
+
+typedef struct
+{
+	pg_atomic_uint64 counters[ChessStatN];
+} chess_stats_shared;
+
+static uint64 chess_stats_pending[ChessStatN];
+static chess_stats_shared chess_stats_local;
+static chess_stats_shared *chess_stats = &chess_stats_local;
+static bool chess_track_timing = false;
+
+#define ChessStatsAdd(i,n) (chess_stats_pending[(i)] += (n))
+
+#define ChessStatsTimerStart(t)											\
+	do {																\
+		if (chess_track_timing)											\
+			INSTR_TIME_SET_CURRENT(t);									\
+	} while (0)
+
+#define ChessStatsTimerStop(i,t)										\
+	do {																\
+		instr_time chess_stats_now;										\
+																		\
+		if (chess_track_timing)											\
+			{															\
+				INSTR_TIME_SET_CURRENT(chess_stats_now);				\
+				INSTR_TIME_SUBTRACT(chess_stats_now, t);				\
+				ChessStatsAdd(i, INSTR_TIME_GET_NANOSEC(chess_stats_now)); \
+			}															\
+	} while (0)
+static shmem_startup_hook_type chess_prev_shmem_startup_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type chess_prev_shmem_request_hook = NULL;
+#endif
+
+/*
+ * Magic numbers for each square. They were found by trying sparse
+ * random candidates until one mapped every occupancy of the mask to
+ * an index without destructive collisions.
+ */
+
+static const ChessBitboard chess_rook_magic_numbers[64] =
+	{
+		UINT64CONST(0x0A80004000801220), UINT64CONST(0x8040004010002008),
+		UINT64CONST(0x2080200010008008), UINT64CONST(0x1100100008210004),
+		UINT64CONST(0xC200209084020008), UINT64CONST(0x2100010004000208),
+		UINT64CONST(0x0400081000822421), UINT64CONST(0x0200010422048844),
+		UINT64CONST(0x0800800080400024), UINT64CONST(0x0001402000401000),
+		UINT64CONST(0x3000801000802001), UINT64CONST(0x4400800800100083),
+		UINT64CONST(0x0904802402480080), UINT64CONST(0x4040800400020080),
+		UINT64CONST(0x0018808042000100), UINT64CONST(0x4040800080004100),
+		UINT64CONST(0x0040048001458024), UINT64CONST(0x00A0004000205000),
+		UINT64CONST(0x3100808010002000), UINT64CONST(0x4825010010000820),
+		UINT64CONST(0x5004808008000401), UINT64CONST(0x2024818004000A00),
+		UINT64CONST(0x0005808002000100), UINT64CONST(0x2100060004806104),
+		UINT64CONST(0x0080400880008421), UINT64CONST(0x4062220600410280),
+		UINT64CONST(0x010A004A00108022), UINT64CONST(0x0000100080080080),
+		UINT64CONST(0x0021000500080010), UINT64CONST(0x0044000202001008),
+		UINT64CONST(0x0000100400080102), UINT64CONST(0xC020128200040545),
+		UINT64CONST(0x0080002000400040), UINT64CONST(0x0000804000802004),
+		UINT64CONST(0x0000120022004080), UINT64CONST(0x010A386103001001),
+		UINT64CONST(0x9010080080800400), UINT64CONST(0x8440020080800400),
+		UINT64CONST(0x0004228824001001), UINT64CONST(0x000000490A000084),
+		UINT64CONST(0x0080002000504000), UINT64CONST(0x200020005000C000),
+		UINT64CONST(0x0012088020420010), UINT64CONST(0x0010010080080800),
+		UINT64CONST(0x0085001008010004), UINT64CONST(0x0002000204008080),
+		UINT64CONST(0x0040413002040008), UINT64CONST(0x0000304081020004),
+		UINT64CONST(0x0080204000800080), UINT64CONST(0x3008804000290100),
+		UINT64CONST(0x1010100080200080), UINT64CONST(0x2008100208028080),
+		UINT64CONST(0x5000850800910100), UINT64CONST(0x8402019004680200),
+		UINT64CONST(0x0120911028020400), UINT64CONST(0x0000008044010200),
+		UINT64CONST(0x0020850200244012), UINT64CONST(0x0020850200244012),
+		UINT64CONST(0x0000102001040841), UINT64CONST(0x140900040A100021),
+		UINT64CONST(0x000200282410A102), UINT64CONST(0x000200282410A102),
+		UINT64CONST(0x000200282410A102), UINT64CONST(0x4048240043802106)
+	};
+
+static const ChessBitboard chess_bishop_magic_numbers[64] =
+	{
+		UINT64CONST(0x40106000A1160020), UINT64CONST(0x0020010250810120),
+		UINT64CONST(0x2010010220280081), UINT64CONST(0x002806004050C040),
+		UINT64CONST(0x0002021018000000), UINT64CONST(0x2001112010000400),
+		UINT64CONST(0x0881010120218080), UINT64CONST(0x1030820110010500),
+		UINT64CONST(0x0000120222042400), UINT64CONST(0x2000020404040044),
+		UINT64CONST(0x8000480094208000), UINT64CONST(0x0003422A02000001),
+		UINT64CONST(0x000A220210100040), UINT64CONST(0x8004820202226000),
+		UINT64CONST(0x0018234854100800), UINT64CONST(0x0100004042101040),
+		UINT64CONST(0x0004001004082820), UINT64CONST(0x0010000810010048),
+		UINT64CONST(0x1014004208081300), UINT64CONST(0x2080818802044202),
+		UINT64CONST(0x0040880C00A00100), UINT64CONST(0x0080400200522010),
+		UINT64CONST(0x0001000188180B04), UINT64CONST(0x0080249202020204),
+		UINT64CONST(0x1004400004100410), UINT64CONST(0x00013100A0022206),
+		UINT64CONST(0x2148500001040080), UINT64CONST(0x4241080011004300),
+		UINT64CONST(0x4020848004002000), UINT64CONST(0x10101380D1004100),
+		UINT64CONST(0x0008004422020284), UINT64CONST(0x01010A1041008080),
+		UINT64CONST(0x0808080400082121), UINT64CONST(0x0808080400082121),
+		UINT64CONST(0x0091128200100C00), UINT64CONST(0x0202200802010104),
+		UINT64CONST(0x8C0A020200440085), UINT64CONST(0x01A0008080B10040),
+		UINT64CONST(0x0889520080122800), UINT64CONST(0x100902022202010A),
+		UINT64CONST(0x04081A0816002000), UINT64CONST(0x0000681208005000),
+		UINT64CONST(0x8170840041008802), UINT64CONST(0x0A00004200810805),
+		UINT64CONST(0x0830404408210100), UINT64CONST(0x2602208106006102),
+		UINT64CONST(0x1048300680802628), UINT64CONST(0x2602208106006102),
+		UINT64CONST(0x0602010120110040), UINT64CONST(0x0941010801043000),
+		UINT64CONST(0x000040440A210428), UINT64CONST(0x0008240020880021),
+		UINT64CONST(0x0400002012048200), UINT64CONST(0x00AC102001210220),
+		UINT64CONST(0x0220021002009900), UINT64CONST(0x84440C080A013080),
+		UINT64CONST(0x0001008044200440), UINT64CONST(0x0004C04410841000),
+		UINT64CONST(0x2000500104011130), UINT64CONST(0x1A0C010011C20229),
+		UINT64CONST(0x0044800112202200), UINT64CONST(0x0434804908100424),
+		UINT64CONST(0x0300404822C08200), UINT64CONST(0x48081010008A2A80)
+	};
+
+/*
+ * Polyglot opening books are keyed by Zobrist hashes too, but with
+ * the fixed keys below, from the Polyglot book format: 64 for each
+ * kind of piece, in the order black pawn, white pawn, black knight,
+ * ..., white king; 4 for the castling rights, in FEN order; 8 for the
+ * file of the en passant target square; 1 for White to move.
+ */
+
+#define ChessPolyglotPiece(side,t,sq) (64 * (2 * (t) + 1 - (side)) + (sq))
+#define ChessPolyglotCastling 768
+#define ChessPolyglotEP 772
+#define ChessPolyglotTurn 780
+
+static const uint64 chess_polyglot_random[781] =
+	{
+		UINT64CONST(0x9D39247E33776D41), UINT64CONST(0x2AF7398005AAA5C7),
+		UINT64CONST(0x44DB015024623547), UINT64CONST(0x9C15F73E62A76AE2),
+		UINT64CONST(0x75834465489C0C89), UINT64CONST(0x3290AC3A203001BF),
+		UINT64CONST(0x0FBBAD1F61042279), UINT64CONST(0xE83A908FF2FB60CA),
+		UINT64CONST(0x0D7E765D58755C10), UINT64CONST(0x1A083822CEAFE02D),
+		UINT64CONST(0x9605D5F0E25EC3B0), UINT64CONST(0xD021FF5CD13A2ED5),
+		UINT64CONST(0x40BDF15D4A672E32), UINT64CONST(0x011355146FD56395),
+		UINT64CONST(0x5DB4832046F3D9E5), UINT64CONST(0x239F8B2D7FF719CC),
+		UINT64CONST(0x05D1A1AE85B49AA1), UINT64CONST(0x679F848F6E8FC971),
+		UINT64CONST(0x7449BBFF801FED0B), UINT64CONST(0x7D11CDB1C3B7ADF0),
+		UINT64CONST(0x82C7709E781EB7CC), UINT64CONST(0xF3218F1C9510786C),
+		UINT64CONST(0x331478F3AF51BBE6), UINT64CONST(0x4BB38DE5E7219443),
+		UINT64CONST(0xAA649C6EBCFD50FC), UINT64CONST(0x8DBD98A352AFD40B),
+		UINT64CONST(0x87D2074B81D79217), UINT64CONST(0x19F3C751D3E92AE1),
+		UINT64CONST(0xB4AB30F062B19ABF), UINT64CONST(0x7B0500AC42047AC4),
+		UINT64CONST(0xC9452CA81A09D85D), UINT64CONST(0x24AA6C514DA27500),
+		UINT64CONST(0x4C9F34427501B447), UINT64CONST(0x14A68FD73C910841),
+		UINT64CONST(0xA71B9B83461CBD93), UINT64CONST(0x03488B95B0F1850F),
+		UINT64CONST(0x637B2B34FF93C040), UINT64CONST(0x09D1BC9A3DD90A94),
+		UINT64CONST(0x3575668334A1DD3B), UINT64CONST(0x735E2B97A4C45A23),
+		UINT64CONST(0x18727070F1BD400B), UINT64CONST(0x1FCBACD259BF02E7),
+		UINT64CONST(0xD310A7C2CE9B6555), UINT64CONST(0xBF983FE0FE5D8244),
+		UINT64CONST(0x9F74D14F7454A824), UINT64CONST(0x51EBDC4AB9BA3035),
+		UINT64CONST(0x5C82C505DB9AB0FA), UINT64CONST(0xFCF7FE8A3430B241),
+		UINT64CONST(0x3253A729B9BA3DDE), UINT64CONST(0x8C74C368081B3075),
+		UINT64CONST(0xB9BC6C87167C33E7), UINT64CONST(0x7EF48F2B83024E20),
+		UINT64CONST(0x11D505D4C351BD7F), UINT64CONST(0x6568FCA92C76A243),
+		UINT64CONST(0x4DE0B0F40F32A7B8), UINT64CONST(0x96D693460CC37E5D),
+		UINT64CONST(0x42E240CB63689F2F), UINT64CONST(0x6D2BDCDAE2919661),
+		UINT64CONST(0x42880B0236E4D951), UINT64CONST(0x5F0F4A5898171BB6),
+		UINT64CONST(0x39F890F579F92F88), UINT64CONST(0x93C5B5F47356388B),
+		UINT64CONST(0x63DC359D8D231B78), UINT64CONST(0xEC16CA8AEA98AD76),
+		UINT64CONST(0x5355F900C2A82DC7), UINT64CONST(0x07FB9F855A997142),
+		UINT64CONST(0x5093417AA8A7ED5E), UINT64CONST(0x7BCBC38DA25A7F3C),
+		UINT64CONST(0x19FC8A768CF4B6D4), UINT64CONST(0x637A7780DECFC0D9),
+		UINT64CONST(0x8249A47AEE0E41F7), UINT64CONST(0x79AD695501E7D1E8),
+		UINT64CONST(0x14ACBAF4777D5776), UINT64CONST(0xF145B6BECCDEA195),
+		UINT64CONST(0xDABF2AC8201752FC), UINT64CONST(0x24C3C94DF9C8D3F6),
+		UINT64CONST(0xBB6E2924F03912EA), UINT64CONST(0x0CE26C0B95C980D9),
+		UINT64CONST(0xA49CD132BFBF7CC4), UINT64CONST(0xE99D662AF4243939),
+		UINT64CONST(0x27E6AD7891165C3F), UINT64CONST(0x8535F040B9744FF1),
+		UINT64CONST(0x54B3F4FA5F40D873), UINT64CONST(0x72B12C32127FED2B),
+		UINT64CONST(0xEE954D3C7B411F47), UINT64CONST(0x9A85AC909A24EAA1),
+		UINT64CONST(0x70AC4CD9F04F21F5), UINT64CONST(0xF9B89D3E99A075C2),
+		UINT64CONST(0x87B3E2B2B5C907B1), UINT64CONST(0xA366E5B8C54F48B8),
+		UINT64CONST(0xAE4A9346CC3F7CF2), UINT64CONST(0x1920C04D47267BBD),
+		UINT64CONST(0x87BF02C6B49E2AE9), UINT64CONST(0x092237AC237F3859),
+		UINT64CONST(0xFF07F64EF8ED14D0), UINT64CONST(0x8DE8DCA9F03CC54E),
+		UINT64CONST(0x9C1633264DB49C89), UINT64CONST(0xB3F22C3D0B0B38ED),
+		UINT64CONST(0x390E5FB44D01144B), UINT64CONST(0x5BFEA5B4712768E9),
+		UINT64CONST(0x1E1032911FA78984), UINT64CONST(0x9A74ACB964E78CB3),
+		UINT64CONST(0x4F80F7A035DAFB04), UINT64CONST(0x6304D09A0B3738C4),
+		UINT64CONST(0x2171E64683023A08), UINT64CONST(0x5B9B63EB9CEFF80C),
+		UINT64CONST(0x506AACF489889342), UINT64CONST(0x1881AFC9A3A701D6),
+		UINT64CONST(0x6503080440750644), UINT64CONST(0xDFD395339CDBF4A7),
+		UINT64CONST(0xEF927DBCF00C20F2), UINT64CONST(0x7B32F7D1E03680EC),
+		UINT64CONST(0xB9FD7620E7316243), UINT64CONST(0x05A7E8A57DB91B77),
+		UINT64CONST(0xB5889C6E15630A75), UINT64CONST(0x4A750A09CE9573F7),
+		UINT64CONST(0xCF464CEC899A2F8A), UINT64CONST(0xF538639CE705B824),
+		UINT64CONST(0x3C79A0FF5580EF7F), UINT64CONST(0xEDE6C87F8477609D),
+		UINT64CONST(0x799E81F05BC93F31), UINT64CONST(0x86536B8CF3428A8C),
+		UINT64CONST(0x97D7374C60087B73), UINT64CONST(0xA246637CFF328532),
+		UINT64CONST(0x043FCAE60CC0EBA0), UINT64CONST(0x920E449535DD359E),
+		UINT64CONST(0x70EB093B15B290CC), UINT64CONST(0x73A1921916591CBD),
+		UINT64CONST(0x56436C9FE1A1AA8D), UINT64CONST(0xEFAC4B70633B8F81),
+		UINT64CONST(0xBB215798D45DF7AF), UINT64CONST(0x45F20042F24F1768),
+		UINT64CONST(0x930F80F4E8EB7462), UINT64CONST(0xFF6712FFCFD75EA1),
+		UINT64CONST(0xAE623FD67468AA70), UINT64CONST(0xDD2C5BC84BC8D8FC),
+		UINT64CONST(0x7EED120D54CF2DD9), UINT64CONST(0x22FE545401165F1C),
+		UINT64CONST(0xC91800E98FB99929), UINT64CONST(0x808BD68E6AC10365),
+		UINT64CONST(0xDEC468145B7605F6), UINT64CONST(0x1BEDE3A3AEF53302),
+		UINT64CONST(0x43539603D6C55602), UINT64CONST(0xAA969B5C691CCB7A),
+		UINT64CONST(0xA87832D392EFEE56), UINT64CONST(0x65942C7B3C7E11AE),
+		UINT64CONST(0xDED2D633CAD004F6), UINT64CONST(0x21F08570F420E565),
+		UINT64CONST(0xB415938D7DA94E3C), UINT64CONST(0x91B859E59ECB6350),
+		UINT64CONST(0x10CFF333E0ED804A), UINT64CONST(0x28AED140BE0BB7DD),
+		UINT64CONST(0xC5CC1D89724FA456), UINT64CONST(0x5648F680F11A2741),
+		UINT64CONST(0x2D255069F0B7DAB3), UINT64CONST(0x9BC5A38EF729ABD4),
+		UINT64CONST(0xEF2F054308F6A2BC), UINT64CONST(0xAF2042F5CC5C2858),
+		UINT64CONST(0x480412BAB7F5BE2A), UINT64CONST(0xAEF3AF4A563DFE43),
+		UINT64CONST(0x19AFE59AE451497F), UINT64CONST(0x52593803DFF1E840),
+		UINT64CONST(0xF4F076E65F2CE6F0), UINT64CONST(0x11379625747D5AF3),
+		UINT64CONST(0xBCE5D2248682C115), UINT64CONST(0x9DA4243DE836994F),
+		UINT64CONST(0x066F70B33FE09017), UINT64CONST(0x4DC4DE189B671A1C),
+		UINT64CONST(0x51039AB7712457C3), UINT64CONST(0xC07A3F80C31FB4B4),
+		UINT64CONST(0xB46EE9C5E64A6E7C), UINT64CONST(0xB3819A42ABE61C87),
+		UINT64CONST(0x21A007933A522A20), UINT64CONST(0x2DF16F761598AA4F),
+		UINT64CONST(0x763C4A1371B368FD), UINT64CONST(0xF793C46702E086A0),
+		UINT64CONST(0xD7288E012AEB8D31), UINT64CONST(0xDE336A2A4BC1C44B),
+		UINT64CONST(0x0BF692B38D079F23), UINT64CONST(0x2C604A7A177326B3),
+		UINT64CONST(0x4850E73E03EB6064), UINT64CONST(0xCFC447F1E53C8E1B),
+		UINT64CONST(0xB05CA3F564268D99), UINT64CONST(0x9AE182C8BC9474E8),
+		UINT64CONST(0xA4FC4BD4FC5558CA), UINT64CONST(0xE755178D58FC4E76),
+		UINT64CONST(0x69B97DB1A4C03DFE), UINT64CONST(0xF9B5B7C4ACC67C96),
+		UINT64CONST(0xFC6A82D64B8655FB), UINT64CONST(0x9C684CB6C4D24417),
+		UINT64CONST(0x8EC97D2917456ED0), UINT64CONST(0x6703DF9D2924E97E),
+		UINT64CONST(0xC547F57E42A7444E), UINT64CONST(0x78E37644E7CAD29E),
+		UINT64CONST(0xFE9A44E9362F05FA), UINT64CONST(0x08BD35CC38336615),
+		UINT64CONST(0x9315E5EB3A129ACE), UINT64CONST(0x94061B871E04DF75),
+		UINT64CONST(0xDF1D9F9D784BA010), UINT64CONST(0x3BBA57B68871B59D),
+		UINT64CONST(0xD2B7ADEEDED1F73F), UINT64CONST(0xF7A255D83BC373F8),
+		UINT64CONST(0xD7F4F2448C0CEB81), UINT64CONST(0xD95BE88CD210FFA7),
+		UINT64CONST(0x336F52F8FF4728E7), UINT64CONST(0xA74049DAC312AC71),
+		UINT64CONST(0xA2F61BB6E437FDB5), UINT64CONST(0x4F2A5CB07F6A35B3),
+		UINT64CONST(0x87D380BDA5BF7859), UINT64CONST(0x16B9F7E06C453A21),
+		UINT64CONST(0x7BA2484C8A0FD54E), UINT64CONST(0xF3A678CAD9A2E38C),
+		UINT64CONST(0x39B0BF7DDE437BA2), UINT64CONST(0xFCAF55C1BF8A4424),
+		UINT64CONST(0x18FCF680573FA594), UINT64CONST(0x4C0563B89F495AC3),
+		UINT64CONST(0x40E087931A00930D), UINT64CONST(0x8CFFA9412EB642C1),
+		UINT64CONST(0x68CA39053261169F), UINT64CONST(0x7A1EE967D27579E2),
+		UINT64CONST(0x9D1D60E5076F5B6F), UINT64CONST(0x3810E399B6F65BA2),
+		UINT64CONST(0x32095B6D4AB5F9B1), UINT64CONST(0x35CAB62109DD038A),
+		UINT64CONST(0xA90B24499FCFAFB1), UINT64CONST(0x77A225A07CC2C6BD),
+		UINT64CONST(0x513E5E634C70E331), UINT64CONST(0x4361C0CA3F692F12),
+		UINT64CONST(0xD941ACA44B20A45B), UINT64CONST(0x528F7C8602C5807B),
+		UINT64CONST(0x52AB92BEB9613989), UINT64CONST(0x9D1DFA2EFC557F73),
+		UINT64CONST(0x722FF175F572C348), UINT64CONST(0x1D1260A51107FE97),
+		UINT64CONST(0x7A249A57EC0C9BA2), UINT64CONST(0x04208FE9E8F7F2D6),
+		UINT64CONST(0x5A110C6058B920A0), UINT64CONST(0x0CD9A497658A5698),
+		UINT64CONST(0x56FD23C8F9715A4C), UINT64CONST(0x284C847B9D887AAE),
+		UINT64CONST(0x04FEABFBBDB619CB), UINT64CONST(0x742E1E651C60BA83),
+		UINT64CONST(0x9A9632E65904AD3C), UINT64CONST(0x881B82A13B51B9E2),
+		UINT64CONST(0x506E6744CD974924), UINT64CONST(0xB0183DB56FFC6A79),
+		UINT64CONST(0x0ED9B915C66ED37E), UINT64CONST(0x5E11E86D5873D484),
+		UINT64CONST(0xF678647E3519AC6E), UINT64CONST(0x1B85D488D0F20CC5),
+		UINT64CONST(0xDAB9FE6525D89021), UINT64CONST(0x0D151D86ADB73615),
+		UINT64CONST(0xA865A54EDCC0F019), UINT64CONST(0x93C42566AEF98FFB),
+		UINT64CONST(0x99E7AFEABE000731), UINT64CONST(0x48CBFF086DDF285A),
+		UINT64CONST(0x7F9B6AF1EBF78BAF), UINT64CONST(0x58627E1A149BBA21),
+		UINT64CONST(0x2CD16E2ABD791E33), UINT64CONST(0xD363EFF5F0977996),
+		UINT64CONST(0x0CE2A38C344A6EED), UINT64CONST(0x1A804AADB9CFA741),
+		UINT64CONST(0x907F30421D78C5DE), UINT64CONST(0x501F65EDB3034D07),
+		UINT64CONST(0x37624AE5A48FA6E9), UINT64CONST(0x957BAF61700CFF4E),
+		UINT64CONST(0x3A6C27934E31188A), UINT64CONST(0xD49503536ABCA345),
+		UINT64CONST(0x088E049589C432E0), UINT64CONST(0xF943AEE7FEBF21B8),
+		UINT64CONST(0x6C3B8E3E336139D3), UINT64CONST(0x364F6FFA464EE52E),
+		UINT64CONST(0xD60F6DCEDC314222), UINT64CONST(0x56963B0DCA418FC0),
+		UINT64CONST(0x16F50EDF91E513AF), UINT64CONST(0xEF1955914B609F93),
+		UINT64CONST(0x565601C0364E3228), UINT64CONST(0xECB53939887E8175),
+		UINT64CONST(0xBAC7A9A18531294B), UINT64CONST(0xB344C470397BBA52),
+		UINT64CONST(0x65D34954DAF3CEBD), UINT64CONST(0xB4B81B3FA97511E2),
+		UINT64CONST(0xB422061193D6F6A7), UINT64CONST(0x071582401C38434D),
+		UINT64CONST(0x7A13F18BBEDC4FF5), UINT64CONST(0xBC4097B116C524D2),
+		UINT64CONST(0x59B97885E2F2EA28), UINT64CONST(0x99170A5DC3115544),
+		UINT64CONST(0x6F423357E7C6A9F9), UINT64CONST(0x325928EE6E6F8794),
+		UINT64CONST(0xD0E4366228B03343), UINT64CONST(0x565C31F7DE89EA27),
+		UINT64CONST(0x30F5611484119414), UINT64CONST(0xD873DB391292ED4F),
+		UINT64CONST(0x7BD94E1D8E17DEBC), UINT64CONST(0xC7D9F16864A76E94),
+		UINT64CONST(0x947AE053EE56E63C), UINT64CONST(0xC8C93882F9475F5F),
+		UINT64CONST(0x3A9BF55BA91F81CA), UINT64CONST(0xD9A11FBB3D9808E4),
+		UINT64CONST(0x0FD22063EDC29FCA), UINT64CONST(0xB3F256D8ACA0B0B9),
+		UINT64CONST(0xB03031A8B4516E84), UINT64CONST(0x35DD37D5871448AF),
+		UINT64CONST(0xE9F6082B05542E4E), UINT64CONST(0xEBFAFA33D7254B59),
+		UINT64CONST(0x9255ABB50D532280), UINT64CONST(0xB9AB4CE57F2D34F3),
+		UINT64CONST(0x693501D628297551), UINT64CONST(0xC62C58F97DD949BF),
+		UINT64CONST(0xCD454F8F19C5126A), UINT64CONST(0xBBE83F4ECC2BDECB),
+		UINT64CONST(0xDC842B7E2819E230), UINT64CONST(0xBA89142E007503B8),
+		UINT64CONST(0xA3BC941D0A5061CB), UINT64CONST(0xE9F6760E32CD8021),
+		UINT64CONST(0x09C7E552BC76492F), UINT64CONST(0x852F54934DA55CC9),
+		UINT64CONST(0x8107FCCF064FCF56), UINT64CONST(0x098954D51FFF6580),
+		UINT64CONST(0x23B70EDB1955C4BF), UINT64CONST(0xC330DE426430F69D),
+		UINT64CONST(0x4715ED43E8A45C0A), UINT64CONST(0xA8D7E4DAB780A08D),
+		UINT64CONST(0x0572B974F03CE0BB), UINT64CONST(0xB57D2E985E1419C7),
+		UINT64CONST(0xE8D9ECBE2CF3D73F), UINT64CONST(0x2FE4B17170E59750),
+		UINT64CONST(0x11317BA87905E790), UINT64CONST(0x7FBF21EC8A1F45EC),
+		UINT64CONST(0x1725CABFCB045B00), UINT64CONST(0x964E915CD5E2B207),
+		UINT64CONST(0x3E2B8BCBF016D66D), UINT64CONST(0xBE7444E39328A0AC),
+		UINT64CONST(0xF85B2B4FBCDE44B7), UINT64CONST(0x49353FEA39BA63B1),
+		UINT64CONST(0x1DD01AAFCD53486A), UINT64CONST(0x1FCA8A92FD719F85),
+		UINT64CONST(0xFC7C95D827357AFA), UINT64CONST(0x18A6A990C8B35EBD),
+		UINT64CONST(0xCCCB7005C6B9C28D), UINT64CONST(0x3BDBB92C43B17F26),
+		UINT64CONST(0xAA70B5B4F89695A2), UINT64CONST(0xE94C39A54A98307F),
+		UINT64CONST(0xB7A0B174CFF6F36E), UINT64CONST(0xD4DBA84729AF48AD),
+		UINT64CONST(0x2E18BC1AD9704A68), UINT64CONST(0x2DE0966DAF2F8B1C),
+		UINT64CONST(0xB9C11D5B1E43A07E), UINT64CONST(0x64972D68DEE33360),
+		UINT64CONST(0x94628D38D0C20584), UINT64CONST(0xDBC0D2B6AB90A559),
+		UINT64CONST(0xD2733C4335C6A72F), UINT64CONST(0x7E75D99D94A70F4D),
+		UINT64CONST(0x6CED1983376FA72B), UINT64CONST(0x97FCAACBF030BC24),
+		UINT64CONST(0x7B77497B32503B12), UINT64CONST(0x8547EDDFB81CCB94),
+		UINT64CONST(0x79999CDFF70902CB), UINT64CONST(0xCFFE1939438E9B24),
+		UINT64CONST(0x829626E3892D95D7), UINT64CONST(0x92FAE24291F2B3F1),
+		UINT64CONST(0x63E22C147B9C3403), UINT64CONST(0xC678B6D860284A1C),
+		UINT64CONST(0x5873888850659AE7), UINT64CONST(0x0981DCD296A8736D),
+		UINT64CONST(0x9F65789A6509A440), UINT64CONST(0x9FF38FED72E9052F),
+		UINT64CONST(0xE479EE5B9930578C), UINT64CONST(0xE7F28ECD2D49EECD),
+		UINT64CONST(0x56C074A581EA17FE), UINT64CONST(0x5544F7D774B14AEF),
+		UINT64CONST(0x7B3F0195FC6F290F), UINT64CONST(0x12153635B2C0CF57),
+		UINT64CONST(0x7F5126DBBA5E0CA7), UINT64CONST(0x7A76956C3EAFB413),
+		UINT64CONST(0x3D5774A11D31AB39), UINT64CONST(0x8A1B083821F40CB4),
+		UINT64CONST(0x7B4A38E32537DF62), UINT64CONST(0x950113646D1D6E03),
+		UINT64CONST(0x4DA8979A0041E8A9), UINT64CONST(0x3BC36E078F7515D7),
+		UINT64CONST(0x5D0A12F27AD310D1), UINT64CONST(0x7F9D1A2E1EBE1327),
+		UINT64CONST(0xDA3A361B1C5157B1), UINT64CONST(0xDCDD7D20903D0C25),
+		UINT64CONST(0x36833336D068F707), UINT64CONST(0xCE68341F79893389),
+		UINT64CONST(0xAB9090168DD05F34), UINT64CONST(0x43954B3252DC25E5),
+		UINT64CONST(0xB438C2B67F98E5E9), UINT64CONST(0x10DCD78E3851A492),
+		UINT64CONST(0xDBC27AB5447822BF), UINT64CONST(0x9B3CDB65F82CA382),
+		UINT64CONST(0xB67B7896167B4C84), UINT64CONST(0xBFCED1B0048EAC50),
+		UINT64CONST(0xA9119B60369FFEBD), UINT64CONST(0x1FFF7AC80904BF45),
+		UINT64CONST(0xAC12FB171817EEE7), UINT64CONST(0xAF08DA9177DDA93D),
+		UINT64CONST(0x1B0CAB936E65C744), UINT64CONST(0xB559EB1D04E5E932),
+		UINT64CONST(0xC37B45B3F8D6F2BA), UINT64CONST(0xC3A9DC228CAAC9E9),
+		UINT64CONST(0xF3B8B6675A6507FF), UINT64CONST(0x9FC477DE4ED681DA),
+		UINT64CONST(0x67378D8ECCEF96CB), UINT64CONST(0x6DD856D94D259236),
+		UINT64CONST(0xA319CE15B0B4DB31), UINT64CONST(0x073973751F12DD5E),
+		UINT64CONST(0x8A8E849EB32781A5), UINT64CONST(0xE1925C71285279F5),
+		UINT64CONST(0x74C04BF1790C0EFE), UINT64CONST(0x4DDA48153C94938A),
+		UINT64CONST(0x9D266D6A1CC0542C), UINT64CONST(0x7440FB816508C4FE),
+		UINT64CONST(0x13328503DF48229F), UINT64CONST(0xD6BF7BAEE43CAC40),
+		UINT64CONST(0x4838D65F6EF6748F), UINT64CONST(0x1E152328F3318DEA),
+		UINT64CONST(0x8F8419A348F296BF), UINT64CONST(0x72C8834A5957B511),
+		UINT64CONST(0xD7A023A73260B45C), UINT64CONST(0x94EBC8ABCFB56DAE),
+		UINT64CONST(0x9FC10D0F989993E0), UINT64CONST(0xDE68A2355B93CAE6),
+		UINT64CONST(0xA44CFE79AE538BBE), UINT64CONST(0x9D1D84FCCE371425),
+		UINT64CONST(0x51D2B1AB2DDFB636), UINT64CONST(0x2FD7E4B9E72CD38C),
+		UINT64CONST(0x65CA5B96B7552210), UINT64CONST(0xDD69A0D8AB3B546D),
+		UINT64CONST(0x604D51B25FBF70E2), UINT64CONST(0x73AA8A564FB7AC9E),
+		UINT64CONST(0x1A8C1E992B941148), UINT64CONST(0xAAC40A2703D9BEA0),
+		UINT64CONST(0x764DBEAE7FA4F3A6), UINT64CONST(0x1E99B96E70A9BE8B),
+		UINT64CONST(0x2C5E9DEB57EF4743), UINT64CONST(0x3A938FEE32D29981),
+		UINT64CONST(0x26E6DB8FFDF5ADFE), UINT64CONST(0x469356C504EC9F9D),
+		UINT64CONST(0xC8763C5B08D1908C), UINT64CONST(0x3F6C6AF859D80055),
+		UINT64CONST(0x7F7CC39420A3A545), UINT64CONST(0x9BFB227EBDF4C5CE),
+		UINT64CONST(0x89039D79D6FC5C5C), UINT64CONST(0x8FE88B57305E2AB6),
+		UINT64CONST(0xA09E8C8C35AB96DE), UINT64CONST(0xFA7E393983325753),
+		UINT64CONST(0xD6B6D0ECC617C699), UINT64CONST(0xDFEA21EA9E7557E3),
+		UINT64CONST(0xB67C1FA481680AF8), UINT64CONST(0xCA1E3785A9E724E5),
+		UINT64CONST(0x1CFC8BED0D681639), UINT64CONST(0xD18D8549D140CAEA),
+		UINT64CONST(0x4ED0FE7E9DC91335), UINT64CONST(0xE4DBF0634473F5D2),
+		UINT64CONST(0x1761F93A44D5AEFE), UINT64CONST(0x53898E4C3910DA55),
+		UINT64CONST(0x734DE8181F6EC39A), UINT64CONST(0x2680B122BAA28D97),
+		UINT64CONST(0x298AF231C85BAFAB), UINT64CONST(0x7983EED3740847D5),
+		UINT64CONST(0x66C1A2A1A60CD889), UINT64CONST(0x9E17E49642A3E4C1),
+		UINT64CONST(0xEDB454E7BADC0805), UINT64CONST(0x50B704CAB602C329),
+		UINT64CONST(0x4CC317FB9CDDD023), UINT64CONST(0x66B4835D9EAFEA22),
+		UINT64CONST(0x219B97E26FFC81BD), UINT64CONST(0x261E4E4C0A333A9D),
+		UINT64CONST(0x1FE2CCA76517DB90), UINT64CONST(0xD7504DFA8816EDBB),
+		UINT64CONST(0xB9571FA04DC089C8), UINT64CONST(0x1DDC0325259B27DE),
+		UINT64CONST(0xCF3F4688801EB9AA), UINT64CONST(0xF4F5D05C10CAB243),
+		UINT64CONST(0x38B6525C21A42B0E), UINT64CONST(0x36F60E2BA4FA6800),
+		UINT64CONST(0xEB3593803173E0CE), UINT64CONST(0x9C4CD6257C5A3603),
+		UINT64CONST(0xAF0C317D32ADAA8A), UINT64CONST(0x258E5A80C7204C4B),
+		UINT64CONST(0x8B889D624D44885D), UINT64CONST(0xF4D14597E660F855),
+		UINT64CONST(0xD4347F66EC8941C3), UINT64CONST(0xE699ED85B0DFB40D),
+		UINT64CONST(0x2472F6207C2D0484), UINT64CONST(0xC2A1E7B5B459AEB5),
+		UINT64CONST(0xAB4F6451CC1D45EC), UINT64CONST(0x63767572AE3D6174),
+		UINT64CONST(0xA59E0BD101731A28), UINT64CONST(0x116D0016CB948F09),
+		UINT64CONST(0x2CF9C8CA052F6E9F), UINT64CONST(0x0B090A7560A968E3),
+		UINT64CONST(0xABEEDDB2DDE06FF1), UINT64CONST(0x58EFC10B06A2068D),
+		UINT64CONST(0xC6E57A78FBD986E0), UINT64CONST(0x2EAB8CA63CE802D7),
+		UINT64CONST(0x14A195640116F336), UINT64CONST(0x7C0828DD624EC390),
+		UINT64CONST(0xD74BBE77E6116AC7), UINT64CONST(0x804456AF10F5FB53),
+		UINT64CONST(0xEBE9EA2ADF4321C7), UINT64CONST(0x03219A39EE587A30),
+		UINT64CONST(0x49787FEF17AF9924), UINT64CONST(0xA1E9300CD8520548),
+		UINT64CONST(0x5B45E522E4B1B4EF), UINT64CONST(0xB49C3B3995091A36),
+		UINT64CONST(0xD4490AD526F14431), UINT64CONST(0x12A8F216AF9418C2),
+		UINT64CONST(0x001F837CC7350524), UINT64CONST(0x1877B51E57A764D5),
+		UINT64CONST(0xA2853B80F17F58EE), UINT64CONST(0x993E1DE72D36D310),
+		UINT64CONST(0xB3598080CE64A656), UINT64CONST(0x252F59CF0D9F04BB),
+		UINT64CONST(0xD23C8E176D113600), UINT64CONST(0x1BDA0492E7E4586E),
+		UINT64CONST(0x21E0BD5026C619BF), UINT64CONST(0x3B097ADAF088F94E),
+		UINT64CONST(0x8D14DEDB30BE846E), UINT64CONST(0xF95CFFA23AF5F6F4),
+		UINT64CONST(0x3871700761B3F743), UINT64CONST(0xCA672B91E9E4FA16),
+		UINT64CONST(0x64C8E531BFF53B55), UINT64CONST(0x241260ED4AD1E87D),
+		UINT64CONST(0x106C09B972D2E822), UINT64CONST(0x7FBA195410E5CA30),
+		UINT64CONST(0x7884D9BC6CB569D8), UINT64CONST(0x0647DFEDCD894A29),
+		UINT64CONST(0x63573FF03E224774), UINT64CONST(0x4FC8E9560F91B123),
+		UINT64CONST(0x1DB956E450275779), UINT64CONST(0xB8D91274B9E9D4FB),
+		UINT64CONST(0xA2EBEE47E2FBFCE1), UINT64CONST(0xD9F1F30CCD97FB09),
+		UINT64CONST(0xEFED53D75FD64E6B), UINT64CONST(0x2E6D02C36017F67F),
+		UINT64CONST(0xA9AA4D20DB084E9B), UINT64CONST(0xB64BE8D8B25396C1),
+		UINT64CONST(0x70CB6AF7C2D5BCF0), UINT64CONST(0x98F076A4F7A2322E),
+		UINT64CONST(0xBF84470805E69B5F), UINT64CONST(0x94C3251F06F90CF3),
+		UINT64CONST(0x3E003E616A6591E9), UINT64CONST(0xB925A6CD0421AFF3),
+		UINT64CONST(0x61BDD1307C66E300), UINT64CONST(0xBF8D5108E27E0D48),
+		UINT64CONST(0x240AB57A8B888B20), UINT64CONST(0xFC87614BAF287E07),
+		UINT64CONST(0xEF02CDD06FFDB432), UINT64CONST(0xA1082C0466DF6C0A),
+		UINT64CONST(0x8215E577001332C8), UINT64CONST(0xD39BB9C3A48DB6CF),
+		UINT64CONST(0x2738259634305C14), UINT64CONST(0x61CF4F94C97DF93D),
+		UINT64CONST(0x1B6BACA2AE4E125B), UINT64CONST(0x758F450C88572E0B),
+		UINT64CONST(0x959F587D507A8359), UINT64CONST(0xB063E962E045F54D),
+		UINT64CONST(0x60E8ED72C0DFF5D1), UINT64CONST(0x7B64978555326F9F),
+		UINT64CONST(0xFD080D236DA814BA), UINT64CONST(0x8C90FD9B083F4558),
+		UINT64CONST(0x106F72FE81E2C590), UINT64CONST(0x7976033A39F7D952),
+		UINT64CONST(0xA4EC0132764CA04B), UINT64CONST(0x733EA705FAE4FA77),
+		UINT64CONST(0xB4D8F77BC3E56167), UINT64CONST(0x9E21F4F903B33FD9),
+		UINT64CONST(0x9D765E419FB69F6D), UINT64CONST(0xD30C088BA61EA5EF),
+		UINT64CONST(0x5D94337FBFAF7F5B), UINT64CONST(0x1A4E4822EB4D7A59),
+		UINT64CONST(0x6FFE73E81B637FB3), UINT64CONST(0xDDF957BC36D8B9CA),
+		UINT64CONST(0x64D0E29EEA8838B3), UINT64CONST(0x08DD9BDFD96B9F63),
+		UINT64CONST(0x087E79E5A57D1D13), UINT64CONST(0xE328E230E3E2B3FB),
+		UINT64CONST(0x1C2559E30F0946BE), UINT64CONST(0x720BF5F26F4D2EAA),
+		UINT64CONST(0xB0774D261CC609DB), UINT64CONST(0x443F64EC5A371195),
+		UINT64CONST(0x4112CF68649A260E), UINT64CONST(0xD813F2FAB7F5C5CA),
+		UINT64CONST(0x660D3257380841EE), UINT64CONST(0x59AC2C7873F910A3),
+		UINT64CONST(0xE846963877671A17), UINT64CONST(0x93B633ABFA3469F8),
+		UINT64CONST(0xC0C0F5A60EF4CDCF), UINT64CONST(0xCAF21ECD4377B28C),
+		UINT64CONST(0x57277707199B8175), UINT64CONST(0x506C11B9D90E8B1D),
+		UINT64CONST(0xD83CC2687A19255F), UINT64CONST(0x4A29C6465A314CD1),
+		UINT64CONST(0xED2DF21216235097), UINT64CONST(0xB5635C95FF7296E2),
+		UINT64CONST(0x22AF003AB672E811), UINT64CONST(0x52E762596BF68235),
+		UINT64CONST(0x9AEBA33AC6ECC6B0), UINT64CONST(0x944F6DE09134DFB6),
+		UINT64CONST(0x6C47BEC883A7DE39), UINT64CONST(0x6AD047C430A12104),
+		UINT64CONST(0xA5B1CFDBA0AB4067), UINT64CONST(0x7C45D833AFF07862),
+		UINT64CONST(0x5092EF950A16DA0B), UINT64CONST(0x9338E69C052B8E7B),
+		UINT64CONST(0x455A4B4CFE30E3F5), UINT64CONST(0x6B02E63195AD0CF8),
+		UINT64CONST(0x6B17B224BAD6BF27), UINT64CONST(0xD1E0CCD25BB9C169),
+		UINT64CONST(0xDE0C89A556B9AE70), UINT64CONST(0x50065E535A213CF6),
+		UINT64CONST(0x9C1169FA2777B874), UINT64CONST(0x78EDEFD694AF1EED),
+		UINT64CONST(0x6DC93D9526A50E68), UINT64CONST(0xEE97F453F06791ED),
+		UINT64CONST(0x32AB0EDB696703D3), UINT64CONST(0x3A6853C7E70757A7),
+		UINT64CONST(0x31865CED6120F37D), UINT64CONST(0x67FEF95D92607890),
+		UINT64CONST(0x1F2B1D1F15F6DC9C), UINT64CONST(0xB69E38A8965C6B65),
+		UINT64CONST(0xAA9119FF184CCCF4), UINT64CONST(0xF43C732873F24C13),
+		UINT64CONST(0xFB4A3D794A9A80D2), UINT64CONST(0x3550C2321FD6109C),
+		UINT64CONST(0x371F77E76BB8417E), UINT64CONST(0x6BFA9AAE5EC05779),
+		UINT64CONST(0xCD04F3FF001A4778), UINT64CONST(0xE3273522064480CA),
+		UINT64CONST(0x9F91508BFFCFC14A), UINT64CONST(0x049A7F41061A9E60),
+		UINT64CONST(0xFCB6BE43A9F2FE9B), UINT64CONST(0x08DE8A1C7797DA9B),
+		UINT64CONST(0x8F9887E6078735A1), UINT64CONST(0xB5B4071DBFC73A66),
+		UINT64CONST(0x230E343DFBA08D33), UINT64CONST(0x43ED7F5A0FAE657D),
+		UINT64CONST(0x3A88A0FBBCB05C63), UINT64CONST(0x21874B8B4D2DBC4F),
+		UINT64CONST(0x1BDEA12E35F6A8C9), UINT64CONST(0x53C065C6C8E63528),
+		UINT64CONST(0xE34A1D250E7A8D6B), UINT64CONST(0xD6B04D3B7651DD7E),
+		UINT64CONST(0x5E90277E7CB39E2D), UINT64CONST(0x2C046F22062DC67D),
+		UINT64CONST(0xB10BB459132D0A26), UINT64CONST(0x3FA9DDFB67E2F199),
+		UINT64CONST(0x0E09B88E1914F7AF), UINT64CONST(0x10E8B35AF3EEAB37),
+		UINT64CONST(0x9EEDECA8E272B933), UINT64CONST(0xD4C718BC4AE8AE5F),
+		UINT64CONST(0x81536D601170FC20), UINT64CONST(0x91B534F885818A06),
+		UINT64CONST(0xEC8177F83F900978), UINT64CONST(0x190E714FADA5156E),
+		UINT64CONST(0xB592BF39B0364963), UINT64CONST(0x89C350C893AE7DC1),
+		UINT64CONST(0xAC042E70F8B383F2), UINT64CONST(0xB49B52E587A1EE60),
+		UINT64CONST(0xFB152FE3FF26DA89), UINT64CONST(0x3E666E6F69AE2C15),
+		UINT64CONST(0x3B544EBE544C19F9), UINT64CONST(0xE805A1E290CF2456),
+		UINT64CONST(0x24B33C9D7ED25117), UINT64CONST(0xE74733427B72F0C1),
+		UINT64CONST(0x0A804D18B7097475), UINT64CONST(0x57E3306D881EDB4F),
+		UINT64CONST(0x4AE7D6A36EB5DBCB), UINT64CONST(0x2D8D5432157064C8),
+		UINT64CONST(0xD1E649DE1E7F268B), UINT64CONST(0x8A328A1CEDFE552C),
+		UINT64CONST(0x07A3AEC79624C7DA), UINT64CONST(0x84547DDC3E203C94),
+		UINT64CONST(0x990A98FD5071D263), UINT64CONST(0x1A4FF12616EEFC89),
+		UINT64CONST(0xF6F7FD1431714200), UINT64CONST(0x30C05B1BA332F41C),
+		UINT64CONST(0x8D2636B81555A786), UINT64CONST(0x46C9FEB55D120902),
+		UINT64CONST(0xCCEC0A73B49C9921), UINT64CONST(0x4E9D2827355FC492),
+		UINT64CONST(0x19EBB029435DCB0F), UINT64CONST(0x4659D2B743848A2C),
+		UINT64CONST(0x963EF2C96B33BE31), UINT64CONST(0x74F85198B05A2E7D),
+		UINT64CONST(0x5A0F544DD2B1FB18), UINT64CONST(0x03727073C2E134B1),
+		UINT64CONST(0xC7F6AA2DE59AEA61), UINT64CONST(0x352787BAA0D7C22F),
+		UINT64CONST(0x9853EAB63B5E0B35), UINT64CONST(0xABBDCDD7ED5C0860),
+		UINT64CONST(0xCF05DAF5AC8D77B0), UINT64CONST(0x49CAD48CEBF4A71E),
+		UINT64CONST(0x7A4C10EC2158C4A6), UINT64CONST(0xD9E92AA246BF719E),
+		UINT64CONST(0x13AE978D09FE5557), UINT64CONST(0x730499AF921549FF),
+		UINT64CONST(0x4E4B705B92903BA4), UINT64CONST(0xFF577222C14F0A3A),
+		UINT64CONST(0x55B6344CF97AAFAE), UINT64CONST(0xB862225B055B6960),
+		UINT64CONST(0xCAC09AFBDDD2CDB4), UINT64CONST(0xDAF8E9829FE96B5F),
+		UINT64CONST(0xB5FDFC5D3132C498), UINT64CONST(0x310CB380DB6F7503),
+		UINT64CONST(0xE87FBB46217A360E), UINT64CONST(0x2102AE466EBB1148),
+		UINT64CONST(0xF8549E1A3AA5E00D), UINT64CONST(0x07A69AFDCC42261A),
+		UINT64CONST(0xC4C118BFE78FEAAE), UINT64CONST(0xF9F4892ED96BD438),
+		UINT64CONST(0x1AF3DBE25D8F45DA), UINT64CONST(0xF5B4B0B0D2DEEEB4),
+		UINT64CONST(0x962ACEEFA82E1C84), UINT64CONST(0x046E3ECAAF453CE9),
+		UINT64CONST(0xF05D129681949A4C), UINT64CONST(0x964781CE734B3C84),
+		UINT64CONST(0x9C2ED44081CE5FBD), UINT64CONST(0x522E23F3925E319E),
+		UINT64CONST(0x177E00F9FC32F791), UINT64CONST(0x2BC60A63A6F3B3F2),
+		UINT64CONST(0x222BBFAE61725606), UINT64CONST(0x486289DDCC3D6780),
+		UINT64CONST(0x7DC7785B8EFDFC80), UINT64CONST(0x8AF38731C02BA980),
+		UINT64CONST(0x1FAB64EA29A2DDF7), UINT64CONST(0xE4D9429322CD065A),
+		UINT64CONST(0x9DA058C67844F20C), UINT64CONST(0x24C0E332B70019B0),
+		UINT64CONST(0x233003B5A6CFE6AD), UINT64CONST(0xD586BD01C5C217F6),
+		UINT64CONST(0x5E5637885F29BC2B), UINT64CONST(0x7EBA726D8C94094B),
+		UINT64CONST(0x0A56A5F0BFE39272), UINT64CONST(0xD79476A84EE20D06),
+		UINT64CONST(0x9E4C1269BAA4BF37), UINT64CONST(0x17EFEE45B0DEE640),
+		UINT64CONST(0x1D95B0A5FCF90BC6), UINT64CONST(0x93CBE0B699C2585D),
+		UINT64CONST(0x65FA4F227A2B6D79), UINT64CONST(0xD5F9E858292504D5),
+		UINT64CONST(0xC2B5A03F71471A6F), UINT64CONST(0x59300222B4561E00),
+		UINT64CONST(0xCE2F8642CA0712DC), UINT64CONST(0x7CA9723FBB2E8988),
+		UINT64CONST(0x2785338347F2BA08), UINT64CONST(0xC61BB3A141E50E8C),
+		UINT64CONST(0x150F361DAB9DEC26), UINT64CONST(0x9F6A419D382595F4),
+		UINT64CONST(0x64A53DC924FE7AC9), UINT64CONST(0x142DE49FFF7A7C3D),
+		UINT64CONST(0x0C335248857FA9E7), UINT64CONST(0x0A9C32D5EAE45305),
+		UINT64CONST(0xE6C42178C4BBB92E), UINT64CONST(0x71F1CE2490D20B07),
+		UINT64CONST(0xF1BCC3D275AFE51A), UINT64CONST(0xE728E8C83C334074),
+		UINT64CONST(0x96FBF83A12884624), UINT64CONST(0x81A1549FD6573DA5),
+		UINT64CONST(0x5FA7867CAF35E149), UINT64CONST(0x56986E2EF3ED091B),
+		UINT64CONST(0x917F1DD5F8886C61), UINT64CONST(0xD20D8C88C8FFE65F),
+		UINT64CONST(0x31D71DCE64B2C310), UINT64CONST(0xF165B587DF898190),
+		UINT64CONST(0xA57E6339DD2CF3A0), UINT64CONST(0x1EF6E6DBB1961EC9),
+		UINT64CONST(0x70CC73D90BC26E24), UINT64CONST(0xE21A6B35DF0C3AD7),
+		UINT64CONST(0x003A93D8B2806962), UINT64CONST(0x1C99DED33CB890A1),
+		UINT64CONST(0xCF3145DE0ADD4289), UINT64CONST(0xD0E4427A5514FB72),
+		UINT64CONST(0x77C621CC9FB3A483), UINT64CONST(0x67A34DAC4356550B),
+		UINT64CONST(0xF8D626AAAF278509)
+	};
+
+/*
+ * Chess-specific static data
+ */
+
+static const int chess_knight_moves[][2] =
+	{
+		{  2,  1 },
+		{  1,  2 },
+		{ -1,  2 },
+		{ -2,  1 },
+		{ -2, -1 },
+		{ -1, -2 },
+		{  1, -2 },
+		{  2, -1 }
+	};
+
+/* even indices are Rook directions, odd indices are Bishop directions */
+static const int chess_queen_directions[][2] =
+	{
+		{  1,  0 },
+		{  1,  1 },
+		{  0,  1 },
+		{ -1,  1 },
+		{ -1,  0 },
+		{ -1, -1 },
+		{  0, -1 },
+		{  1, -1 }
+	};
 
 /*
- * The following coefficients control the importance of available
- * moves and attacked pieces in evaluating a position.
+ * The following coefficients control the importance of mobility,
+ * attacked pieces, King safety and piece placement in evaluating a
+ * position. The first three terms come from the same attack maps,
+ * computed once per evaluation; piece placement is in centipawns.
  */
 
 #define ChessCoeffScoreMoves 0.1
-#define ChessCoeffScoreAttacked 0.1
+#define ChessCoeffScoreAttacked 0.2
+#define ChessCoeffScoreKingSafety 0.05
+#define ChessCoeffScorePSQ 0.01
+
+/* the value of each piece type, as in aux_chess_piece_value */
+static const int chess_piece_values[6] = { 1, 3, 3, 5, 9, 0 };
+
+/*
+ * Piece-square tables, in centipawns, from the point of view of
+ * White, with the 8th rank first: a White piece on sq reads entry
+ * sq ^ 56, a Black one entry sq. These are the tables of Tomasz
+ * Michniewski's "Simplified evaluation function".
+ */
+
+static const int chess_psq[6][64] =
+	{
+		/* Pawn */
+		{   0,   0,   0,   0,   0,   0,   0,   0,
+		   50,  50,  50,  50,  50,  50,  50,  50,
+		   10,  10,  20,  30,  30,  20,  10,  10,
+		    5,   5,  10,  25,  25,  10,   5,   5,
+		    0,   0,   0,  20,  20,   0,   0,   0,
+		    5,  -5, -10,   0,   0, -10,  -5,   5,
+		    5,  10,  10, -20, -20,  10,  10,   5,
+		    0,   0,   0,   0,   0,   0,   0,   0 },
+		/* Knight */
+		{ -50, -40, -30, -30, -30, -30, -40, -50,
+		  -40, -20,   0,   0,   0,   0, -20, -40,
+		  -30,   0,  10,  15,  15,  10,   0, -30,
+		  -30,   5,  15,  20,  20,  15,   5, -30,
+		  -30,   0,  15,  20,  20,  15,   0, -30,
+		  -30,   5,  10,  15,  15,  10,   5, -30,
+		  -40, -20,   0,   5,   5,   0, -20, -40,
+		  -50, -40, -30, -30, -30, -30, -40, -50 },
+		/* Bishop */
+		{ -20, -10, -10, -10, -10, -10, -10, -20,
+		  -10,   0,   0,   0,   0,   0,   0, -10,
+		  -10,   0,   5,  10,  10,   5,   0, -10,
+		  -10,   5,   5,  10,  10,   5,   5, -10,
+		  -10,   0,  10,  10,  10,  10,   0, -10,
+		  -10,  10,  10,  10,  10,  10,  10, -10,
+		  -10,   5,   0,   0,   0,   0,   5, -10,
+		  -20, -10, -10, -10, -10, -10, -10, -20 },
+		/* Rook */
+		{   0,   0,   0,   0,   0,   0,   0,   0,
+		    5,  10,  10,  10,  10,  10,  10,   5,
+		   -5,   0,   0,   0,   0,   0,   0,  -5,
+		   -5,   0,   0,   0,   0,   0,   0,  -5,
+		   -5,   0,   0,   0,   0,   0,   0,  -5,
+		   -5,   0,   0,   0,   0,   0,   0,  -5,
+		   -5,   0,   0,   0,   0,   0,   0,  -5,
+		    0,   0,   0,   5,   5,   0,   0,   0 },
+		/* Queen */
+		{ -20, -10, -10,  -5,  -5, -10, -10, -20,
+		  -10,   0,   0,   0,   0,   0,   0, -10,
+		  -10,   0,   5,   5,   5,   5,   0, -10,
+		   -5,   0,   5,   5,   5,   5,   0,  -5,
+		    0,   0,   5,   5,   5,   5,   0,  -5,
+		  -10,   5,   5,   5,   5,   5,   0, -10,
+		  -10,   0,   5,   0,   0,   0,   0, -10,
+		  -20, -10, -10,  -5,  -5, -10, -10, -20 },
+		/* King */
+		{ -30, -40, -40, -50, -50, -40, -40, -30,
+		  -30, -40, -40, -50, -50, -40, -40, -30,
+		  -30, -40, -40, -50, -50, -40, -40, -30,
+		  -30, -40, -40, -50, -50, -40, -40, -30,
+		  -20, -30, -30, -40, -40, -30, -30, -20,
+		  -10, -20, -20, -20, -20, -20, -20, -10,
+		   20,  20,   0,   0,   0,   0,  20,  20,
+		   20,  30,  10,   0,   0,  10,  30,  20 }
+	};
+
+#define ChessPSQ(side,t,sq) chess_psq[t][(side) == ChessWhite ? (sq) ^ 56 : (sq)]
 
 typedef struct
 {
 	/* the board */
 	char b[8][8];
 
-	/* castling information */
+	/*
+	 * the same board as bitboards, one for each side and piece type,
+	 * plus the squares occupied by each side; they are kept in sync
+	 * with b by aux_chess_set_square
+	 */
+	ChessBitboard pieces[2][6];
+	ChessBitboard occupied[2];
+
+	/*
+	 * evaluation terms of each side, kept up to date in the same way:
+	 * the value of its pieces, and their piece-square total
+	 */
+	int material[2];
+	int psq[2];
+
+	/* castling information, in FEN order: K, Q, k, q */
 	char c[4];
 
+	/* en passant target square, or -1 */
+	int ep_square;
+
 	char last_piece_captured;
 
+	/*
+	 * the Zobrist hash of the position, kept up to date by
+	 * aux_chess_set_square and aux_chess_make_move
+	 */
+	uint64 hash;
+
 	int move_iterator;
 	int candidate_move;
 	int found_moves;
 
+	/* the formal moves found by the last rewind */
+	int formal_moves_n;
+	int formal_moves[ChessMaxFormalMoves];
+
+	/*
+	 * The number of half moves played so far; its parity is the side
+	 * to move. The moves themselves are not needed by the engine.
+	 */
 	int previous_moves_n;
-	int *previous_moves;
 
 	int halfmove_counter;
 
 	/* Forsyth-Edwards Notation */
-	char fen[90];
+	char fen[96];
 	/* 
 	 * The maximum size of 89 character is computed from the maximum
 	 * possible sizes for each field: 71 1 4 2 2 4. We are assuming
@@ -86,36 +997,222 @@ typedef struct
 	
 } chess_game_status;
 
+/*
+ * What aux_chess_make_move needs to remember for undoing a move: the
+ * position is changed in place, and restored by aux_chess_unmake_move.
+ */
+
+typedef struct
+{
+	int move;
+	char moved_piece;
+	char captured_piece;
+	int captured_square;		/* not the target, in case of en passant */
+	char c[4];
+	int ep_square;
+	char last_piece_captured;
+	int halfmove_counter;
+	uint64 hash;
+} chess_undo;
+
+/*
+ * Attack maps: the squares attacked by each side, and by how many of
+ * its pieces. They are computed in one pass over the pieces, with the
+ * current occupancy (so a slider does not attack through a piece).
+ * The same pass counts the mobility of each side: the squares its
+ * pieces other than Pawns attack and that it does not occupy.
+ */
+
+typedef struct
+{
+	ChessBitboard attacked[2];
+	uint8 count[2][64];
+	int mobility[2];
+} chess_attack_maps;
+
+/*
+ * The chessboard type is a position in a fixed-size binary format,
+ * which can be used instead of the game composite type when the
+ * history of the game is not needed. Each square is a 4-bit code,
+ * that is, its position in ChessBoardCodes.
+ */
+
+typedef struct
+{
+	uint8 squares[32];
+	uint8 side;					/* 0 = white, 1 = black */
+	uint8 castling;				/* in FEN order: K = 1, Q = 2, k = 4, q = 8 */
+	int8 ep_square;				/* en passant target square, or -1 */
+	char last_piece_captured;
+	int16 halfmove_counter;
+	int16 fullmove_number;
+} ChessBoard;
+
+#define ChessBoardCodes " PNBRQKpnbrqk"
+
+/* the leading part of a ChessBoard which identifies a position */
+#define ChessBoardPositionSize offsetof(ChessBoard, last_piece_captured)
+#define ChessBoardGetCode(cb,sq) (((cb)->squares[(sq)/2] >> (4*((sq)%2))) & 15)
+
+#define DatumGetChessBoardP(X) ((ChessBoard *) DatumGetPointer(X))
+#define ChessBoardPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_CHESSBOARD_P(n) DatumGetChessBoardP(PG_GETARG_DATUM(n))
+#define PG_RETURN_CHESSBOARD_P(x) return ChessBoardPGetDatum(x)
+
 /*
  * Prototypes of auxiliary functions
  */
 
 char aux_chess_side(char);
+void aux_chess_init_tables(void);
+Size aux_chess_tt_shmem_size(void);
+void aux_chess_tt_shmem_request(void);
+void aux_chess_tt_shmem_startup(void);
+void aux_chess_stats_flush(void);
+void aux_chess_stats_xact_callback(XactEvent, void *);
+bool aux_chess_tt_probe(uint64, chess_tt_data *);
+void aux_chess_tt_store(uint64, double, int, int, int);
+bool aux_chess_move_is_capture(const chess_game_status *, int);
+int aux_chess_move_order_key(const chess_game_status *, int);
+int aux_chess_see(const chess_game_status *, int);
+void aux_chess_sort_moves(int *, int *, int);
+void aux_chess_order_moves(const chess_game_status *, int *, int, int, const int *);
+int aux_chess_move_sort_key(chess_game_status *, int);
+bool aux_chess_in_check(const chess_game_status *);
+uint64 aux_chess_next_random(uint64 *);
+ChessBitboard aux_chess_slider_attacks_slow(int, ChessBitboard, int);
+void aux_chess_init_magic(chess_magic *, int, int, ChessBitboard **);
+int aux_chess_piece_type(char);
+void aux_chess_set_square(chess_game_status *, int, char);
+void aux_chess_sync_bitboards(chess_game_status *);
+uint64 aux_chess_hash_state(const chess_game_status *);
+void aux_chess_compute_hash(chess_game_status *);
+uint64 aux_chess_polyglot_key(const chess_game_status *);
+void aux_chess_book_map(void);
+uint64 aux_chess_book_read(const unsigned char *, int);
+int aux_chess_book_move(const chess_game_status *, int);
+void aux_chess_check_ep_square(chess_game_status *);
+int aux_chess_position_cmp(const ChessBoard *, const ChessBoard *);
+int aux_chess_position_cmp_args(FunctionCallInfo);
+void aux_chess_generate_formal_moves(chess_game_status *);
+void aux_chess_set_ep_square(chess_game_status *, int);
 int aux_init_chess_game_status(chess_game_status *);
 void aux_destroy_chess_game_status(chess_game_status *);
+chess_game_status *aux_fn_chess_game_status(FunctionCallInfo);
 void aux_chess_apply_candidate_move(chess_game_status *);
-chess_game_status * aux_clone_chess_game_status(const chess_game_status *);
+void aux_chess_make_move(chess_game_status *, int, chess_undo *);
+void aux_chess_unmake_move(chess_game_status *, const chess_undo *);
+bool aux_chess_square_attacked(const chess_game_status *, int, int);
 int aux_read_game(chess_game_status *, Datum);
+void aux_read_chessboard(chess_game_status *, const ChessBoard *);
+void aux_write_chessboard(const chess_game_status *, ChessBoard *);
+bool aux_arg_is_game(FunctionCallInfo, int);
+int aux_read_game_arg(chess_game_status *, FunctionCallInfo, int);
+const ChessBoard *aux_read_position_arg(FunctionCallInfo, int, ChessBoard *);
+void aux_chess_read_fen(chess_game_status *, const char *);
 int aux_read_move(Datum);
+TupleDesc aux_game_tuple_desc(FunctionCallInfo);
+Datum aux_write_game(TupleDesc, const chess_game_status *, const int16 *, int, const int *, int);
+Datum aux_chess_fen_to_game(TupleDesc, chess_game_status *, const char *);
+int16 *aux_chess_fen_moves(const chess_game_status *);
+int aux_read_moves_array(ArrayType *, int16 **);
 int aux_chess_formal_move_rewind(chess_game_status *);
 int aux_chess_formal_move_next(chess_game_status *);
-int aux_chess_is_king_safe(const chess_game_status *);
+bool aux_chess_make_legal_move(chess_game_status *, int, chess_undo *);
+int aux_chess_is_king_safe(chess_game_status *);
+int aux_chess_valid_moves(chess_game_status *, int *);
+int aux_chess_san_to_move(chess_game_status *, const char *, int);
+int aux_chess_legal_moves(chess_game_status *, int *);
+void aux_chess_move_to_san(const chess_game_status *, int, const int *, int, char *);
+void aux_chess_san_check(const chess_game_status *, int, char *);
+ChessBitboard aux_chess_attackers(const chess_game_status *, int, int, ChessBitboard);
+ChessBitboard aux_chess_between(int, int);
+int aux_chess_count_valid_moves(chess_game_status *);
+int64 aux_chess_perft(chess_game_status *, int);
+int aux_chess_perft_divide(chess_game_status *, int, int *, int64 *);
+int64 aux_chess_parallel_perft(chess_game_status *, int);
+double aux_chess_perft_report(const char *, int, int64, TimestampTz);
+chess_game_status *aux_chess_perft_args(FunctionCallInfo, const char *, int);
 int aux_chess_piece_value(char);
 int aux_chess_score_available_pieces(chess_game_status *);
-int aux_chess_score_available_moves(chess_game_status *);
-int aux_chess_score_attacked_pieces(chess_game_status *);
+int aux_chess_score_piece_squares(chess_game_status *);
+void aux_chess_attack_maps(const chess_game_status *, chess_attack_maps *);
+int aux_chess_score_mobility(chess_game_status *, const chess_attack_maps *);
+int aux_chess_score_attacked_pieces(chess_game_status *, const chess_attack_maps *);
+int aux_chess_score_king_safety(chess_game_status *, const chess_attack_maps *);
 double aux_chess_score(chess_game_status *);
-void aux_chess_update_fen(chess_game_status *);
+double aux_chess_cached_score(chess_game_status *);
+int aux_chess_update_fen(chess_game_status *);
 
 /*
  * Prototypes of PostgreSQL functions
  */
 
+void _PG_init(void);
+PGDLLEXPORT void chess_parallel_worker_main(Datum);
 Datum chess_valid_moves(PG_FUNCTION_ARGS);
+Datum chess_valid_moves_ordered(PG_FUNCTION_ARGS);
+Datum chess_see(PG_FUNCTION_ARGS);
+Datum chess_valid_moves_array(PG_FUNCTION_ARGS);
+Datum chess_count_valid_moves(PG_FUNCTION_ARGS);
 Datum chess_is_king_safe(PG_FUNCTION_ARGS);
 Datum chess_is_game_ended(PG_FUNCTION_ARGS);
 Datum chess_game_to_fen(PG_FUNCTION_ARGS);
+Datum chess_fen_to_game(PG_FUNCTION_ARGS);
+Datum chess_fen_to_game_array(PG_FUNCTION_ARGS);
+Datum chess_game_to_fen_array(PG_FUNCTION_ARGS);
 Datum chess_game_score(PG_FUNCTION_ARGS);
+Datum chess_score_breakdown(PG_FUNCTION_ARGS);
+Datum chess_attack_map(PG_FUNCTION_ARGS);
+Datum chess_chessboard_in(PG_FUNCTION_ARGS);
+Datum chess_chessboard_out(PG_FUNCTION_ARGS);
+Datum chess_chessboard_recv(PG_FUNCTION_ARGS);
+Datum chess_chessboard_send(PG_FUNCTION_ARGS);
+Datum chess_game_to_chessboard(PG_FUNCTION_ARGS);
+Datum chess_chessboard_to_game(PG_FUNCTION_ARGS);
+Datum chess_apply_move(PG_FUNCTION_ARGS);
+Datum chess_apply_moves(PG_FUNCTION_ARGS);
+Datum chess_chessboard_apply_move(PG_FUNCTION_ARGS);
+Datum chess_chessboard_apply_moves(PG_FUNCTION_ARGS);
+Datum chess_best_move(PG_FUNCTION_ARGS);
+Datum chess_expand(PG_FUNCTION_ARGS);
+Datum chess_perft(PG_FUNCTION_ARGS);
+Datum chess_perft_timed(PG_FUNCTION_ARGS);
+Datum chess_perft_divide(PG_FUNCTION_ARGS);
+Datum chess_tt_stats(PG_FUNCTION_ARGS);
+Datum chess_tt_clear(PG_FUNCTION_ARGS);
+Datum chess_pgchess_stats(PG_FUNCTION_ARGS);
+Datum chess_pgchess_stats_reset(PG_FUNCTION_ARGS);
+Datum chess_book_moves(PG_FUNCTION_ARGS);
+Datum chess_polyglot_key(PG_FUNCTION_ARGS);
+Datum chess_pgn_import(PG_FUNCTION_ARGS);
+Datum chess_pgn_import_file(PG_FUNCTION_ARGS);
+Datum chess_move_to_san(PG_FUNCTION_ARGS);
+Datum chess_san_to_move(PG_FUNCTION_ARGS);
+Datum chess_moves_to_san(PG_FUNCTION_ARGS);
+Datum chess_position_hash(PG_FUNCTION_ARGS);
+Datum chess_position_hash32(PG_FUNCTION_ARGS);
+Datum chess_position_cmp(PG_FUNCTION_ARGS);
+Datum chess_position_eq(PG_FUNCTION_ARGS);
+Datum chess_position_ne(PG_FUNCTION_ARGS);
+Datum chess_position_lt(PG_FUNCTION_ARGS);
+Datum chess_position_le(PG_FUNCTION_ARGS);
+Datum chess_position_gt(PG_FUNCTION_ARGS);
+Datum chess_position_ge(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_hash(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_hash32(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_cmp(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_eq(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_ne(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_lt(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_le(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_gt(PG_FUNCTION_ARGS);
+Datum chess_chessboard_position_ge(PG_FUNCTION_ARGS);
+Datum chess_placement_match(PG_FUNCTION_ARGS);
+Datum chess_chessboard_gin_extract_value(PG_FUNCTION_ARGS);
+Datum chess_game_gin_extract_value(PG_FUNCTION_ARGS);
+Datum chess_placement_gin_extract_query(PG_FUNCTION_ARGS);
+Datum chess_placement_gin_consistent(PG_FUNCTION_ARGS);
 
 /*
  * Functions
@@ -136,165 +1233,747 @@ Datum chess_game_score(PG_FUNCTION_ARGS);
 			   (X == 'n' ? 'b' :					\
 				(X == 'p' ? 'b' : '?')))))))))))))
 
-int
-aux_init_chess_game_status(chess_game_status *s)
-{
-	s->candidate_move = ChessVoidMove;
-	return 0;
-};
+/*
+ * Module initialization: the attack tables are computed once per
+ * backend, when the library is loaded; the transposition table is
+ * requested only when preloading.
+ */
 
 void
-aux_destroy_chess_game_status(chess_game_status *s)
+_PG_init(void)
 {
-	if (s->previous_moves != NULL)
-		pfree(s->previous_moves);
-	pfree(s);
-}
+	int i;
 
-void
-aux_chess_apply_candidate_move(chess_game_status *s)
-{
-	int x1=0, x2=0, y1=0, y2=0;
-	char p1='-', p2='-';
+	aux_chess_init_tables();
 
-	if (s->candidate_move != ChessVoidMove)
+	/*
+	 * Settings which only take effect at server start can only be
+	 * defined while preloading.
+	 */
+	if (process_shared_preload_libraries_in_progress)
 		{
-			x1 = ChessMoveX1(s->candidate_move);
-			y1 = ChessMoveY1(s->candidate_move);
-			x2 = ChessMoveX2(s->candidate_move);
-			y2 = ChessMoveY2(s->candidate_move);
-			p1 = s->b[x1][y1];
-			p2 = s->b[x2][y2];
-			if (p2 != ' ')
-				s->last_piece_captured = p2;
-			s->b[x2][y2] = p1;
-			s->b[x1][y1] = ' ';
+			DefineCustomIntVariable("pgchess.tt_size",
+									"Size of the shared transposition table, in megabytes.",
+									"0 disables the table. Only effective when pgchess is in shared_preload_libraries.",
+									&chess_tt_size,
+									16, 0, 65536,
+									PGC_POSTMASTER,
+									GUC_UNIT_MB,
+									NULL, NULL, NULL);
 		}
-	s->previous_moves_n++;
-	if (s->previous_moves == NULL)
-		s->previous_moves = (int *) palloc(sizeof(int) * s->previous_moves_n);
-	else
-		s->previous_moves = (int *) repalloc(s->previous_moves, sizeof(int) * s->previous_moves_n);
-	s->previous_moves[s->previous_moves_n - 1] = s->candidate_move;
-	s->candidate_move = ChessVoidMove;
+	DefineCustomIntVariable("pgchess.max_workers",
+							"Maximum number of background workers of a single search or perft.",
+							"0 runs them in the calling backend only. Workers are taken from max_worker_processes.",
+							&chess_max_workers,
+							0, 0, 1024,
+							PGC_USERSET,
+							0,
+							NULL, NULL, NULL);
+	DefineCustomStringVariable("pgchess.book_path",
+							   "Path of the Polyglot opening book read by book_moves.",
+							   "Relative paths are taken from the data directory.",
+							   &chess_book_path,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL, NULL, NULL);
+	DefineCustomBoolVariable("pgchess.track_timing",
+							 "Collects the time spent in move generation and evaluation.",
+							 "The time of searches and perft is always collected.",
+							 &chess_track_timing,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL, NULL, NULL);
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("pgchess");
+#else
+	EmitWarningsOnPlaceholders("pgchess");
+#endif
 
-	/* 
-	 * If the King moves by > 1 squares, then he is castling, and the
-	 * Rook must be moved too.
-	 */
+	for (i = 0; i < ChessStatN; i++)
+		pg_atomic_init_u64(&chess_stats_local.counters[i], 0);
+	RegisterXactCallback(aux_chess_stats_xact_callback, NULL);
 
-	if (p1 == 'K' && x1 == 4 && x2 == 6)
-		{
-			s->b[5][0] = 'R';
-			s->b[7][0] = ' ';
-		}
-	if (p1 == 'K' && x1 == 4 && x2 == 2)
-		{
-			s->b[3][0] = 'R';
-			s->b[0][0] = ' ';
-		}
-	if (p1 == 'k' && x1 == 4 && x2 == 6)
-		{
-			s->b[5][7] = 'r';
-			s->b[7][7] = ' ';
-		}
-	if (p1 == 'k' && x1 == 4 && x2 == 2)
-		{
-			s->b[3][7] = 'r';
-			s->b[0][7] = ' ';
-		}
+	if (!process_shared_preload_libraries_in_progress)
+		return;
 
-	/*
-	 * Moving a King waives the castling status of its castles.
-	 */
-	if (p1 == 'K')
-		{
-			s->c[0] = 'n';
-			s->c[1] = 'n';
-		}
-	if (p1 == 'k')
-		{
-			s->c[2] = 'n';
-			s->c[3] = 'n';
-		}
+#if PG_VERSION_NUM >= 150000
+	chess_prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = aux_chess_tt_shmem_request;
+#else
+	aux_chess_tt_shmem_request();
+#endif
+	chess_prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = aux_chess_tt_shmem_startup;
+}
 
-	/* 
-	 * Moving a Rook waives its castling status.
-	 */
+/*
+ * Shared memory for the transposition table and the statistics. The
+ * GUC is in MB, and each bucket of the former holds two entries.
+ */
 
-	if (x1 == 0 && y1 == 0 && s->c[0] == 'y') s->c[0] = 'n';
-	if (x1 == 7 && y1 == 0 && s->c[1] == 'y') s->c[1] = 'n';
-	if (x1 == 0 && y1 == 7 && s->c[2] == 'y') s->c[2] = 'n';
-	if (x1 == 7 && y1 == 7 && s->c[3] == 'y') s->c[3] = 'n';
+Size
+aux_chess_tt_shmem_size(void)
+{
+	Size n_buckets = ((Size) chess_tt_size * 1024 * 1024) / (2 * sizeof(chess_tt_entry));
 
-	/* 
-	 * When pawns reach the other side, they are promoted.
-	 */
-	if (s->candidate_move != ChessVoidMove)
+	return add_size(offsetof(chess_tt_shared, entries),
+					mul_size(n_buckets, 2 * sizeof(chess_tt_entry)));
+}
+
+void
+aux_chess_tt_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (chess_prev_shmem_request_hook)
+		chess_prev_shmem_request_hook();
+#endif
+	if (chess_tt_size > 0)
+		RequestAddinShmemSpace(aux_chess_tt_shmem_size());
+	RequestAddinShmemSpace(sizeof(chess_stats_shared));
+}
+
+void
+aux_chess_tt_shmem_startup(void)
+{
+	bool found;
+	uint64 i;
+
+	if (chess_prev_shmem_startup_hook)
+		chess_prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	chess_stats = ShmemInitStruct("pgchess statistics", sizeof(chess_stats_shared), &found);
+	if (!found)
+		for (i = 0; i < ChessStatN; i++)
+			pg_atomic_init_u64(&chess_stats->counters[i], 0);
+	if (chess_tt_size <= 0)
+		{
+			LWLockRelease(AddinShmemInitLock);
+			return;
+		}
+	chess_tt = ShmemInitStruct("pgchess transposition table",
+							   aux_chess_tt_shmem_size(), &found);
+	if (!found)
 		{
-			if ((p1 == 'P' && y1 == 6 && y2 == 7)
-				||
-				(p1 == 'p' && y1 == 1 && y2 == 0))
+			chess_tt->n_buckets = ((Size) chess_tt_size * 1024 * 1024) / (2 * sizeof(chess_tt_entry));
+			pg_atomic_init_u64(&chess_tt->hits, 0);
+			pg_atomic_init_u64(&chess_tt->misses, 0);
+			pg_atomic_init_u64(&chess_tt->stores, 0);
+			pg_atomic_init_u64(&chess_tt->replacements, 0);
+			for (i = 0; i < 2 * chess_tt->n_buckets; i++)
 				{
-					s->b[x2][y2] = ChessMovePPCToChar(ChessMovePPC(s->candidate_move));
+					pg_atomic_init_u64(&chess_tt->entries[i].check, 0);
+					pg_atomic_init_u64(&chess_tt->entries[i].score, 0);
+					pg_atomic_init_u64(&chess_tt->entries[i].info, 0);
 				}
 		}
-
-	/*
-	 * A pawn move or a piece capture reset the halfmove counter.
-	 */
-
-	if (p1 == 'p' || p1 == 'P' || p2 != ' ')
-		s->halfmove_counter = 0;
-	else
-		s->halfmove_counter ++;
+	LWLockRelease(AddinShmemInitLock);
 }
 
-chess_game_status *
-aux_clone_chess_game_status(const chess_game_status *s0)
+/*
+ * This function adds the counts of this backend to the totals.
+ */
+
+void
+aux_chess_stats_flush(void)
 {
-	chess_game_status *s;
+	int i;
 
-	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	for (i = 0; i < ChessStatN; i++)
+		if (chess_stats_pending[i] != 0)
+			{
+				pg_atomic_fetch_add_u64(&chess_stats->counters[i], chess_stats_pending[i]);
+				chess_stats_pending[i] = 0;
+			}
+}
 
-	memcpy(s->b[0], s0->b[0], sizeof(char) * 8);
-	memcpy(s->b[1], s0->b[1], sizeof(char) * 8);
-	memcpy(s->b[2], s0->b[2], sizeof(char) * 8);
-	memcpy(s->b[3], s0->b[3], sizeof(char) * 8);
-	memcpy(s->b[4], s0->b[4], sizeof(char) * 8);
-	memcpy(s->b[5], s0->b[5], sizeof(char) * 8);
-	memcpy(s->b[6], s0->b[6], sizeof(char) * 8);
-	memcpy(s->b[7], s0->b[7], sizeof(char) * 8);
+void
+aux_chess_stats_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+		{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PREPARE:
+			aux_chess_stats_flush();
+			break;
+		default:
+			break;
+		}
+}
 
-	memcpy(s->c, s0->c, sizeof(char) * 4);
+void
+aux_chess_init_tables(void)
+{
+	int sq, i, x, y;
+	ChessBitboard *rook_next = chess_rook_table;
+	ChessBitboard *bishop_next = chess_bishop_table;
+	uint64 seed = ChessZobristSeed;
+
+	if (chess_tables_ready)
+		return;
+
+	for (i = 0; i < 2 * 6 * 64; i++)
+		(&chess_zobrist_pieces[0][0][0])[i] = aux_chess_next_random(&seed);
+	for (i = 0; i < 4; i++)
+		chess_zobrist_castling[i] = aux_chess_next_random(&seed);
+	for (i = 0; i < 8; i++)
+		chess_zobrist_ep[i] = aux_chess_next_random(&seed);
+	chess_zobrist_black = aux_chess_next_random(&seed);
+
+	for (sq = 0; sq < 64; sq++)
+		{
+			x = ChessSquareX(sq);
+			y = ChessSquareY(sq);
 
-	s->last_piece_captured = s0->last_piece_captured;
+			for (i = 0; i < 8; i++)
+				{
+					if (ChessValidXY(x + chess_knight_moves[i][0],
+									 y + chess_knight_moves[i][1]))
+						chess_knight_attacks[sq] |=
+							ChessBit(ChessSquare(x + chess_knight_moves[i][0],
+												 y + chess_knight_moves[i][1]));
+					if (ChessValidXY(x + chess_queen_directions[i][0],
+									 y + chess_queen_directions[i][1]))
+						chess_king_attacks[sq] |=
+							ChessBit(ChessSquare(x + chess_queen_directions[i][0],
+												 y + chess_queen_directions[i][1]));
+				}
 
-	s->previous_moves_n = s0->previous_moves_n;
-	s->previous_moves = (int *) palloc0(sizeof(int) * s->previous_moves_n);
-	memcpy(s->previous_moves, s0->previous_moves, sizeof(int) * s->previous_moves_n);
+			for (i = -1; i <= 1; i += 2)
+				{
+					if (ChessValidXY(x + i, y + 1))
+						chess_pawn_attacks[ChessWhite][sq] |= ChessBit(ChessSquare(x + i, y + 1));
+					if (ChessValidXY(x + i, y - 1))
+						chess_pawn_attacks[ChessBlack][sq] |= ChessBit(ChessSquare(x + i, y - 1));
+				}
 
-	s->candidate_move = s0->candidate_move;
+			aux_chess_init_magic(&chess_rook_magics[sq], sq, 0, &rook_next);
+			aux_chess_init_magic(&chess_bishop_magics[sq], sq, 1, &bishop_next);
+		}
 
-	return s;
-};
+	chess_tables_ready = true;
+}
 
 /*
- * This function reads an input "game" argument into a chess_game_status
+ * This function returns the next number of a splitmix64 sequence.
  */
 
-int aux_read_game(chess_game_status *s, Datum d)
+uint64
+aux_chess_next_random(uint64 *seed)
 {
-	HeapTupleHeader h;
-	bool isnull;
+	uint64 z;
 
-	char *game = NULL;
+	*seed += ChessZobristSeed;
+	z = *seed;
+	z = (z ^ (z >> 30)) * UINT64CONST(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64CONST(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
 
-	ArrayType *moves;
-	ArrayIterator moves_iterator;
+/*
+ * This function computes the attacks of a slider on sq by walking
+ * along the rays; first_direction is 0 for Rooks and 1 for Bishops
+ * (see chess_queen_directions). It is only used to fill the tables.
+ */
 
-	int i;
-	int x1;
+ChessBitboard
+aux_chess_slider_attacks_slow(int sq, ChessBitboard occupied, int first_direction)
+{
+	ChessBitboard o = 0;
+	int i, x, y;
+
+	for (i = first_direction; i < 8; i += 2)
+		{
+			x = ChessSquareX(sq) + chess_queen_directions[i][0];
+			y = ChessSquareY(sq) + chess_queen_directions[i][1];
+			while (ChessValidXY(x,y))
+				{
+					o |= ChessBit(ChessSquare(x,y));
+					if (occupied & ChessBit(ChessSquare(x,y)))
+						break;
+					x += chess_queen_directions[i][0];
+					y += chess_queen_directions[i][1];
+				}
+		}
+	return o;
+}
+
+/*
+ * This function fills the attack table of a slider on sq. The table
+ * is carved out of the space pointed by *next, which is advanced
+ * accordingly.
+ */
+
+void
+aux_chess_init_magic(chess_magic *m, int sq, int first_direction, ChessBitboard **next)
+{
+	ChessBitboard edges, b;
+	int size;
+
+	/* edge squares never block a ray, unless the slider is on that edge */
+	edges = ((ChessRank1 | ChessRank8) & ~ChessRankOf(sq))
+		| ((ChessFileA | ChessFileH) & ~ChessFileOf(sq));
+	m->mask = aux_chess_slider_attacks_slow(sq, 0, first_direction) & ~edges;
+	m->magic = (first_direction == 0)
+		? chess_rook_magic_numbers[sq]
+		: chess_bishop_magic_numbers[sq];
+	m->shift = 64 - ChessPopCount(m->mask);
+	m->attacks = *next;
+
+	/* enumerate all the subsets of the mask (Carry-Rippler) */
+	size = 0;
+	b = 0;
+	do
+		{
+			m->attacks[ChessMagicIndex(m, b)] =
+				aux_chess_slider_attacks_slow(sq, b, first_direction);
+			size++;
+			b = (b - m->mask) & m->mask;
+		}
+	while (b);
+	*next += size;
+}
+
+/*
+ * This function returns the bitboard index of a piece, or -1 for an
+ * empty square.
+ */
+
+int
+aux_chess_piece_type(char p)
+{
+	switch (p)
+		{
+		case 'P': case 'p': return ChessPawn;
+		case 'N': case 'n': return ChessKnight;
+		case 'B': case 'b': return ChessBishop;
+		case 'R': case 'r': return ChessRook;
+		case 'Q': case 'q': return ChessQueen;
+		case 'K': case 'k': return ChessKing;
+		default: return -1;
+		}
+}
+
+/*
+ * This function puts p on square sq (' ' empties the square),
+ * updating both the board and the bitboards.
+ */
+
+void
+aux_chess_set_square(chess_game_status *s, int sq, char p)
+{
+	char *square = &(s->b[ChessSquareX(sq)][ChessSquareY(sq)]);
+	int t, side;
+
+	t = aux_chess_piece_type(*square);
+	if (t >= 0)
+		{
+			side = aux_chess_side(*square) == 'w' ? ChessWhite : ChessBlack;
+			s->pieces[side][t] &= ~ChessBit(sq);
+			s->occupied[side] &= ~ChessBit(sq);
+			s->material[side] -= chess_piece_values[t];
+			s->psq[side] -= ChessPSQ(side, t, sq);
+			s->hash ^= chess_zobrist_pieces[side][t][sq];
+		}
+
+	*square = p;
+
+	t = aux_chess_piece_type(p);
+	if (t >= 0)
+		{
+			side = aux_chess_side(p) == 'w' ? ChessWhite : ChessBlack;
+			s->pieces[side][t] |= ChessBit(sq);
+			s->occupied[side] |= ChessBit(sq);
+			s->material[side] += chess_piece_values[t];
+			s->psq[side] += ChessPSQ(side, t, sq);
+			s->hash ^= chess_zobrist_pieces[side][t][sq];
+		}
+}
+
+/*
+ * This function rebuilds the bitboards, and the evaluation terms,
+ * from the board.
+ */
+
+void
+aux_chess_sync_bitboards(chess_game_status *s)
+{
+	int sq, t, side;
+	char p;
+
+	memset(s->pieces, 0, sizeof(s->pieces));
+	memset(s->occupied, 0, sizeof(s->occupied));
+	memset(s->material, 0, sizeof(s->material));
+	memset(s->psq, 0, sizeof(s->psq));
+	for (sq = 0; sq < 64; sq++)
+		{
+			p = s->b[ChessSquareX(sq)][ChessSquareY(sq)];
+			t = aux_chess_piece_type(p);
+			if (t < 0)
+				continue;
+			side = aux_chess_side(p) == 'w' ? ChessWhite : ChessBlack;
+			s->pieces[side][t] |= ChessBit(sq);
+			s->occupied[side] |= ChessBit(sq);
+			s->material[side] += chess_piece_values[t];
+			s->psq[side] += ChessPSQ(side, t, sq);
+		}
+}
+
+/*
+ * This function returns the part of the Zobrist hash which does not
+ * depend on the pieces: castling rights, en passant and side to move.
+ */
+
+uint64
+aux_chess_hash_state(const chess_game_status *s)
+{
+	uint64 h = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (s->c[i] == 'y')
+			h ^= chess_zobrist_castling[i];
+	if (s->ep_square >= 0)
+		h ^= chess_zobrist_ep[ChessSquareX(s->ep_square)];
+	if (s->previous_moves_n % 2)
+		h ^= chess_zobrist_black;
+	return h;
+}
+
+/*
+ * This function computes the Zobrist hash from scratch; it must be
+ * called after the bitboards are synced and the state is read.
+ */
+
+void
+aux_chess_compute_hash(chess_game_status *s)
+{
+	ChessBitboard b;
+	int side, t;
+
+	s->hash = aux_chess_hash_state(s);
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		for (t = ChessPawn; t <= ChessKing; t++)
+			for (b = s->pieces[side][t]; b; b &= b - 1)
+				s->hash ^= chess_zobrist_pieces[side][t][ChessFirstSquare(b)];
+}
+
+/*
+ * This function computes the key of the position in Polyglot books.
+ * Like ours, the en passant file counts only when a pawn of the side
+ * to move can capture there.
+ */
+
+uint64
+aux_chess_polyglot_key(const chess_game_status *s)
+{
+	ChessBitboard b;
+	uint64 k = 0;
+	int side, t, i;
+
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		for (t = ChessPawn; t <= ChessKing; t++)
+			for (b = s->pieces[side][t]; b; b &= b - 1)
+				k ^= chess_polyglot_random[ChessPolyglotPiece(side, t, ChessFirstSquare(b))];
+	for (i = 0; i < 4; i++)
+		if (s->c[i] == 'y')
+			k ^= chess_polyglot_random[ChessPolyglotCastling + i];
+	if (s->ep_square >= 0)
+		k ^= chess_polyglot_random[ChessPolyglotEP + ChessSquareX(s->ep_square)];
+	if (s->previous_moves_n % 2 == 0)
+		k ^= chess_polyglot_random[ChessPolyglotTurn];
+	return k;
+}
+
+int
+aux_init_chess_game_status(chess_game_status *s)
+{
+	s->candidate_move = ChessVoidMove;
+	return 0;
+};
+
+void
+aux_destroy_chess_game_status(chess_game_status *s)
+{
+	pfree(s);
+}
+
+/*
+ * This function returns an initialised chess_game_status for the
+ * current function. It is allocated on the first call in fn_mcxt and
+ * kept in fn_extra, so that a function called once per row reuses it
+ * instead of allocating a new one each time; it must not be destroyed,
+ * nor used by value-per-call set-returning functions, which keep their
+ * own state in fn_extra.
+ */
+
+chess_game_status *
+aux_fn_chess_game_status(FunctionCallInfo fcinfo)
+{
+	chess_game_status *s;
+
+	if (fcinfo->flinfo == NULL)
+		s = (chess_game_status *) palloc(sizeof(chess_game_status));
+	else if (fcinfo->flinfo->fn_extra == NULL)
+		s = fcinfo->flinfo->fn_extra =
+			MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(chess_game_status));
+	else
+		s = (chess_game_status *) fcinfo->flinfo->fn_extra;
+
+	/* the formal moves are only read after a rewind */
+	memset(s, 0, offsetof(chess_game_status, formal_moves));
+	memset(&s->previous_moves_n, 0,
+		   sizeof(chess_game_status) - offsetof(chess_game_status, previous_moves_n));
+	aux_init_chess_game_status(s);
+	return s;
+}
+
+/*
+ * This function applies the candidate move, which is then forgotten.
+ */
+
+void
+aux_chess_apply_candidate_move(chess_game_status *s)
+{
+	chess_undo u;
+
+	aux_chess_make_move(s, s->candidate_move, &u);
+	s->candidate_move = ChessVoidMove;
+}
+
+/*
+ * This function applies move to s in place, saving in *u what is
+ * needed by aux_chess_unmake_move to restore s. It does not check
+ * whether the move is admissible; castling is detected by the
+ * movement of the King, en passant by a pawn moving diagonally to
+ * the en passant target square.
+ */
+
+void
+aux_chess_make_move(chess_game_status *s, int move, chess_undo *u)
+{
+	int x1=0, x2=0, y1=0, y2=0;
+	char p1='-', p2='-';
+
+	u->move = move;
+	u->moved_piece = ' ';
+	u->captured_piece = ' ';
+	memcpy(u->c, s->c, 4);
+	u->ep_square = s->ep_square;
+	u->last_piece_captured = s->last_piece_captured;
+	u->halfmove_counter = s->halfmove_counter;
+	u->hash = s->hash;
+
+	s->hash ^= aux_chess_hash_state(s);
+	s->previous_moves_n++;
+
+	if (move != ChessVoidMove)
+		{
+			x1 = ChessMoveX1(move);
+			y1 = ChessMoveY1(move);
+			x2 = ChessMoveX2(move);
+			y2 = ChessMoveY2(move);
+			p1 = s->b[x1][y1];
+			p2 = s->b[x2][y2];
+			u->moved_piece = p1;
+			u->captured_piece = p2;
+			u->captured_square = ChessSquare(x2,y2);
+
+			/* en passant: the captured pawn is not on the target square */
+			if ((p1 == 'P' || p1 == 'p') && p2 == ' ' && x1 != x2 &&
+				ChessSquare(x2,y2) == s->ep_square)
+				{
+					u->captured_square = ChessSquare(x2,y1);
+					u->captured_piece = s->b[x2][y1];
+					aux_chess_set_square(s, u->captured_square, ' ');
+				}
+
+			s->last_piece_captured = u->captured_piece;
+			aux_chess_set_square(s, ChessSquare(x2,y2), p1);
+			aux_chess_set_square(s, ChessSquare(x1,y1), ' ');
+		}
+
+	/* 
+	 * If the King moves by > 1 squares, then he is castling, and the
+	 * Rook must be moved too.
+	 */
+
+	if (p1 == 'K' && x1 == 4 && x2 == 6)
+		{
+			aux_chess_set_square(s, ChessSquare(5,0), 'R');
+			aux_chess_set_square(s, ChessSquare(7,0), ' ');
+		}
+	if (p1 == 'K' && x1 == 4 && x2 == 2)
+		{
+			aux_chess_set_square(s, ChessSquare(3,0), 'R');
+			aux_chess_set_square(s, ChessSquare(0,0), ' ');
+		}
+	if (p1 == 'k' && x1 == 4 && x2 == 6)
+		{
+			aux_chess_set_square(s, ChessSquare(5,7), 'r');
+			aux_chess_set_square(s, ChessSquare(7,7), ' ');
+		}
+	if (p1 == 'k' && x1 == 4 && x2 == 2)
+		{
+			aux_chess_set_square(s, ChessSquare(3,7), 'r');
+			aux_chess_set_square(s, ChessSquare(0,7), ' ');
+		}
+
+	/*
+	 * Moving a King waives the castling status of its castles.
+	 */
+	if (p1 == 'K')
+		{
+			s->c[0] = 'n';
+			s->c[1] = 'n';
+		}
+	if (p1 == 'k')
+		{
+			s->c[2] = 'n';
+			s->c[3] = 'n';
+		}
+
+	/* 
+	 * Moving a Rook, or capturing it, waives its castling status.
+	 */
+
+	if (move != ChessVoidMove)
+		{
+			if ((x1 == 7 && y1 == 0) || (x2 == 7 && y2 == 0)) s->c[0] = 'n';
+			if ((x1 == 0 && y1 == 0) || (x2 == 0 && y2 == 0)) s->c[1] = 'n';
+			if ((x1 == 7 && y1 == 7) || (x2 == 7 && y2 == 7)) s->c[2] = 'n';
+			if ((x1 == 0 && y1 == 7) || (x2 == 0 && y2 == 7)) s->c[3] = 'n';
+		}
+
+	/* 
+	 * When pawns reach the other side, they are promoted.
+	 */
+	if (move != ChessVoidMove)
+		{
+			if (p1 == 'P' && y1 == 6 && y2 == 7)
+				aux_chess_set_square(s, ChessSquare(x2,y2),
+									 ChessMovePPCToChar(ChessMovePPC(move)) - 'a' + 'A');
+			if (p1 == 'p' && y1 == 1 && y2 == 0)
+				aux_chess_set_square(s, ChessSquare(x2,y2),
+									 ChessMovePPCToChar(ChessMovePPC(move)));
+		}
+
+	/*
+	 * A pawn move or a piece capture reset the halfmove counter.
+	 */
+
+	if (p1 == 'p' || p1 == 'P' || p2 != ' ')
+		s->halfmove_counter = 0;
+	else
+		s->halfmove_counter ++;
+
+	aux_chess_set_ep_square(s, move);
+	s->hash ^= aux_chess_hash_state(s);
+}
+
+/*
+ * This function undoes the move saved in *u, which must be the last
+ * move made on s.
+ */
+
+void
+aux_chess_unmake_move(chess_game_status *s, const chess_undo *u)
+{
+	int move = u->move;
+	int x1 = ChessMoveX1(move);
+	int y1 = ChessMoveY1(move);
+	int x2 = ChessMoveX2(move);
+	int y2 = ChessMoveY2(move);
+
+	s->previous_moves_n--;
+	memcpy(s->c, u->c, 4);
+	s->ep_square = u->ep_square;
+	s->last_piece_captured = u->last_piece_captured;
+	s->halfmove_counter = u->halfmove_counter;
+
+	if (move == ChessVoidMove)
+		{
+			s->hash = u->hash;
+			return;
+		}
+
+	/* castling: the Rook goes back too */
+	if ((u->moved_piece == 'K' || u->moved_piece == 'k') && x1 == 4 && x2 == 6)
+		{
+			aux_chess_set_square(s, ChessSquare(7,y1), s->b[5][y1]);
+			aux_chess_set_square(s, ChessSquare(5,y1), ' ');
+		}
+	if ((u->moved_piece == 'K' || u->moved_piece == 'k') && x1 == 4 && x2 == 2)
+		{
+			aux_chess_set_square(s, ChessSquare(0,y1), s->b[3][y1]);
+			aux_chess_set_square(s, ChessSquare(3,y1), ' ');
+		}
+
+	/* this also undoes promotions */
+	aux_chess_set_square(s, ChessSquare(x2,y2), ' ');
+	aux_chess_set_square(s, ChessSquare(x1,y1), u->moved_piece);
+	if (u->captured_piece != ' ')
+		aux_chess_set_square(s, u->captured_square, u->captured_piece);
+	s->hash = u->hash;
+}
+
+/*
+ * This function records the en passant target square created by
+ * move, which must have been applied already. As usual, the square
+ * is recorded only when a pawn of the opponent is there to capture.
+ */
+
+void
+aux_chess_set_ep_square(chess_game_status *s, int move)
+{
+	int sq1 = ChessMoveSource(move);
+	int sq2 = ChessMoveTarget(move);
+	char p = s->b[ChessMoveX2(move)][ChessMoveY2(move)];
+	int side = (p == 'P') ? ChessWhite : ChessBlack;
+
+	s->ep_square = -1;
+	if (move == ChessVoidMove ||
+		(p != 'P' && p != 'p') ||
+		(sq2 - sq1 != 16 && sq1 - sq2 != 16))
+		return;
+	if (chess_pawn_attacks[side][(sq1 + sq2) / 2] & s->pieces[1 - side][ChessPawn])
+		s->ep_square = (sq1 + sq2) / 2;
+}
+
+/*
+ * This function forgets an en passant target square read from the
+ * outside, when no pawn of the side to move can capture there; thus
+ * equal positions have equal representations.
+ */
+
+void
+aux_chess_check_ep_square(chess_game_status *s)
+{
+	int side = s->previous_moves_n % 2;
+
+	if (s->ep_square >= 0 &&
+		!(chess_pawn_attacks[1 - side][s->ep_square] & s->pieces[side][ChessPawn]))
+		s->ep_square = -1;
+}
+
+/*
+ * This function reads an input "game" argument into a chess_game_status
+ */
+
+int aux_read_game(chess_game_status *s, Datum d)
+{
+	HeapTupleHeader h;
+	bool isnull;
+
+	const char *game;
+
+	ArrayType *moves;
+	int last_move = ChessVoidMove;
+
+	int x1;
 	int y1;
 
 	h = DatumGetHeapTupleHeader(d);
@@ -310,7 +1989,8 @@ int aux_read_game(chess_game_status *s, Datum d)
 	d = GetAttributeByName(h, "board", &isnull);
 	if(isnull)
 		return 1;
-	game = TextDatumGetCString(DatumGetBpCharP(d));
+	/* character(69) is padded to its length, so it is read in place */
+	game = VARDATA_ANY(DatumGetBpCharPP(d));
 	for(x1=0;x1<8;x1++)
 		for(y1=0;y1<8;y1++)
 			s->b[x1][y1] = game[x1+8*y1];
@@ -319,791 +1999,4879 @@ int aux_read_game(chess_game_status *s, Datum d)
 	s->c[2] = game[66];
 	s->c[3] = game[67];
 	s->last_piece_captured = game[68];
+	aux_chess_sync_bitboards(s);
+
+	/* game.halfmove_counter */
+	d = GetAttributeByName(h, "halfmove_counter", &isnull);
+	if (isnull)
+		return 1;
+	s->halfmove_counter = DatumGetInt16(d);
+					
+	/* game.moves */
+	d = GetAttributeByName(h, "moves", &isnull);
+
+	/*
+	 * Only the number of moves and the last move are needed, for the
+	 * side to move and the en passant target square; moves is int2[],
+	 * so we can read the last element directly.
+	 */
+	s->previous_moves_n = 0;
+	if (!isnull)
+		{
+			moves = DatumGetArrayTypeP(d);
+			if (ARR_NDIM(moves) == 1) 
+				{
+					s->previous_moves_n = ARR_DIMS(moves)[0];
+					if (s->previous_moves_n > 0 && !ARR_HASNULL(moves))
+						last_move = ((int16 *) ARR_DATA_PTR(moves))[s->previous_moves_n - 1];
+				}
+		}
+	if (!ChessMoveIsValid(last_move))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid move %d", last_move)));
+
+	/* the en passant target square is implied by the last move */
+	aux_chess_set_ep_square(s, last_move);
+	aux_chess_compute_hash(s);
+
+	return 0;
+}
+
+/*
+ * This function reads a "chessboard" argument into a chess_game_status
+ */
+
+void
+aux_read_chessboard(chess_game_status *s, const ChessBoard *cb)
+{
+	int sq;
+
+	for (sq = 0; sq < 64; sq++)
+		s->b[ChessSquareX(sq)][ChessSquareY(sq)] = ChessBoardCodes[ChessBoardGetCode(cb, sq)];
+	s->c[0] = (cb->castling & 1) ? 'y' : 'n';
+	s->c[1] = (cb->castling & 2) ? 'y' : 'n';
+	s->c[2] = (cb->castling & 4) ? 'y' : 'n';
+	s->c[3] = (cb->castling & 8) ? 'y' : 'n';
+	s->ep_square = cb->ep_square;
+	s->last_piece_captured = cb->last_piece_captured;
+	s->halfmove_counter = cb->halfmove_counter;
+
+	/*
+	 * The side to move and the fullmove number are encoded, as for
+	 * the game type, by the number of previous moves; the moves
+	 * themselves are unknown.
+	 */
+	s->previous_moves_n = 2 * (Max(cb->fullmove_number, 1) - 1) + cb->side;
+
+	aux_chess_sync_bitboards(s);
+	aux_chess_check_ep_square(s);
+	aux_chess_compute_hash(s);
+}
+
+/*
+ * This function writes a chess_game_status into a "chessboard"
+ */
+
+void
+aux_write_chessboard(const chess_game_status *s, ChessBoard *cb)
+{
+	int sq;
+	char p;
+
+	memset(cb, 0, sizeof(ChessBoard));
+	for (sq = 0; sq < 64; sq++)
+		{
+			p = s->b[ChessSquareX(sq)][ChessSquareY(sq)];
+			if (p != ' ')
+				cb->squares[sq / 2] |=
+					(aux_chess_piece_type(p) + (aux_chess_side(p) == 'w' ? 1 : 7)) << (4 * (sq % 2));
+		}
+	cb->side = s->previous_moves_n % 2;
+	cb->castling = (s->c[0] == 'y' ? 1 : 0)
+		| (s->c[1] == 'y' ? 2 : 0)
+		| (s->c[2] == 'y' ? 4 : 0)
+		| (s->c[3] == 'y' ? 8 : 0);
+	cb->ep_square = s->ep_square;
+	cb->last_piece_captured = s->last_piece_captured;
+	cb->halfmove_counter = s->halfmove_counter;
+	cb->fullmove_number = 1 + s->previous_moves_n / 2;
+}
+
+/*
+ * This function tells whether argument argno of the current function,
+ * which can be either a "game" or a "chessboard", is a "game". Whether
+ * the argument type is composite is remembered, to avoid a catalog
+ * lookup on each call.
+ */
+
+bool
+aux_arg_is_game(FunctionCallInfo fcinfo, int argno)
+{
+	static Oid last_argtype = InvalidOid;
+	static bool last_argtype_is_game = true;
+	Oid argtype = get_fn_expr_argtype(fcinfo->flinfo, argno);
+
+	if (!OidIsValid(argtype))
+		return true;
+	if (argtype != last_argtype)
+		{
+			last_argtype_is_game = type_is_rowtype(argtype);
+			last_argtype = argtype;
+		}
+	return last_argtype_is_game;
+}
+
+/*
+ * This function reads argument argno of the current function, which
+ * can be either a "game" or a "chessboard", into a chess_game_status.
+ */
+
+int
+aux_read_game_arg(chess_game_status *s, FunctionCallInfo fcinfo, int argno)
+{
+	if (!aux_arg_is_game(fcinfo, argno))
+		{
+			aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(argno));
+			return 0;
+		}
+	return aux_read_game(s, PG_GETARG_DATUM(argno));
+}
+
+/*
+ * This function reads argument argno of the current function, which
+ * can be either a "game" or a "chessboard", as a chessboard; a game
+ * is converted into cb, a chessboard is returned as it is.
+ */
+
+const ChessBoard *
+aux_read_position_arg(FunctionCallInfo fcinfo, int argno, ChessBoard *cb)
+{
+	chess_game_status *s;
+
+	if (!aux_arg_is_game(fcinfo, argno))
+		return PG_GETARG_CHESSBOARD_P(argno);
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	aux_init_chess_game_status(s);
+	if (aux_read_game(s, PG_GETARG_DATUM(argno)))
+		ereport(ERROR, (errmsg("null board in game")));
+	aux_write_chessboard(s, cb);
+	pfree(s);
+	return cb;
+}
+
+/*
+ * This function reads a position in Forsyth-Edwards Notation into a
+ * chess_game_status. The halfmove clock and the fullmove number can
+ * be omitted, as in EPD.
+ */
+
+#define aux_chess_fen_error(fen,detail)								\
+	ereport(ERROR,															\
+			(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),					\
+			 errmsg("invalid FEN: \"%s\"", fen),							\
+			 errdetail(detail)))
+
+void
+aux_chess_read_fen(chess_game_status *s, const char *fen)
+{
+	const char *p = fen;
+	int x = 0, y = 7;
+	int side = 0;
+	int fullmove = 1;
+
+	/* (1) piece placement */
+	memset(s->b, ' ', sizeof(s->b));
+	for (; *p != '\0' && *p != ' '; p++)
+		{
+			if (*p == '/' && x == 8 && y > 0)
+				{
+					x = 0;
+					y--;
+				}
+			else if (*p >= '1' && *p <= '8' && x + (*p - '0') <= 8)
+				x += *p - '0';
+			else if (aux_chess_piece_type(*p) >= 0 && x < 8)
+				s->b[x++][y] = *p;
+			else
+				aux_chess_fen_error(fen, "Invalid piece placement.");
+		}
+	if (x != 8 || y != 0)
+		aux_chess_fen_error(fen, "Invalid piece placement.");
+
+	/* (2) active colour */
+	while (*p == ' ') p++;
+	if (*p == 'w')
+		side = 0;
+	else if (*p == 'b')
+		side = 1;
+	else
+		aux_chess_fen_error(fen, "Invalid active colour.");
+	p++;
+
+	/* (3) castling availability */
+	while (*p == ' ') p++;
+	memcpy(s->c, "nnnn", 4);
+	if (*p == '-')
+		p++;
+	else
+		for (; *p != '\0' && *p != ' '; p++)
+			switch (*p)
+				{
+				case 'K': s->c[0] = 'y'; break;
+				case 'Q': s->c[1] = 'y'; break;
+				case 'k': s->c[2] = 'y'; break;
+				case 'q': s->c[3] = 'y'; break;
+				default:
+					aux_chess_fen_error(fen, "Invalid castling availability.");
+				}
+
+	/* (4) en passant target square */
+	while (*p == ' ') p++;
+	s->ep_square = -1;
+	if (*p == '-')
+		p++;
+	else if (p[0] >= 'a' && p[0] <= 'h' && p[1] == (side == 0 ? '6' : '3'))
+		{
+			s->ep_square = ChessSquare(p[0] - 'a', p[1] - '1');
+			p += 2;
+		}
+	else
+		aux_chess_fen_error(fen, "Invalid en passant target square.");
+
+	/*
+	 * (5) halfmove clock and (6) fullmove number; both end up in the
+	 * int16 fields of ChessBoard
+	 */
+	s->halfmove_counter = 0;
+	while (*p == ' ') p++;
+	if (*p != '\0')
+		{
+			if (*p < '0' || *p > '9')
+				aux_chess_fen_error(fen, "Invalid halfmove clock.");
+			for (s->halfmove_counter = 0; *p >= '0' && *p <= '9' && s->halfmove_counter <= PG_INT16_MAX; p++)
+				s->halfmove_counter = 10 * s->halfmove_counter + (*p - '0');
+			if ((*p != '\0' && *p != ' ') || s->halfmove_counter > PG_INT16_MAX)
+				aux_chess_fen_error(fen, "Invalid halfmove clock.");
+			while (*p == ' ') p++;
+		}
+	if (*p != '\0')
+		{
+			if (*p < '0' || *p > '9')
+				aux_chess_fen_error(fen, "Invalid fullmove number.");
+			for (fullmove = 0; *p >= '0' && *p <= '9' && fullmove <= PG_INT16_MAX; p++)
+				fullmove = 10 * fullmove + (*p - '0');
+			if ((*p != '\0' && *p != ' ') || fullmove < 1 || fullmove > PG_INT16_MAX)
+				aux_chess_fen_error(fen, "Invalid fullmove number.");
+			while (*p == ' ') p++;
+		}
+	if (*p != '\0')
+		aux_chess_fen_error(fen, "Unexpected trailing data.");
+
+	s->previous_moves_n = 2 * (fullmove - 1) + side;
+	s->last_piece_captured = ' ';
+	s->candidate_move = ChessVoidMove;
+
+	aux_chess_sync_bitboards(s);
+	if (ChessPopCount(s->pieces[ChessWhite][ChessKing]) != 1 ||
+		ChessPopCount(s->pieces[ChessBlack][ChessKing]) != 1)
+		aux_chess_fen_error(fen, "Each side must have exactly one King.");
+	aux_chess_check_ep_square(s);
+	aux_chess_compute_hash(s);
+}
+
+/*
+ * This function reads a "move" argument into an int
+ */
+
+int aux_read_move(Datum d)
+{
+	HeapTupleHeader h;
+	bool isnull;
+
+	int x1;
+	int x2;
+	int y1;
+	int y2;
+	int ppc;
+
+	h = DatumGetHeapTupleHeader(d);
+
+	/*
+	 * SQL object definitions which are relevant here:
+	 *
+	 * CREATE TYPE move AS (x1 int2, y1 int2, x2 int2, y2 int2, ppc int2);
+	 */
+
+	x1  = DatumGetInt16(GetAttributeByName(h, "x1",  &isnull));
+	x2  = DatumGetInt16(GetAttributeByName(h, "x2",  &isnull));
+	y1  = DatumGetInt16(GetAttributeByName(h, "y1",  &isnull));
+	y2  = DatumGetInt16(GetAttributeByName(h, "y2",  &isnull));
+	ppc = DatumGetInt16(GetAttributeByName(h, "ppc", &isnull));
+
+	/* the fields of move are 1-based */
+	if (!ChessValidXY(x1 - 1, y1 - 1) || !ChessValidXY(x2 - 1, y2 - 1) ||
+		ppc < 0 || ppc > 3)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid move (%d,%d,%d,%d,%d)", x1, y1, x2, y2, ppc)));
+
+	return ChessMove(x1 - 1, y1 - 1, x2 - 1, y2 - 1, ppc);
+}
+
+/*
+ * This function reads an int2[] of moves, returning their number and
+ * pointing *moves to their values (without copying, when possible).
+ * Each move must encode two squares and a promotion piece.
+ */
+
+int
+aux_read_moves_array(ArrayType *a, int16 **moves)
+{
+	int n, i;
+
+	if (ARR_NDIM(a) == 0)
+		{
+			*moves = NULL;
+			return 0;
+		}
+	if (ARR_NDIM(a) != 1 || ARR_HASNULL(a) || ARR_ELEMTYPE(a) != INT2OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("moves must be a one-dimensional int2 array without nulls")));
+
+	n = ARR_DIMS(a)[0];
+	*moves = (int16 *) ARR_DATA_PTR(a);
+	for (i = 0; i < n; i++)
+		if (!ChessMoveIsValid((*moves)[i]))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid move %d", (*moves)[i])));
+	return n;
+}
+
+/*
+ * This function returns the blessed tuple descriptor of the "game"
+ * returned by the current function.
+ */
+
+TupleDesc
+aux_game_tuple_desc(FunctionCallInfo fcinfo)
+{
+	TupleDesc tuple_desc;
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	return BlessTupleDesc(tuple_desc);
+}
+
+/*
+ * This function builds a "game" from a chess_game_status. The "moves"
+ * field is the concatenation of the n1 int2 values in moves1 (or void
+ * moves, if moves1 is NULL) and of the n2 int values in moves2; the
+ * caller must ensure that n1 + n2 == s->previous_moves_n. Each game
+ * built is counted as a clone of the position.
+ */
+
+Datum
+aux_write_game(TupleDesc tuple_desc, const chess_game_status *s,
+			   const int16 *moves1, int n1, const int *moves2, int n2)
+{
+	Datum values[3];
+	bool isnull[3] = { false, false, false };
+	Datum *moves;
+	char board[69];
+	int i, x, y;
+
+	/*
+	 * SQL object definitions which are relevant here:
+	 *
+	 * CREATE TYPE game AS (board character(69), halfmove_counter int2, moves int2[]);
+	 */
+
+	for (x = 0; x < 8; x++)
+		for (y = 0; y < 8; y++)
+			board[x + 8 * y] = s->b[x][y];
+	memcpy(board + 64, s->c, 4);
+	board[68] = s->last_piece_captured;
+	values[0] = PointerGetDatum(cstring_to_text_with_len(board, 69));
+
+	values[1] = Int16GetDatum(s->halfmove_counter);
+	ChessStatsAdd(ChessStatClones, 1);
+
+	if (n1 + n2 == 0)
+		values[2] = PointerGetDatum(construct_empty_array(INT2OID));
+	else
+		{
+			moves = (Datum *) palloc(sizeof(Datum) * (n1 + n2));
+			for (i = 0; i < n1; i++)
+				moves[i] = Int16GetDatum(moves1 == NULL ? ChessVoidMove : moves1[i]);
+			for (i = 0; i < n2; i++)
+				moves[n1 + i] = Int16GetDatum(moves2[i]);
+			values[2] = PointerGetDatum(construct_array(moves, n1 + n2,
+														INT2OID, sizeof(int16), true, 's'));
+		}
+
+	return HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull));
+}
+
+/*
+ * Formal moves are enumerated by target square, from a1 to h8; for
+ * each target square we look up which of our pieces can reach it,
+ * using the attack tables above, rather than walking the board:
+ *
+ *---------+---------------------------------------------------------*
+ * Piece   | Moves                                                   *
+ *---------+---------------------------------------------------------*
+ * Knight  | knight attacks from the target square                   *
+ * Slider  | rook/bishop attacks from the target square              *
+ * King    | king attacks from the target square, plus castling      *
+ * Pawn    | forward if the target is empty, otherwise capturing     *
+ *         | (also en passant); when rank = max, one move for each   *
+ *         | promotion choice                                        *
+ *---------+---------------------------------------------------------*/
+
+/*
+ * This function rewinds the formal move iterator to the start, by
+ * generating the list of the formal moves of the current position.
+ */
+
+int
+aux_chess_formal_move_rewind(chess_game_status *s)
+{
+	aux_chess_generate_formal_moves(s);
+	s->move_iterator = 0;
+	return 0;
+}
+
+/*
+ * This function finds the next formal move available, returning 0
+ * iff there is none.
+ */
+
+int
+aux_chess_formal_move_next(chess_game_status *s)
+{
+	if (s->halfmove_counter >= 50 ||
+		s->move_iterator >= s->formal_moves_n)
+		{
+			s->candidate_move=ChessEndOfMoves;
+			return 0;
+		}
+
+	s->candidate_move = s->formal_moves[s->move_iterator++];
+	return 1;
+}
+
+#define aux_chess_add_formal_move(s,m)									\
+	do {																\
+		if ((s)->formal_moves_n >= ChessMaxFormalMoves)					\
+			ereport(ERROR, (errmsg("too many formal moves")));			\
+		(s)->formal_moves[(s)->formal_moves_n++] = (m);					\
+	} while (0)
+
+/*
+ * This function fills s->formal_moves with all the formal moves of
+ * the side to move, that is, the moves that follow the rules of
+ * each piece, without checking whether our King is left in check.
+ */
+
+void
+aux_chess_generate_formal_moves(chess_game_status *s)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int them = 1 - us;
+	int forward = (us == ChessWhite) ? 8 : -8;
+	int first_rank = (us == ChessWhite) ? 0 : 7;
+	int last_rank = (us == ChessWhite) ? 7 : 0;
+	ChessBitboard *mine = s->pieces[us];
+	ChessBitboard occupied = s->occupied[ChessWhite] | s->occupied[ChessBlack];
+	ChessBitboard targets = ~s->occupied[us];
+	ChessBitboard sources;
+	int tg, sq, ppc;
+	instr_time start;
+
+	INSTR_TIME_SET_ZERO(start);
+	ChessStatsTimerStart(start);
+	s->formal_moves_n = 0;
+
+	while (targets)
+		{
+			tg = ChessFirstSquare(targets);
+			targets &= targets - 1;
+
+			/* Knight, Rook, Bishop, Queen and King */
+			sources = (chess_knight_attacks[tg] & mine[ChessKnight])
+				| (ChessRookAttacks(tg, occupied) & (mine[ChessRook] | mine[ChessQueen]))
+				| (ChessBishopAttacks(tg, occupied) & (mine[ChessBishop] | mine[ChessQueen]))
+				| (chess_king_attacks[tg] & mine[ChessKing]);
+			while (sources)
+				{
+					sq = ChessFirstSquare(sources);
+					sources &= sources - 1;
+					aux_chess_add_formal_move(s, ChessMoveFromSquares(sq, tg, 0));
+				}
+
+			/*
+			 * Castling: the King and the Rook must be in place, and
+			 * the squares between them empty.
+			 */
+			if (tg == ChessSquare(6, first_rank) &&
+				s->c[2 * us] == 'y' &&
+				(mine[ChessKing] & ChessBit(ChessSquare(4, first_rank))) &&
+				(mine[ChessRook] & ChessBit(ChessSquare(7, first_rank))) &&
+				!(occupied & (ChessBit(ChessSquare(5, first_rank)) |
+							  ChessBit(ChessSquare(6, first_rank)))))
+				aux_chess_add_formal_move(s, ChessMoveFromSquares(ChessSquare(4, first_rank), tg, 0));
+			if (tg == ChessSquare(2, first_rank) &&
+				s->c[2 * us + 1] == 'y' &&
+				(mine[ChessKing] & ChessBit(ChessSquare(4, first_rank))) &&
+				(mine[ChessRook] & ChessBit(ChessSquare(0, first_rank))) &&
+				!(occupied & (ChessBit(ChessSquare(1, first_rank)) |
+							  ChessBit(ChessSquare(2, first_rank)) |
+							  ChessBit(ChessSquare(3, first_rank)))))
+				aux_chess_add_formal_move(s, ChessMoveFromSquares(ChessSquare(4, first_rank), tg, 0));
+
+			/* Pawn */
+			if ((occupied & ChessBit(tg)) || tg == s->ep_square)
+				{
+					/* only capturing, possibly en passant */
+					sources = chess_pawn_attacks[them][tg] & mine[ChessPawn];
+				}
+			else if (ChessSquareY(tg) != first_rank)
+				{
+					/* only non-capturing */
+					sources = mine[ChessPawn] & ChessBit(tg - forward);
+					if (!sources &&
+						ChessSquareY(tg) == first_rank + 3 * (forward / 8) &&
+						!(occupied & ChessBit(tg - forward)))
+						sources = mine[ChessPawn] & ChessBit(tg - 2 * forward);
+				}
+			else
+				sources = 0;
+			while (sources)
+				{
+					sq = ChessFirstSquare(sources);
+					sources &= sources - 1;
+					if (ChessSquareY(tg) == last_rank)
+						for (ppc = 0; ppc < 4; ppc++)
+							aux_chess_add_formal_move(s, ChessMoveFromSquares(sq, tg, ppc));
+					else
+						aux_chess_add_formal_move(s, ChessMoveFromSquares(sq, tg, 0));
+				}
+		}
+
+	ChessStatsAdd(ChessStatFormalMoves, s->formal_moves_n);
+	ChessStatsTimerStop(ChessStatMoveGenNs, start);
+}
+
+/*
+ * This function decides whether square sq is attacked by side, by
+ * looking from sq for pieces of that side which can reach it.
+ */
+
+bool
+aux_chess_square_attacked(const chess_game_status *s, int sq, int side)
+{
+	const ChessBitboard *theirs = s->pieces[side];
+	ChessBitboard occupied = s->occupied[ChessWhite] | s->occupied[ChessBlack];
+
+	return (chess_pawn_attacks[1 - side][sq] & theirs[ChessPawn])
+		|| (chess_knight_attacks[sq] & theirs[ChessKnight])
+		|| (chess_king_attacks[sq] & theirs[ChessKing])
+		|| (ChessBishopAttacks(sq, occupied) & (theirs[ChessBishop] | theirs[ChessQueen]))
+		|| (ChessRookAttacks(sq, occupied) & (theirs[ChessRook] | theirs[ChessQueen]));
+}
+
+/*
+ * This function makes move (which is assumed to be a formal move) in
+ * place, unless it leaves its own king under attack: in that case s
+ * is unchanged, and false is returned.
+ */
+
+bool
+aux_chess_make_legal_move(chess_game_status *s, int move, chess_undo *u)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int sq1 = ChessMoveSource(move);
+	int sq2 = ChessMoveTarget(move);
+	ChessBitboard king;
+
+	ChessStatsAdd(ChessStatLegalityChecks, 1);
+
+	/*
+	 * The King cannot castle out of, or through, an attacked square;
+	 * the target square is checked below, as for any move.
+	 */
+	if ((s->pieces[us][ChessKing] & ChessBit(sq1)) &&
+		(sq2 - sq1 == 2 || sq1 - sq2 == 2) &&
+		(aux_chess_square_attacked(s, sq1, 1 - us) ||
+		 aux_chess_square_attacked(s, (sq1 + sq2) / 2, 1 - us)))
+		return false;
+
+	aux_chess_make_move(s, move, u);
+	king = s->pieces[us][ChessKing];
+	if (king != 0 && aux_chess_square_attacked(s, ChessFirstSquare(king), 1 - us))
+		{
+			aux_chess_unmake_move(s, u);
+			return false;
+		}
+	return true;
+}
+
+/*
+ * This function decides whether the candidate move (which is assumed
+ * to be a formal move) leaves its own king under attack. The move is
+ * made and unmade in place, so s is unchanged on return.
+ */
+
+int
+aux_chess_is_king_safe(chess_game_status *s)
+{
+	chess_undo u;
+
+	if (!aux_chess_make_legal_move(s, s->candidate_move, &u))
+		return 0;
+	aux_chess_unmake_move(s, &u);
+	return 1;
+}
+
+/*
+ * This function stores the valid moves of s into moves, which must
+ * have room for ChessMaxFormalMoves elements, and returns how many
+ * they are. The moves are in the same order as for valid_moves.
+ */
+
+int
+aux_chess_valid_moves(chess_game_status *s, int *moves)
+{
+	int n = 0;
+
+	aux_chess_formal_move_rewind(s);
+	while (aux_chess_formal_move_next(s))
+		if (aux_chess_is_king_safe(s))
+			moves[n++] = s->candidate_move;
+
+	return n;
+}
+
+/*
+ * This function decodes a move in Standard Algebraic Notation, as in
+ * PGN: "e4", "exd5", "Nbd7", "R1e2", "e8=Q", "O-O-O", with optional
+ * check and annotation suffixes. It also accepts long algebraic moves
+ * such as "Ng1-f3" or "e2e4", and promotions without "=". It returns
+ * the move, ChessSANInvalid when it is malformed or matches no valid
+ * move, and ChessSANAmbiguous when it matches several. Only the
+ * formal moves which match are checked for legality.
+ */
+
+int
+aux_chess_san_to_move(chess_game_status *s, const char *san, int len)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int type = ChessPawn;
+	int ppc = -1;
+	int from_x = -1, from_y = -1;
+	int target, king, move = ChessSANInvalid;
+	int i, m, sq1;
+	chess_undo u;
+
+	while (len > 0 && strchr("+#!?", san[len - 1]) != NULL)
+		len--;
+
+	if (len >= 3 && (san[0] == 'O' || san[0] == '0') && san[1] == '-' && san[2] == san[0])
+		{
+			if (len == 3)
+				i = 2;
+			else if (len == 5 && san[3] == '-' && san[4] == san[0])
+				i = -2;
+			else
+				return ChessSANInvalid;
+			if (s->pieces[us][ChessKing] == 0)
+				return ChessSANInvalid;
+			king = ChessFirstSquare(s->pieces[us][ChessKing]);
+			from_x = ChessSquareX(king);
+			from_y = ChessSquareY(king);
+			target = king + i;
+			type = ChessKing;
+		}
+	else
+		{
+			if (len > 0 && strchr("NBRQK", san[0]) != NULL)
+				{
+					type = aux_chess_piece_type(san[0]);
+					san++;
+					len--;
+				}
+			if (type == ChessPawn && len >= 3 && strchr("qbnrQBNR", san[len - 1]) != NULL &&
+				(san[len - 2] == '=' || san[len - 2] == '1' || san[len - 2] == '8'))
+				{
+					ppc = (strchr("qbnrQBNR", san[len - 1]) - "qbnrQBNR") % 4;
+					len -= (san[len - 2] == '=') ? 2 : 1;
+				}
+			if (len < 2 || san[len - 2] < 'a' || san[len - 2] > 'h' ||
+				san[len - 1] < '1' || san[len - 1] > '8')
+				return ChessSANInvalid;
+			target = ChessSquare(san[len - 2] - 'a', san[len - 1] - '1');
+			for (i = 0; i < len - 2; i++)
+				if (san[i] >= 'a' && san[i] <= 'h')
+					from_x = san[i] - 'a';
+				else if (san[i] >= '1' && san[i] <= '8')
+					from_y = san[i] - '1';
+				else if (san[i] != 'x' && san[i] != ':' && san[i] != '-')
+					return ChessSANInvalid;
+		}
+
+	aux_chess_generate_formal_moves(s);
+	for (i = 0; i < s->formal_moves_n; i++)
+		{
+			m = s->formal_moves[i];
+			sq1 = ChessMoveSource(m);
+			if (ChessMoveTarget(m) != target ||
+				!(s->pieces[us][type] & ChessBit(sq1)) ||
+				(from_x >= 0 && ChessSquareX(sq1) != from_x) ||
+				(from_y >= 0 && ChessSquareY(sq1) != from_y))
+				continue;
+			/* promotions must say what the pawn becomes */
+			if (type == ChessPawn && (target < 8 || target >= 56)
+				? ChessMovePPC(m) != ppc
+				: ppc >= 0)
+				continue;
+			if (!aux_chess_make_legal_move(s, m, &u))
+				continue;
+			aux_chess_unmake_move(s, &u);
+			if (move != ChessSANInvalid)
+				return ChessSANAmbiguous;
+			move = m;
+		}
+
+	return move;
+}
+
+/*
+ * This function stores the legal moves of s into moves, as
+ * aux_chess_valid_moves, but regardless of the halfmove counter: the
+ * notation of a move does not depend on it.
+ */
+
+int
+aux_chess_legal_moves(chess_game_status *s, int *moves)
+{
+	chess_undo u;
+	int i, n = 0;
+
+	aux_chess_generate_formal_moves(s);
+	for (i = 0; i < s->formal_moves_n; i++)
+		if (aux_chess_make_legal_move(s, s->formal_moves[i], &u))
+			{
+				aux_chess_unmake_move(s, &u);
+				moves[n++] = s->formal_moves[i];
+			}
+
+	return n;
+}
+
+/*
+ * This function writes the SAN of move into san, which must have room
+ * for ChessSANSize characters; move must be one of the n legal moves
+ * of s, which are used for disambiguation. The check suffix is added
+ * by aux_chess_san_check, once the move is made, because it depends on
+ * the legal moves of the next position.
+ */
+
+void
+aux_chess_move_to_san(const chess_game_status *s, int move, const int *moves, int n, char *san)
+{
+	int sq1 = ChessMoveSource(move);
+	int sq2 = ChessMoveTarget(move);
+	char p = s->b[ChessSquareX(sq1)][ChessSquareY(sq1)];
+	int type = aux_chess_piece_type(p);
+	bool same_file = false, same_rank = false, ambiguous = false;
+	int i, other;
+
+	if (type == ChessKing && (sq2 - sq1 == 2 || sq1 - sq2 == 2))
+		{
+			strcpy(san, sq2 > sq1 ? "O-O" : "O-O-O");
+			return;
+		}
+
+	if (type != ChessPawn)
+		{
+			*san++ = ChessPieceChar(ChessWhite, type);
+			for (i = 0; i < n; i++)
+				{
+					other = ChessMoveSource(moves[i]);
+					if (ChessMoveTarget(moves[i]) != sq2 || other == sq1 ||
+						s->b[ChessSquareX(other)][ChessSquareY(other)] != p)
+						continue;
+					ambiguous = true;
+					same_file |= (ChessSquareX(other) == ChessSquareX(sq1));
+					same_rank |= (ChessSquareY(other) == ChessSquareY(sq1));
+				}
+			if (ambiguous && (!same_file || same_rank))
+				*san++ = 'a' + ChessSquareX(sq1);
+			if (ambiguous && same_file)
+				*san++ = '1' + ChessSquareY(sq1);
+		}
+	else if (aux_chess_move_is_capture(s, move))
+		*san++ = 'a' + ChessSquareX(sq1);
+
+	if (aux_chess_move_is_capture(s, move))
+		*san++ = 'x';
+	*san++ = 'a' + ChessSquareX(sq2);
+	*san++ = '1' + ChessSquareY(sq2);
+	if (type == ChessPawn && (sq2 < 8 || sq2 >= 56))
+		{
+			*san++ = '=';
+			*san++ = "QBNR"[ChessMovePPC(move)];
+		}
+	*san = '\0';
+}
+
+/*
+ * This function appends "+" or "#" to san when the side to move in s,
+ * which has n legal moves, is in check.
+ */
+
+void
+aux_chess_san_check(const chess_game_status *s, int n, char *san)
+{
+	if (aux_chess_in_check(s))
+		strcat(san, n == 0 ? "#" : "+");
+}
+
+/*
+ * This function returns the pieces of side attacking sq, when the
+ * occupied squares are occupied.
+ */
+
+ChessBitboard
+aux_chess_attackers(const chess_game_status *s, int sq, int side, ChessBitboard occupied)
+{
+	const ChessBitboard *theirs = s->pieces[side];
+
+	return (chess_pawn_attacks[1 - side][sq] & theirs[ChessPawn])
+		| (chess_knight_attacks[sq] & theirs[ChessKnight])
+		| (chess_king_attacks[sq] & theirs[ChessKing])
+		| (ChessBishopAttacks(sq, occupied) & (theirs[ChessBishop] | theirs[ChessQueen]))
+		| (ChessRookAttacks(sq, occupied) & (theirs[ChessRook] | theirs[ChessQueen]));
+}
+
+/*
+ * This function returns the squares strictly between sq1 and sq2,
+ * when they are on the same line, and 0 otherwise.
+ */
+
+ChessBitboard
+aux_chess_between(int sq1, int sq2)
+{
+	if (ChessRookAttacks(sq1, 0) & ChessBit(sq2))
+		return ChessRookAttacks(sq1, ChessBit(sq2)) & ChessRookAttacks(sq2, ChessBit(sq1));
+	if (ChessBishopAttacks(sq1, 0) & ChessBit(sq2))
+		return ChessBishopAttacks(sq1, ChessBit(sq2)) & ChessBishopAttacks(sq2, ChessBit(sq1));
+	return 0;
+}
+
+/*
+ * This function returns the number of the valid moves of s, that is,
+ * aux_chess_valid_moves(s) without the moves.
+ *
+ * Instead of making each formal move to see whether it leaves the
+ * King in check, the moves are counted on attack bitboards: the King
+ * can go to the squares that are not attacked, a pinned piece can
+ * only move along the pin, and when in check the other pieces can
+ * only capture the checker or block its line. En passant, and
+ * positions without exactly one King, are left to the slow way.
+ */
+
+int
+aux_chess_count_valid_moves(chess_game_status *s)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int them = 1 - us;
+	int forward = (us == ChessWhite) ? 8 : -8;
+	int first_rank = (us == ChessWhite) ? 0 : 7;
+	int last_rank = (us == ChessWhite) ? 7 : 0;
+	const ChessBitboard *mine = s->pieces[us];
+	const ChessBitboard *theirs = s->pieces[them];
+	ChessBitboard occupied = s->occupied[ChessWhite] | s->occupied[ChessBlack];
+	ChessBitboard checkers, snipers, pinned = 0, allowed, b, t;
+	ChessBitboard pin_line[64];
+	int moves[ChessMaxFormalMoves];
+	int n = 0, k, sq, tg;
+	chess_undo u;
+
+	if (s->halfmove_counter >= 50)
+		return 0;
+	if (ChessPopCount(mine[ChessKing]) != 1)
+		return aux_chess_valid_moves(s, moves);
+
+	k = ChessFirstSquare(mine[ChessKing]);
+	checkers = aux_chess_attackers(s, k, them, occupied);
+
+	/* King: the squares it leaves behind do not shield it any more */
+	for (b = chess_king_attacks[k] & ~s->occupied[us]; b; b &= b - 1)
+		if (!aux_chess_attackers(s, ChessFirstSquare(b), them, occupied & ~ChessBit(k)))
+			n++;
+	if (ChessPopCount(checkers) > 1)
+		return n;
+
+	/* castling, as in aux_chess_generate_formal_moves */
+	if (!checkers && k == ChessSquare(4, first_rank))
+		{
+			if (s->c[2 * us] == 'y' &&
+				(mine[ChessRook] & ChessBit(ChessSquare(7, first_rank))) &&
+				!(occupied & (ChessBit(ChessSquare(5, first_rank)) | ChessBit(ChessSquare(6, first_rank)))) &&
+				!aux_chess_attackers(s, ChessSquare(5, first_rank), them, occupied) &&
+				!aux_chess_attackers(s, ChessSquare(6, first_rank), them,
+									 occupied ^ ChessBit(k) ^ ChessBit(ChessSquare(6, first_rank))
+									 ^ ChessBit(ChessSquare(7, first_rank)) ^ ChessBit(ChessSquare(5, first_rank))))
+				n++;
+			if (s->c[2 * us + 1] == 'y' &&
+				(mine[ChessRook] & ChessBit(ChessSquare(0, first_rank))) &&
+				!(occupied & (ChessBit(ChessSquare(1, first_rank)) | ChessBit(ChessSquare(2, first_rank)) |
+							  ChessBit(ChessSquare(3, first_rank)))) &&
+				!aux_chess_attackers(s, ChessSquare(3, first_rank), them, occupied) &&
+				!aux_chess_attackers(s, ChessSquare(2, first_rank), them,
+									 occupied ^ ChessBit(k) ^ ChessBit(ChessSquare(2, first_rank))
+									 ^ ChessBit(ChessSquare(0, first_rank)) ^ ChessBit(ChessSquare(3, first_rank))))
+				n++;
+		}
+
+	/* the other pieces can only capture the checker, or block it */
+	allowed = ~s->occupied[us];
+	if (checkers)
+		allowed = checkers | aux_chess_between(k, ChessFirstSquare(checkers));
+
+	/* pins: their sliders which see our King through one of ours */
+	snipers = (ChessRookAttacks(k, s->occupied[them]) & (theirs[ChessRook] | theirs[ChessQueen]))
+		| (ChessBishopAttacks(k, s->occupied[them]) & (theirs[ChessBishop] | theirs[ChessQueen]));
+	for (; snipers; snipers &= snipers - 1)
+		{
+			sq = ChessFirstSquare(snipers);
+			b = aux_chess_between(k, sq);
+			t = b & occupied;
+			if (t && !(t & (t - 1)) && (t & s->occupied[us]))
+				{
+					pinned |= t;
+					pin_line[ChessFirstSquare(t)] = b | ChessBit(sq);
+				}
+		}
+
+#define aux_chess_targets(sq,b) (((pinned & ChessBit(sq)) ? pin_line[sq] : ~UINT64CONST(0)) & allowed & (b))
+
+	for (b = mine[ChessKnight] & ~pinned; b; b &= b - 1)
+		{
+			sq = ChessFirstSquare(b);
+			n += ChessPopCount(aux_chess_targets(sq, chess_knight_attacks[sq]));
+		}
+	for (b = mine[ChessBishop] | mine[ChessQueen]; b; b &= b - 1)
+		{
+			sq = ChessFirstSquare(b);
+			n += ChessPopCount(aux_chess_targets(sq, ChessBishopAttacks(sq, occupied)));
+		}
+	for (b = mine[ChessRook] | mine[ChessQueen]; b; b &= b - 1)
+		{
+			sq = ChessFirstSquare(b);
+			n += ChessPopCount(aux_chess_targets(sq, ChessRookAttacks(sq, occupied)));
+		}
+	for (b = mine[ChessPawn]; b; b &= b - 1)
+		{
+			sq = ChessFirstSquare(b);
+
+			/* captures, except en passant */
+			t = chess_pawn_attacks[us][sq] & s->occupied[them];
+
+			/* pushes */
+			tg = sq + forward;
+			if (tg >= 0 && tg < 64 && ChessSquareY(tg) != first_rank && !(occupied & ChessBit(tg)))
+				{
+					t |= ChessBit(tg);
+					if (ChessSquareY(tg + forward) == first_rank + 3 * (forward / 8) &&
+						!(occupied & ChessBit(tg + forward)))
+						t |= ChessBit(tg + forward);
+				}
+
+			t = aux_chess_targets(sq, t);
+			n += ChessPopCount(t & ~ChessRankOf(ChessSquare(0, last_rank)))
+				+ 4 * ChessPopCount(t & ChessRankOf(ChessSquare(0, last_rank)));
+		}
+
+#undef aux_chess_targets
+
+	/* en passant */
+	if (s->ep_square >= 0 && !(occupied & ChessBit(s->ep_square)))
+		for (b = chess_pawn_attacks[them][s->ep_square] & mine[ChessPawn]; b; b &= b - 1)
+			if (aux_chess_make_legal_move(s, ChessMoveFromSquares(ChessFirstSquare(b), s->ep_square, 0), &u))
+				{
+					aux_chess_unmake_move(s, &u);
+					n++;
+				}
+
+	return n;
+}
+
+/*
+ * This function counts the leaf nodes of the tree of valid moves of
+ * s, up to depth plies (perft). The last ply is counted in bulk,
+ * without making its moves.
+ */
+
+int64
+aux_chess_perft(chess_game_status *s, int depth)
+{
+	int moves[ChessMaxFormalMoves];
+	int n = 0, i;
+	int64 nodes = 0;
+	chess_undo u;
+
+	if (depth == 0)
+		return 1;
+	if (depth == 1)
+		return aux_chess_count_valid_moves(s);
+
+	if (depth > 2)
+		CHECK_FOR_INTERRUPTS();
+
+	aux_chess_formal_move_rewind(s);
+	while (aux_chess_formal_move_next(s))
+		moves[n++] = s->candidate_move;
+
+	for (i = 0; i < n; i++)
+		if (aux_chess_make_legal_move(s, moves[i], &u))
+			{
+				nodes += aux_chess_perft(s, depth - 1);
+				aux_chess_unmake_move(s, &u);
+			}
+
+	return nodes;
+}
+
+/*
+ * The following functions compute the score for a given
+ * game. Positive scores means that the game is in favour of the
+ * player that moves next.
+ * 
+ * "We" and "our" refer to the player that makes the next move, "They"
+ * and "their" refer to the other player.
+ *
+ * The score that we compute is the combination of three subscores:
+ * 
+ * (1) the value of our pieces minus the value of their pieces
+ * 
+ * (2) the number of our available moves minus the number of their
+ *      available moves
+ * 
+ * (3) the number of their pieces that we attack, minus the number of
+ *     our pieces that they attack
+ * 
+ * The number in (3) is computed with multiplicities, e.g. if their
+ * Rook is attacked by both our Queen and our Bishop then it is counts
+ * as two.
+ */
+
+int
+aux_chess_piece_value(char p)
+{
+	switch (p)
+		{
+		case 'p':
+		case 'P':
+			return 1;
+		case 'n':
+		case 'N':
+			return 3;
+		case 'b':
+		case 'B':
+			return 3;
+		case 'r':
+		case 'R':
+			return 5;
+		case 'q':
+		case 'Q':
+			return 9;
+		default:
+			return 0;
+		}
+}
+
+int
+aux_chess_score_available_pieces(chess_game_status *s)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+
+	return s->material[us] - s->material[1 - us];
+}
+
+int
+aux_chess_score_piece_squares(chess_game_status *s)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+
+	return s->psq[us] - s->psq[1 - us];
+}
+
+void
+aux_chess_attack_maps(const chess_game_status *s, chess_attack_maps *m)
+{
+	ChessBitboard occupied = s->occupied[ChessWhite] | s->occupied[ChessBlack];
+	ChessBitboard b, a;
+	int side, t, sq;
+
+	memset(m, 0, sizeof(chess_attack_maps));
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		for (t = ChessPawn; t <= ChessKing; t++)
+			for (b = s->pieces[side][t]; b; b &= b - 1)
+				{
+					sq = ChessFirstSquare(b);
+					switch (t)
+						{
+						case ChessPawn:
+							a = chess_pawn_attacks[side][sq];
+							break;
+						case ChessKnight:
+							a = chess_knight_attacks[sq];
+							break;
+						case ChessBishop:
+							a = ChessBishopAttacks(sq, occupied);
+							break;
+						case ChessRook:
+							a = ChessRookAttacks(sq, occupied);
+							break;
+						case ChessQueen:
+							a = ChessBishopAttacks(sq, occupied) | ChessRookAttacks(sq, occupied);
+							break;
+						default:
+							a = chess_king_attacks[sq];
+							break;
+						}
+					m->attacked[side] |= a;
+					if (t != ChessPawn)
+						m->mobility[side] += ChessPopCount(a & ~s->occupied[side]);
+					for (; a; a &= a - 1)
+						m->count[side][ChessFirstSquare(a)]++;
+				}
+}
+
+/*
+ * The mobility of the side to move minus that of the other side.
+ */
+
+int
+aux_chess_score_mobility(chess_game_status *s, const chess_attack_maps *m)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+
+	return m->mobility[us] - m->mobility[1 - us];
+}
+
+/*
+ * The value of the pieces (other than the King) which are attacked
+ * by more pieces than defend them: theirs minus ours.
+ */
+
+int
+aux_chess_score_attacked_pieces(chess_game_status *s, const chess_attack_maps *m)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int o = 0, side, t, sq;
+	ChessBitboard b;
+
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		for (t = ChessPawn; t < ChessKing; t++)
+			for (b = s->pieces[side][t] & m->attacked[1 - side]; b; b &= b - 1)
+				{
+					sq = ChessFirstSquare(b);
+					if (m->count[1 - side][sq] > m->count[side][sq])
+						o += (side == us) ? -chess_piece_values[t] : chess_piece_values[t];
+				}
+	return o;
+}
+
+/*
+ * The attacks on the squares around their King (and on the King
+ * itself) minus the attacks on the squares around ours.
+ */
+
+int
+aux_chess_score_king_safety(chess_game_status *s, const chess_attack_maps *m)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	int o = 0, side, k;
+	ChessBitboard b;
+
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		{
+			if (s->pieces[side][ChessKing] == 0)
+				continue;
+			k = ChessFirstSquare(s->pieces[side][ChessKing]);
+			for (b = (chess_king_attacks[k] | ChessBit(k)) & m->attacked[1 - side]; b; b &= b - 1)
+				o += (side == us ? -1 : 1) * m->count[1 - side][ChessFirstSquare(b)];
+		}
+	return o;
+}
+
+double
+aux_chess_score(chess_game_status *s)
+{
+	chess_attack_maps m;
+	instr_time start;
+	double score;
+
+	INSTR_TIME_SET_ZERO(start);
+	ChessStatsTimerStart(start);
+	aux_chess_attack_maps(s, &m);
+	score = aux_chess_score_available_pieces(s)
+		+ ChessCoeffScoreMoves * aux_chess_score_mobility(s, &m)
+		+ ChessCoeffScoreAttacked * aux_chess_score_attacked_pieces(s, &m)
+		+ ChessCoeffScoreKingSafety * aux_chess_score_king_safety(s, &m)
+		+ ChessCoeffScorePSQ * aux_chess_score_piece_squares(s)
+		;
+	ChessStatsAdd(ChessStatEvaluations, 1);
+	ChessStatsTimerStop(ChessStatEvalNs, start);
+	return score;
+}
+
+/*
+ * Transposition table lookup: returns true, filling *d, when an entry
+ * for key is found.
+ */
+
+bool
+aux_chess_tt_probe(uint64 key, chess_tt_data *d)
+{
+	chess_tt_entry *e;
+	uint64 score, info;
+	int i;
+
+	if (chess_tt == NULL || chess_tt->n_buckets == 0)
+		return false;
+
+	ChessStatsAdd(ChessStatTTProbes, 1);
+	e = &chess_tt->entries[2 * (key % chess_tt->n_buckets)];
+	for (i = 0; i < 2; i++)
+		{
+			score = pg_atomic_read_u64(&e[i].score);
+			info = pg_atomic_read_u64(&e[i].info);
+			if (ChessTTInfoBound(info) != ChessTTBoundNone &&
+				(pg_atomic_read_u64(&e[i].check) ^ score ^ info) == key)
+				{
+					memcpy(&d->score, &score, sizeof(double));
+					d->depth = ChessTTInfoDepth(info);
+					d->bound = ChessTTInfoBound(info);
+					d->move = ChessTTInfoMove(info);
+					pg_atomic_fetch_add_u64(&chess_tt->hits, 1);
+					ChessStatsAdd(ChessStatTTHits, 1);
+					return true;
+				}
+		}
+	pg_atomic_fetch_add_u64(&chess_tt->misses, 1);
+	return false;
+}
+
+/*
+ * Transposition table store: the first entry of the bucket keeps the
+ * deepest result, the second one the latest.
+ */
+
+void
+aux_chess_tt_store(uint64 key, double score, int depth, int bound, int move)
+{
+	chess_tt_entry *e;
+	uint64 old_info, old_key, new_score, new_info;
+
+	if (chess_tt == NULL || chess_tt->n_buckets == 0)
+		return;
+
+	e = &chess_tt->entries[2 * (key % chess_tt->n_buckets)];
+	old_info = pg_atomic_read_u64(&e[0].info);
+	old_key = pg_atomic_read_u64(&e[0].check) ^ pg_atomic_read_u64(&e[0].score) ^ old_info;
+	if (ChessTTInfoBound(old_info) != ChessTTBoundNone &&
+		old_key != key && depth < ChessTTInfoDepth(old_info))
+		e++;
+
+	old_info = pg_atomic_read_u64(&e->info);
+	old_key = pg_atomic_read_u64(&e->check) ^ pg_atomic_read_u64(&e->score) ^ old_info;
+	if (ChessTTInfoBound(old_info) != ChessTTBoundNone && old_key != key)
+		pg_atomic_fetch_add_u64(&chess_tt->replacements, 1);
+
+	memcpy(&new_score, &score, sizeof(double));
+	new_info = ChessTTInfo(move, Max(Min(depth, 127), -128), bound);
+	pg_atomic_write_u64(&e->score, new_score);
+	pg_atomic_write_u64(&e->info, new_info);
+	pg_atomic_write_u64(&e->check, key ^ new_score ^ new_info);
+	pg_atomic_fetch_add_u64(&chess_tt->stores, 1);
+}
+
+/*
+ * This function returns aux_chess_score(s), looking it up in the
+ * transposition table first.
+ */
+
+double
+aux_chess_cached_score(chess_game_status *s)
+{
+	chess_tt_data d;
+	double score;
+
+	/* beyond the 50-halfmove limit the score changes */
+	if (s->halfmove_counter >= 50)
+		return aux_chess_score(s);
+
+	if (aux_chess_tt_probe(s->hash ^ ChessTTEvalKey, &d))
+		return d.score;
+	score = aux_chess_score(s);
+	aux_chess_tt_store(s->hash ^ ChessTTEvalKey, score, 0, ChessTTBoundExact, ChessVoidMove);
+	return score;
+}
+
+/*
+ * Search. aux_chess_search is a negamax alpha-beta search, extended
+ * at the leaves by a quiescence search on captures and promotions;
+ * aux_chess_best_move deepens it iteratively, until the requested
+ * depth or the time limit. Scores are those of aux_chess_score, from
+ * the point of view of the side to move; being checkmated in n plies
+ * scores -(ChessMateScore - n), and draws score 0.
+ */
+
+#define ChessMaxPly 64
+#define ChessMateScore 10000.0
+#define ChessMateThreshold (ChessMateScore - ChessMaxPly)
+#define ChessInfinity 1e9
+
+/* ordering key of checks: after promotions, before quiet moves */
+#define ChessCheckKey 50
+
+/* the value of the King in a static exchange, so that it captures last */
+#define ChessSEEKingValue 100
+
+/* how often, in nodes, the search checks time and interrupts */
+#define ChessSearchCheckNodes 1024
+
+/* mate scores are stored relative to the node, not to the root */
+#define ChessScoreToTT(v,ply)											\
+	((v) > ChessMateThreshold ? (v) + (ply) : ((v) < -ChessMateThreshold ? (v) - (ply) : (v)))
+#define ChessScoreFromTT(v,ply)											\
+	((v) > ChessMateThreshold ? (v) - (ply) : ((v) < -ChessMateThreshold ? (v) + (ply) : (v)))
+
+/*
+ * Parallel mode. The work is split into items, which are run by the
+ * calling backend and by up to pgchess.max_workers dynamic background
+ * workers, sharing a dynamic shared memory segment. For perft, an item
+ * is a line of one or two moves from the root; for the search, it is
+ * a root move, searched once for each depth. The participants take
+ * the next item of each depth without waiting for the others, and the
+ * root moves are searched against the best score found so far at that
+ * depth; the result is that of the deepest complete depth.
+ */
+
+#define ChessParallelPerft 1
+#define ChessParallelSearch 2
+#define ChessParallelMaxDepth (ChessMaxPly / 2)
+
+/* perft is only worth splitting from this depth on */
+#define ChessParallelMinPerftDepth 3
+
+typedef struct
+{
+	int16 root;					/* index of the root move */
+	int16 n_moves;
+	int16 moves[2];
+	int64 nodes;				/* perft only */
+} chess_parallel_item;
+
+typedef struct
+{
+	int kind;
+	int depth;
+	TimestampTz deadline;
+	TimestampTz next_deadline;
+	TimestampTz hard_deadline;
+	ChessBoard root;
+	int n_items;
+	pg_atomic_uint32 stop;
+	pg_atomic_uint32 attached;	/* participants that started */
+	pg_atomic_uint32 finished;	/* participants that did not fail */
+	pg_atomic_uint32 completed_depth;
+	pg_atomic_uint64 nodes;
+	pg_atomic_uint32 next_item;	/* perft */
+	/* the search, by depth, protected by mutex */
+	slock_t mutex;
+	int next[ChessParallelMaxDepth + 1];
+	int first[ChessParallelMaxDepth + 1];	/* the root move searched first */
+	int done[ChessParallelMaxDepth + 1];
+	int best_root[ChessParallelMaxDepth + 1];
+	double best_score[ChessParallelMaxDepth + 1];
+	int best_pv_n[ChessParallelMaxDepth + 1];	/* 0 until a move is done */
+	int best_pv[ChessParallelMaxDepth + 1][ChessMaxPly];
+	chess_parallel_item items[FLEXIBLE_ARRAY_MEMBER];
+} chess_parallel_shared;
+
+typedef struct
+{
+	chess_game_status *s;
+	chess_parallel_shared *parallel;	/* NULL unless in parallel mode */
+	int64 nodes;
+	/*
+	 * The time limits, 0 for none: deadline stops the search once an
+	 * iteration is complete, next_deadline stops it from starting a
+	 * new one, and hard_deadline stops even the first one.
+	 */
+	TimestampTz deadline;
+	TimestampTz next_deadline;
+	TimestampTz hard_deadline;
+	bool can_stop;				/* false until the first iteration ends */
+	bool stopped;
+	int depth;					/* the deepest iteration completed */
+	int root_move;				/* best move of the previous iteration */
+	double root_score;			/* the score of pv[0], as far as known */
+	int killers[ChessMaxPly][2];
+	uint64 path[ChessMaxPly];	/* hashes of the positions on the line */
+	int pv_n[ChessMaxPly + 1];
+	int pv[ChessMaxPly + 1][ChessMaxPly];
+} chess_search;
+
+bool aux_chess_search_stop(chess_search *);
+double aux_chess_quiesce(chess_search *, double, double, int);
+double aux_chess_search(chess_search *, int, double, double, int);
+int aux_chess_best_move(chess_search *, int, double *, int *);
+void aux_chess_search_deadlines(chess_search *, TimestampTz, int, int);
+dsm_segment *aux_chess_parallel_create(const chess_game_status *, int, int, const chess_search *, int);
+void aux_chess_parallel_participate(chess_parallel_shared *);
+void aux_chess_parallel_execute(dsm_segment *, int);
+int aux_chess_parallel_best_move(chess_search *, int, double *, int *);
+
+/*
+ * This function tells whether move, which must be a formal move of
+ * the side to move, captures something.
+ */
+
+bool
+aux_chess_move_is_capture(const chess_game_status *s, int move)
+{
+	char p = s->b[ChessMoveX1(move)][ChessMoveY1(move)];
+
+	return s->b[ChessMoveX2(move)][ChessMoveY2(move)] != ' '
+		|| ((p == 'P' || p == 'p') && ChessMoveX1(move) != ChessMoveX2(move));
+}
+
+/*
+ * This function returns the static ordering key of a formal move:
+ * captures first, by Most Valuable Victim / Least Valuable Aggressor,
+ * then promotions, then the others.
+ */
+
+int
+aux_chess_move_order_key(const chess_game_status *s, int move)
+{
+	char p1 = s->b[ChessMoveX1(move)][ChessMoveY1(move)];
+	char p2 = s->b[ChessMoveX2(move)][ChessMoveY2(move)];
+	int key = 0;
+
+	if (aux_chess_move_is_capture(s, move))
+		key += 1000 + 10 * (p2 == ' ' ? 1 : aux_chess_piece_value(p2))
+			- (p1 == 'K' || p1 == 'k' ? 10 : aux_chess_piece_value(p1));
+	if ((p1 == 'P' && ChessMoveY2(move) == 7) || (p1 == 'p' && ChessMoveY2(move) == 0))
+		key += ChessMovePPC(move) == 0 ? 900 : 100;
+	return key;
+}
+
+/*
+ * This function returns the static exchange evaluation of move, in
+ * pawns: the material won (or lost, when negative) by the side to
+ * move if both sides go on capturing on the target square, each with
+ * its least valuable piece and each free to stop. The sliders behind
+ * a capturing piece join the exchange when it leaves; pins, checks
+ * and promotions by recapturing pawns are ignored.
+ */
+
+int
+aux_chess_see(const chess_game_status *s, int move)
+{
+	static const int values[6] = { 1, 3, 3, 5, 9, ChessSEEKingValue };
+	int x1 = ChessMoveX1(move), y1 = ChessMoveY1(move);
+	int x2 = ChessMoveX2(move), y2 = ChessMoveY2(move);
+	int sq = ChessSquare(x2, y2);
+	int side = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	char p1 = s->b[x1][y1];
+	char p2 = s->b[x2][y2];
+	const ChessBitboard *theirs;
+	ChessBitboard occupied = s->occupied[ChessWhite] | s->occupied[ChessBlack];
+	ChessBitboard attackers;
+	int gain[32];
+	int d = 0, type, value;
+
+	/* value is the value of the piece standing on the target square */
+	value = (p1 == 'K' || p1 == 'k') ? ChessSEEKingValue : aux_chess_piece_value(p1);
+	gain[0] = aux_chess_piece_value(p2);
+	occupied &= ~ChessBit(ChessSquare(x1, y1));
+	if ((p1 == 'P' || p1 == 'p') && x1 != x2 && p2 == ' ')
+		{
+			/* en passant */
+			gain[0] = 1;
+			occupied &= ~ChessBit(ChessSquare(x2, y1));
+		}
+	if ((p1 == 'P' && y2 == 7) || (p1 == 'p' && y2 == 0))
+		{
+			value = aux_chess_piece_value(ChessMovePPCToChar(ChessMovePPC(move)));
+			gain[0] += value - 1;
+		}
+
+	while (d < lengthof(gain) - 1)
+		{
+			side = 1 - side;
+			theirs = s->pieces[side];
+			attackers = ((chess_pawn_attacks[1 - side][sq] & theirs[ChessPawn])
+						 | (chess_knight_attacks[sq] & theirs[ChessKnight])
+						 | (ChessBishopAttacks(sq, occupied) & (theirs[ChessBishop] | theirs[ChessQueen]))
+						 | (ChessRookAttacks(sq, occupied) & (theirs[ChessRook] | theirs[ChessQueen]))
+						 | (chess_king_attacks[sq] & theirs[ChessKing])) & occupied;
+			if (attackers == 0)
+				break;
+			for (type = ChessPawn; !(attackers & theirs[type]); type++)
+				;
+			d++;
+			gain[d] = value - gain[d - 1];
+			value = values[type];
+			occupied &= ~ChessBit(ChessFirstSquare(attackers & theirs[type]));
+		}
+
+	/* each side captures only when it does not lose by doing so */
+	for (; d > 0; d--)
+		gain[d - 1] = -Max(-gain[d - 1], gain[d]);
+	return gain[0];
+}
+
+/*
+ * This function sorts moves by decreasing ordering key; the TT move,
+ * if any, goes first, and the killers (if any) after the captures.
+ */
+
+void
+aux_chess_order_moves(const chess_game_status *s, int *moves, int n, int tt_move, const int *killers)
+{
+	int keys[ChessMaxFormalMoves];
+	int i;
+
+	for (i = 0; i < n; i++)
+		{
+			if (moves[i] == tt_move)
+				keys[i] = 1000000;
+			else
+				{
+					keys[i] = aux_chess_move_order_key(s, moves[i]);
+					if (keys[i] == 0 && killers != NULL &&
+						(moves[i] == killers[0] || moves[i] == killers[1]))
+						keys[i] = moves[i] == killers[0] ? 2 : 1;
+				}
+		}
+
+	aux_chess_sort_moves(moves, keys, n);
+}
+
+/*
+ * This function sorts moves by decreasing keys; moves with the same
+ * key keep their order.
+ */
+
+void
+aux_chess_sort_moves(int *moves, int *keys, int n)
+{
+	int i, j, k, m;
+
+	/* insertion sort: the lists are short */
+	for (i = 1; i < n; i++)
+		{
+			k = keys[i];
+			m = moves[i];
+			for (j = i; j > 0 && keys[j - 1] < k; j--)
+				{
+					keys[j] = keys[j - 1];
+					moves[j] = moves[j - 1];
+				}
+			keys[j] = k;
+			moves[j] = m;
+		}
+}
+
+/*
+ * This function returns the ordering key of a valid move as returned
+ * by valid_moves(b, ordered): the static key, or ChessCheckKey for the
+ * other moves which give check. Unlike the static key it needs to make
+ * the move, so the search does not use it.
+ */
+
+int
+aux_chess_move_sort_key(chess_game_status *s, int move)
+{
+	int key = aux_chess_move_order_key(s, move);
+	chess_undo u;
+
+	if (key == 0 && aux_chess_make_legal_move(s, move, &u))
+		{
+			if (aux_chess_in_check(s))
+				key = ChessCheckKey;
+			aux_chess_unmake_move(s, &u);
+		}
+	return key;
+}
+
+/*
+ * This function returns true when the search must stop, because the
+ * time is over or, in parallel mode, because the others stopped.
+ */
+
+bool
+aux_chess_search_stop(chess_search *search)
+{
+	if (search->stopped)
+		return true;
+	if (search->nodes % ChessSearchCheckNodes == 0)
+		{
+			CHECK_FOR_INTERRUPTS();
+			if (search->parallel != NULL)
+				{
+					if (pg_atomic_read_u32(&search->parallel->stop) != 0)
+						search->stopped = true;
+					search->can_stop = pg_atomic_read_u32(&search->parallel->completed_depth) > 0;
+				}
+			if ((search->can_stop && search->deadline != 0 &&
+				 GetCurrentTimestamp() >= search->deadline) ||
+				(search->hard_deadline != 0 &&
+				 GetCurrentTimestamp() >= search->hard_deadline))
+				search->stopped = true;
+		}
+	return search->stopped;
+}
+
+/*
+ * This function tells whether the King of the side to move is
+ * attacked.
+ */
+
+bool
+aux_chess_in_check(const chess_game_status *s)
+{
+	int us = (s->previous_moves_n % 2 == 0) ? ChessWhite : ChessBlack;
+	ChessBitboard king = s->pieces[us][ChessKing];
+
+	return king != 0 && aux_chess_square_attacked(s, ChessFirstSquare(king), 1 - us);
+}
+
+double
+aux_chess_quiesce(chess_search *search, double alpha, double beta, int ply)
+{
+	chess_game_status *s = search->s;
+	int moves[ChessMaxFormalMoves];
+	int n = 0, i;
+	double score;
+	chess_undo u;
+
+	search->pv_n[ply] = 0;
+	if (aux_chess_search_stop(search))
+		return 0;
+	search->nodes++;
+
+	/* standing pat: we can assume that some quiet move is as good */
+	score = aux_chess_score(s);
+	if (score >= beta || ply >= ChessMaxPly - 1)
+		return score;
+	if (score > alpha)
+		alpha = score;
+
+	/* the captures and promotions which do not lose material */
+	aux_chess_formal_move_rewind(s);
+	while (aux_chess_formal_move_next(s))
+		if (aux_chess_move_order_key(s, s->candidate_move) > 0 &&
+			aux_chess_see(s, s->candidate_move) >= 0)
+			moves[n++] = s->candidate_move;
+	aux_chess_order_moves(s, moves, n, ChessVoidMove, NULL);
+
+	for (i = 0; i < n; i++)
+		{
+			if (!aux_chess_make_legal_move(s, moves[i], &u))
+				continue;
+			score = -aux_chess_quiesce(search, -beta, -alpha, ply + 1);
+			aux_chess_unmake_move(s, &u);
+			if (search->stopped)
+				return 0;
+			if (score >= beta)
+				return score;
+			if (score > alpha)
+				alpha = score;
+		}
+	return alpha;
+}
+
+double
+aux_chess_search(chess_search *search, int depth, double alpha, double beta, int ply)
+{
+	chess_game_status *s = search->s;
+	int moves[ChessMaxFormalMoves];
+	int n = 0, i, legal = 0;
+	int best_move = ChessVoidMove, tt_move = ChessVoidMove;
+	double alpha0 = alpha, best = -ChessInfinity, score;
+	chess_tt_data d;
+	chess_undo u;
+
+	if (depth <= 0 || ply >= ChessMaxPly - 1)
+		return aux_chess_quiesce(search, alpha, beta, ply);
+
+	search->pv_n[ply] = 0;
+	if (aux_chess_search_stop(search))
+		return 0;
+	search->nodes++;
+
+	/* draws by the 50-halfmove rule, or by repetition on this line */
+	search->path[ply] = s->hash;
+	if (ply > 0)
+		{
+			if (s->halfmove_counter >= 50)
+				return 0;
+			for (i = ply - 2; i >= 0 && i >= ply - s->halfmove_counter; i -= 2)
+				if (search->path[i] == s->hash)
+					return 0;
+		}
+
+	if (aux_chess_tt_probe(s->hash, &d))
+		{
+			tt_move = d.move;
+			if (ply > 0 && d.depth >= depth)
+				{
+					score = ChessScoreFromTT(d.score, ply);
+					if (d.bound == ChessTTBoundExact)
+						return score;
+					if (d.bound == ChessTTBoundLower && score > alpha)
+						alpha = score;
+					if (d.bound == ChessTTBoundUpper && score < beta)
+						beta = score;
+					if (alpha >= beta)
+						return score;
+				}
+		}
+	if (ply == 0 && search->root_move != ChessVoidMove)
+		tt_move = search->root_move;
+
+	aux_chess_formal_move_rewind(s);
+	while (aux_chess_formal_move_next(s))
+		moves[n++] = s->candidate_move;
+	aux_chess_order_moves(s, moves, n, tt_move, search->killers[ply]);
+
+	for (i = 0; i < n; i++)
+		{
+			if (!aux_chess_make_legal_move(s, moves[i], &u))
+				continue;
+			legal++;
+			score = -aux_chess_search(search, depth - 1, -beta, -alpha, ply + 1);
+			aux_chess_unmake_move(s, &u);
+			if (search->stopped)
+				return 0;
+
+			if (score > best)
+				{
+					best = score;
+					best_move = moves[i];
+					if (score > alpha)
+						{
+							alpha = score;
+							if (ply == 0)
+								search->root_score = score;
+							search->pv[ply][0] = moves[i];
+							memcpy(&search->pv[ply][1], search->pv[ply + 1],
+								   sizeof(int) * search->pv_n[ply + 1]);
+							search->pv_n[ply] = 1 + search->pv_n[ply + 1];
+						}
+				}
+			if (alpha >= beta)
+				{
+					if (aux_chess_move_order_key(s, moves[i]) == 0 &&
+						search->killers[ply][0] != moves[i])
+						{
+							search->killers[ply][1] = search->killers[ply][0];
+							search->killers[ply][0] = moves[i];
+						}
+					break;
+				}
+		}
+
+	if (legal == 0)
+		return aux_chess_in_check(s) ? -(ChessMateScore - ply) : 0;
+
+	aux_chess_tt_store(s->hash, ChessScoreToTT(best, ply), depth,
+					   best <= alpha0 ? ChessTTBoundUpper
+					   : (best >= beta ? ChessTTBoundLower : ChessTTBoundExact),
+					   best_move);
+	return best;
+}
+
+/*
+ * This function searches s by iterative deepening, up to max_depth
+ * plies or until the time limits, and fills *score and pv with the
+ * results of the deepest completed iteration. It returns the length
+ * of the principal variation, which is 0 when there are no valid
+ * moves or when the hard limit came before any result.
+ */
+
+int
+aux_chess_best_move(chess_search *search, int max_depth, double *score, int *pv)
+{
+	MemoryContext oldcontext, depth_context;
+	int depth, pv_n = 0;
+	double v;
+
+	/* whatever an iteration allocates is freed before the next one */
+	depth_context = AllocSetContextCreate(CurrentMemoryContext,
+										  "pgchess search",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	*score = 0;
+	for (depth = 1; depth <= max_depth; depth++)
+		{
+			if (depth > 1 && search->next_deadline != 0 &&
+				GetCurrentTimestamp() >= search->next_deadline)
+				break;
+
+			oldcontext = MemoryContextSwitchTo(depth_context);
+			v = aux_chess_search(search, depth, -ChessInfinity, ChessInfinity, 0);
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(depth_context);
+
+			if (search->stopped)
+				{
+					/*
+					 * The best move of the previous iteration is searched
+					 * first; once it is done, the best of the moves done
+					 * is better informed than the previous result.
+					 */
+					if (search->pv_n[0] > 0)
+						{
+							*score = search->root_score;
+							pv_n = search->pv_n[0];
+							memcpy(pv, search->pv[0], sizeof(int) * pv_n);
+						}
+					break;
+				}
+
+			search->depth = depth;
+			*score = v;
+			pv_n = search->pv_n[0];
+			memcpy(pv, search->pv[0], sizeof(int) * pv_n);
+			search->root_move = pv_n > 0 ? pv[0] : ChessVoidMove;
+			search->can_stop = true;
+
+			/* no need to look deeper than a forced mate */
+			if (v > ChessMateThreshold || v < -ChessMateThreshold || pv_n == 0)
+				break;
+		}
+
+	MemoryContextDelete(depth_context);
+	return pv_n;
+}
+
+/*
+ * This function creates the shared memory of a parallel task on s,
+ * with room for n_items items.
+ */
+
+dsm_segment *
+aux_chess_parallel_create(const chess_game_status *s, int kind, int depth,
+						  const chess_search *search, int n_items)
+{
+	dsm_segment *seg;
+	chess_parallel_shared *p;
+	Size size = add_size(offsetof(chess_parallel_shared, items),
+						 mul_size(n_items, sizeof(chess_parallel_item)));
+
+#if PG_VERSION_NUM >= 100000
+	seg = dsm_create(size, 0);
+#else
+	seg = dsm_create(size);
+#endif
+	p = (chess_parallel_shared *) dsm_segment_address(seg);
+	memset(p, 0, size);
+
+	p->kind = kind;
+	p->depth = depth;
+	if (search != NULL)
+		{
+			p->deadline = search->deadline;
+			p->next_deadline = search->next_deadline;
+			p->hard_deadline = search->hard_deadline;
+		}
+	aux_write_chessboard(s, &p->root);
+	p->n_items = n_items;
+	pg_atomic_init_u32(&p->stop, 0);
+	pg_atomic_init_u32(&p->attached, 0);
+	pg_atomic_init_u32(&p->finished, 0);
+	pg_atomic_init_u32(&p->completed_depth, 0);
+	pg_atomic_init_u64(&p->nodes, 0);
+	pg_atomic_init_u32(&p->next_item, 0);
+	SpinLockInit(&p->mutex);
+
+	return seg;
+}
+
+/*
+ * This function runs items of p until there are none left; it is run
+ * by each participant, that is, by the calling backend and by each
+ * background worker.
+ */
+
+void
+aux_chess_parallel_participate(chess_parallel_shared *p)
+{
+	chess_game_status *s;
+	chess_search *search;
+	chess_parallel_item *item;
+	chess_undo u[2];
+	MemoryContext oldcontext, depth_context;
+	uint32 i;
+	int depth, j, first;
+	double alpha, score;
+	bool done;
+
+	pg_atomic_fetch_add_u32(&p->attached, 1);
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	aux_init_chess_game_status(s);
+	aux_read_chessboard(s, &p->root);
+
+	if (p->kind == ChessParallelPerft)
+		{
+			while (pg_atomic_read_u32(&p->stop) == 0 &&
+				   (i = pg_atomic_fetch_add_u32(&p->next_item, 1)) < p->n_items)
+				{
+					item = &p->items[i];
+					for (j = 0; j < item->n_moves; j++)
+						aux_chess_make_legal_move(s, item->moves[j], &u[j]);
+					item->nodes = aux_chess_perft(s, p->depth - item->n_moves);
+					for (j = item->n_moves - 1; j >= 0; j--)
+						aux_chess_unmake_move(s, &u[j]);
+				}
+			pfree(s);
+			pg_atomic_fetch_add_u32(&p->finished, 1);
+			return;
+		}
+
+	search = (chess_search *) palloc0(sizeof(chess_search));
+	search->s = s;
+	search->parallel = p;
+	search->deadline = p->deadline;
+	search->next_deadline = p->next_deadline;
+	search->hard_deadline = p->hard_deadline;
+	depth_context = AllocSetContextCreate(CurrentMemoryContext,
+										  "pgchess search",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * As in aux_chess_best_move, each depth starts from the best move
+	 * of the previous one, as far as it is known, and its allocations
+	 * are freed after each root move.
+	 */
+	for (depth = 1; depth <= p->depth && !search->stopped &&
+			 (depth == 1 || search->next_deadline == 0 ||
+			  GetCurrentTimestamp() < search->next_deadline); depth++)
+		while (pg_atomic_read_u32(&p->stop) == 0)
+			{
+				SpinLockAcquire(&p->mutex);
+				i = p->next[depth]++;
+				if (i == 0)
+					p->first[depth] = p->best_pv_n[depth - 1] > 0 ? p->best_root[depth - 1] : 0;
+				first = p->first[depth];
+				alpha = p->best_pv_n[depth] > 0 ? p->best_score[depth] : -ChessInfinity;
+				SpinLockRelease(&p->mutex);
+
+				if (i >= p->n_items)
+					break;
+				item = &p->items[i == 0 ? first : (i <= first ? i - 1 : i)];
+
+				search->path[0] = s->hash;
+				aux_chess_make_legal_move(s, item->moves[0], &u[0]);
+				oldcontext = MemoryContextSwitchTo(depth_context);
+				score = -aux_chess_search(search, depth - 1, -ChessInfinity, -alpha, 1);
+				MemoryContextSwitchTo(oldcontext);
+				MemoryContextReset(depth_context);
+				aux_chess_unmake_move(s, &u[0]);
+				if (search->stopped)
+					break;
+
+				/*
+				 * A score not better than alpha is only an upper bound,
+				 * but then it is not the best one.
+				 */
+				SpinLockAcquire(&p->mutex);
+				if (p->best_pv_n[depth] == 0 || score > p->best_score[depth])
+					{
+						p->best_root[depth] = item->root;
+						p->best_score[depth] = score;
+						p->best_pv[depth][0] = item->moves[0];
+						memcpy(&p->best_pv[depth][1], search->pv[1], sizeof(int) * search->pv_n[1]);
+						p->best_pv_n[depth] = 1 + search->pv_n[1];
+					}
+				done = (++p->done[depth] == p->n_items);
+				if (done && depth > (int) pg_atomic_read_u32(&p->completed_depth))
+					pg_atomic_write_u32(&p->completed_depth, depth);
+				score = p->best_score[depth];
+				SpinLockRelease(&p->mutex);
+
+				/* no need to look deeper than a forced mate */
+				if (done && (score > ChessMateThreshold || score < -ChessMateThreshold))
+					pg_atomic_write_u32(&p->stop, 1);
+			}
+
+	pg_atomic_fetch_add_u64(&p->nodes, search->nodes);
+	MemoryContextDelete(depth_context);
+	pfree(search);
+	pfree(s);
+	pg_atomic_fetch_add_u32(&p->finished, 1);
+}
+
+/*
+ * This function runs the items of the task in seg on the calling
+ * backend and on up to n_workers background workers, and waits for
+ * all of them. Fewer workers are used when max_worker_processes has
+ * no room for them.
+ */
+
+void
+aux_chess_parallel_execute(dsm_segment *seg, int n_workers)
+{
+	chess_parallel_shared *p = (chess_parallel_shared *) dsm_segment_address(seg);
+	BackgroundWorker worker;
+	BackgroundWorkerHandle **handles;
+	int n = 0, i;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name), "chess");
+	snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+			 "chess_parallel_worker_main");
+	snprintf(worker.bgw_name, sizeof(worker.bgw_name),
+			 "pgchess worker for PID %d", MyProcPid);
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, sizeof(worker.bgw_type), "pgchess worker");
+#endif
+	worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+	worker.bgw_notify_pid = MyProcPid;
+
+	handles = (BackgroundWorkerHandle **) palloc(sizeof(BackgroundWorkerHandle *) * Max(n_workers, 1));
+	while (n < n_workers && RegisterDynamicBackgroundWorker(&worker, &handles[n]))
+		n++;
+
+	PG_TRY();
+	{
+		aux_chess_parallel_participate(p);
+		for (i = 0; i < n; i++)
+			WaitForBackgroundWorkerShutdown(handles[i]);
+	}
+	PG_CATCH();
+	{
+		pg_atomic_write_u32(&p->stop, 1);
+		for (i = 0; i < n; i++)
+			TerminateBackgroundWorker(handles[i]);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (pg_atomic_read_u32(&p->finished) != pg_atomic_read_u32(&p->attached))
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("a pgchess worker exited before finishing its work")));
+	pfree(handles);
+}
+
+/*
+ * Entry point of the background workers.
+ */
+
+void
+chess_parallel_worker_main(Datum main_arg)
+{
+	dsm_segment *seg;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pgchess worker");
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	aux_chess_parallel_participate((chess_parallel_shared *) dsm_segment_address(seg));
+	aux_chess_stats_flush();
+	dsm_detach(seg);
+}
+
+/*
+ * This function is aux_chess_best_move, with the root moves split
+ * across background workers; it is used when pgchess.max_workers is
+ * not 0. Unlike aux_chess_best_move, when two moves have the same
+ * score the first one to be searched is taken.
+ */
+
+int
+aux_chess_parallel_best_move(chess_search *search, int max_depth, double *score, int *pv)
+{
+	chess_game_status *s = search->s;
+	chess_parallel_shared *p;
+	dsm_segment *seg;
+	chess_tt_data d;
+	int moves[ChessMaxFormalMoves];
+	int n, i, depth, pv_n;
+
+	n = aux_chess_valid_moves(s, moves);
+	if (chess_max_workers == 0 || n < 2)
+		return aux_chess_best_move(search, max_depth, score, pv);
+
+	aux_chess_order_moves(s, moves, n,
+						  aux_chess_tt_probe(s->hash, &d) ? d.move : ChessVoidMove, NULL);
+
+	seg = aux_chess_parallel_create(s, ChessParallelSearch, max_depth, search, n);
+	p = (chess_parallel_shared *) dsm_segment_address(seg);
+	for (i = 0; i < n; i++)
+		{
+			p->items[i].root = i;
+			p->items[i].n_moves = 1;
+			p->items[i].moves[0] = moves[i];
+		}
+
+	aux_chess_parallel_execute(seg, Min(chess_max_workers, n - 1));
+
+	depth = pg_atomic_read_u32(&p->completed_depth);
+	*score = p->best_score[depth];
+	pv_n = p->best_pv_n[depth];
+	memcpy(pv, p->best_pv[depth], sizeof(int) * pv_n);
+	search->nodes = pg_atomic_read_u64(&p->nodes);
+	search->depth = depth;
+
+	dsm_detach(seg);
+	return pv_n;
+}
+
+/*
+ * This function stores the valid moves of s into moves and their
+ * perft counts, at depth - 1 plies, into nodes; it returns how many
+ * they are. The work is split across background workers when
+ * pgchess.max_workers is not 0: each item is a move and a reply.
+ */
+
+int
+aux_chess_perft_divide(chess_game_status *s, int depth, int *moves, int64 *nodes)
+{
+	chess_parallel_shared *p;
+	dsm_segment *seg;
+	chess_undo u;
+	int replies[ChessMaxFormalMoves];
+	int n, n_items = 0, k, i, j;
+
+	n = aux_chess_valid_moves(s, moves);
+	if (chess_max_workers == 0 || depth < ChessParallelMinPerftDepth)
+		{
+			for (i = 0; i < n; i++)
+				{
+					aux_chess_make_legal_move(s, moves[i], &u);
+					nodes[i] = aux_chess_perft(s, depth - 1);
+					aux_chess_unmake_move(s, &u);
+				}
+			return n;
+		}
+
+	/* a move without replies is an item by itself */
+	for (i = 0; i < n; i++)
+		{
+			aux_chess_make_legal_move(s, moves[i], &u);
+			n_items += Max(aux_chess_count_valid_moves(s), 1);
+			aux_chess_unmake_move(s, &u);
+		}
+
+	seg = aux_chess_parallel_create(s, ChessParallelPerft, depth, NULL, n_items);
+	p = (chess_parallel_shared *) dsm_segment_address(seg);
+	n_items = 0;
+	for (i = 0; i < n; i++)
+		{
+			aux_chess_make_legal_move(s, moves[i], &u);
+			k = aux_chess_valid_moves(s, replies);
+			for (j = 0; j < Max(k, 1); j++)
+				{
+					p->items[n_items].root = i;
+					p->items[n_items].n_moves = (k > 0) ? 2 : 1;
+					p->items[n_items].moves[0] = moves[i];
+					p->items[n_items].moves[1] = (k > 0) ? replies[j] : ChessVoidMove;
+					n_items++;
+				}
+			aux_chess_unmake_move(s, &u);
+		}
+
+	aux_chess_parallel_execute(seg, Min(chess_max_workers, n_items - 1));
+
+	memset(nodes, 0, sizeof(int64) * n);
+	for (i = 0; i < n_items; i++)
+		nodes[p->items[i].root] += p->items[i].nodes;
+
+	dsm_detach(seg);
+	return n;
+}
+
+/*
+ * This function is aux_chess_perft, split across background workers
+ * when pgchess.max_workers is not 0.
+ */
+
+int64
+aux_chess_parallel_perft(chess_game_status *s, int depth)
+{
+	int moves[ChessMaxFormalMoves];
+	int64 nodes[ChessMaxFormalMoves];
+	int64 total = 0;
+	int n, i;
+
+	if (chess_max_workers == 0 || depth < ChessParallelMinPerftDepth)
+		return aux_chess_perft(s, depth);
+
+	n = aux_chess_perft_divide(s, depth, moves, nodes);
+	for (i = 0; i < n; i++)
+		total += nodes[i];
+	return total;
+}
+
+/*
+ * This function writes the position in Forsyth-Edwards Notation into
+ * s->fen, returning its length.
+ */
+
+#define aux_chess_put_int(p,n)								\
+	do {													\
+		char digits[12];									\
+		int i_ = 0, n_ = (n);								\
+		do { digits[i_++] = '0' + n_ % 10; n_ /= 10; }		\
+		while (n_ > 0 && i_ < 5);							\
+		while (i_ > 0) *(p)++ = digits[--i_];				\
+	} while (0)
+
+int
+aux_chess_update_fen(chess_game_status *s)
+{
+	char *p = s->fen;
+	int x, y;
+	int c;
+
+	/* (1) piece placement */
+	for (y = 7; y >= 0; y--)
+		{
+			c = 0;
+			for (x = 0; x < 8; x++)
+				{
+					if (s->b[x][y] == ' ')
+						c++;
+					else
+						{
+							if (c > 0)
+								*p++ = '0' + c;
+							c = 0;
+							*p++ = s->b[x][y];
+						}
+				}
+			if (c > 0)
+				*p++ = '0' + c;
+			if (y > 0)
+				*p++ = '/';
+		}
+
+	/* (2) active colour */
+	*p++ = ' ';
+	*p++ = s->previous_moves_n % 2 ? 'b' : 'w';
+
+	/* (3) castling availability */
+	*p++ = ' ';
+	if (s->c[0] == 'y') *p++ = 'K';
+	if (s->c[1] == 'y') *p++ = 'Q';
+	if (s->c[2] == 'y') *p++ = 'k';
+	if (s->c[3] == 'y') *p++ = 'q';
+	if (p[-1] == ' ')
+		*p++ = '-';
+
+	/* (4) en passant target square */
+	*p++ = ' ';
+	if (s->ep_square >= 0)
+		{
+			*p++ = 'a' + ChessSquareX(s->ep_square);
+			*p++ = '1' + ChessSquareY(s->ep_square);
+		}
+	else
+		*p++ = '-';
+
+	/* (5) halfmove clock and (6) fullmove number */
+	*p++ = ' ';
+	aux_chess_put_int(p, Max(s->halfmove_counter, 0));
+	*p++ = ' ';
+	aux_chess_put_int(p, 1 + s->previous_moves_n / 2);
+
+	*p = '\0';
+	return p - s->fen;
+}
+
+/*
+ * This function checks whether the king of the moving side is safe.
+ */
+
+PG_FUNCTION_INFO_V1(chess_is_king_safe);
+
+Datum
+chess_is_king_safe(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	s = aux_fn_chess_game_status(fcinfo);
+	if(aux_read_game_arg(s, fcinfo, 0))
+		{
+			ereport(ERROR, (errmsg("chess_is_king_safe: null input not allowed")));
+		}
+	s->candidate_move = ChessVoidMove;
+	PG_RETURN_BOOL(aux_chess_is_king_safe(s) ? true : false);
+}
+
+/*
+ * This function checks whether the game is ended.
+ */
+
+PG_FUNCTION_INFO_V1(chess_is_game_ended);
+
+Datum
+chess_is_game_ended(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_is_game_ended: null input not allowed")));
+
+	aux_chess_formal_move_rewind(s);
+	while (aux_chess_formal_move_next(s))
+		if (aux_chess_is_king_safe(s))
+			PG_RETURN_BOOL(false);
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * This function generates the list of valid moves.
+ *
+ * (freely inspired by the normal_rand function in the tablefunc
+ * extension)
+ */
+
+PG_FUNCTION_INFO_V1(chess_valid_moves);
+
+Datum
+chess_valid_moves(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	*cctx;
+	MemoryContext	oldcontext;
+    TupleDesc		tuple_desc;
+
+	chess_game_status *s;
+	int i;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+
+	/*
+	 * When the caller accepts it, generate all the moves in one pass
+	 * into a tuplestore.
+	 */
+	if (rsinfo != NULL && IsA(rsinfo, ReturnSetInfo) &&
+		(rsinfo->allowedModes & SFRM_Materialize))
+		{
+			Tuplestorestate *tupstore;
+			Datum values[5];
+			bool isnull[5] = { false, false, false, false, false };
+			int moves[ChessMaxFormalMoves];
+			int n;
+
+			s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+			aux_init_chess_game_status(s);
+			if(aux_read_game_arg(s, fcinfo, 0))
+				{
+					ereport(ERROR, (errmsg("chess_valid_moves: null input not allowed")));
+				}
+
+			if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("function returning record called in context "
+								"that cannot accept type record")));
+
+			oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+			tuple_desc = CreateTupleDescCopy(tuple_desc);
+			tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+											 false, work_mem);
+			rsinfo->returnMode = SFRM_Materialize;
+			rsinfo->setResult = tupstore;
+			rsinfo->setDesc = tuple_desc;
+			MemoryContextSwitchTo(oldcontext);
+
+			n = aux_chess_valid_moves(s, moves);
+			for (i = 0; i < n; i++)
+				{
+					values[0] = Int16GetDatum(1 + ChessMoveX1(moves[i]));
+					values[1] = Int16GetDatum(1 + ChessMoveY1(moves[i]));
+					values[2] = Int16GetDatum(1 + ChessMoveX2(moves[i]));
+					values[3] = Int16GetDatum(1 + ChessMoveY2(moves[i]));
+					values[4] = Int16GetDatum(ChessMovePPC(moves[i]));
+					tuplestore_putvalues(tupstore, tuple_desc, values, isnull);
+				}
+
+			aux_destroy_chess_game_status(s);
+			return (Datum) 0;
+		}
+
+	/* stuff done only on the first call of the function */
+	if (SRF_IS_FIRSTCALL())
+	{
+
+		/* create a function context for cross-call persistence */
+		cctx = SRF_FIRSTCALL_INIT();
+
+		/*
+		 * switch to memory context appropriate for multiple function calls
+		 */
+		oldcontext = MemoryContextSwitchTo(cctx->multi_call_memory_ctx);
+
+		/* allocate memory for user context */
+		s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+
+		aux_init_chess_game_status(s);
+
+        /* Build a tuple descriptor for our result type */
+        if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context "
+                            "that cannot accept type record")));
+
+        /*
+         * generate attribute metadata needed later to produce tuples
+         * from Datum objects
+         */
+		cctx->tuple_desc = BlessTupleDesc(tuple_desc);
+
+		/*
+		 * read the input data into s
+		 */
+		if(aux_read_game_arg(s, fcinfo, 0))
+			{
+				ereport(ERROR, (errmsg("chess_valid_moves: null input not allowed")));
+			}
+		aux_chess_formal_move_rewind(s);
+
+		/* save s into cctx and switch back to the old context */
+		cctx->user_fctx = s;
+		MemoryContextSwitchTo(oldcontext);
+
+	}
+
+	/* stuff done on every call of the function */
+	cctx = SRF_PERCALL_SETUP();
+	s = cctx->user_fctx;
+
+	/* browse candidate moves */
+	while (aux_chess_formal_move_next(s) &&
+		   (! aux_chess_is_king_safe(s)));
+
+	if (s->candidate_move >= ChessEndOfMoves) /* no more candidates */
+		{
+			SRF_RETURN_DONE(cctx);
+		}
+	else /* found a valid move */
+		{
+			Datum values[5];
+			HeapTuple tuple;
+			bool isnull[5] = { false, false, false, false, false };
+			int move = s->candidate_move;
+			s->candidate_move ++;
+			s->found_moves ++;
+
+			tuple_desc = cctx->tuple_desc;
+
+			values[0] = Int16GetDatum(1 + ChessMoveX1(move));
+			values[1] = Int16GetDatum(1 + ChessMoveY1(move));
+			values[2] = Int16GetDatum(1 + ChessMoveX2(move));
+			values[3] = Int16GetDatum(1 + ChessMoveY2(move));
+			values[4] = Int16GetDatum(ChessMovePPC(move));
+
+			tuple = heap_form_tuple(tuple_desc,values,isnull);
+			
+			SRF_RETURN_NEXT(cctx, HeapTupleGetDatum(tuple));
+		}			
+}
+
+/*
+ * This function generates the valid moves with their ordering key:
+ * captures by Most Valuable Victim / Least Valuable Aggressor, then
+ * promotions, then checks, then the quiet moves. When ordered is
+ * true the moves are sorted by decreasing key, so that a searcher
+ * can try the best candidates first.
+ */
+
+PG_FUNCTION_INFO_V1(chess_valid_moves_ordered);
+
+Datum
+chess_valid_moves_ordered(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	TupleDesc tuple_desc;
+	Tuplestorestate *tupstore;
+	chess_game_status *s;
+	bool ordered = PG_GETARG_BOOL(1);
+	int moves[ChessMaxFormalMoves];
+	int keys[ChessMaxFormalMoves];
+	Datum values[6];
+	bool isnull[6] = { false, false, false, false, false, false };
+	int n, i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_valid_moves_ordered: null input not allowed")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tuple_desc = CreateTupleDescCopy(tuple_desc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tuple_desc;
+	MemoryContextSwitchTo(oldcontext);
+
+	n = aux_chess_valid_moves(s, moves);
+	for (i = 0; i < n; i++)
+		keys[i] = aux_chess_move_sort_key(s, moves[i]);
+	if (ordered)
+		aux_chess_sort_moves(moves, keys, n);
+
+	for (i = 0; i < n; i++)
+		{
+			values[0] = Int16GetDatum(1 + ChessMoveX1(moves[i]));
+			values[1] = Int16GetDatum(1 + ChessMoveY1(moves[i]));
+			values[2] = Int16GetDatum(1 + ChessMoveX2(moves[i]));
+			values[3] = Int16GetDatum(1 + ChessMoveY2(moves[i]));
+			values[4] = Int16GetDatum(ChessMovePPC(moves[i]));
+			values[5] = Int32GetDatum(keys[i]);
+			tuplestore_putvalues(tupstore, tuple_desc, values, isnull);
+		}
+
+	return (Datum) 0;
+}
+
+/*
+ * This function returns the static exchange evaluation of a valid
+ * move, as computed by aux_chess_see.
+ */
+
+PG_FUNCTION_INFO_V1(chess_see);
+
+Datum
+chess_see(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	int moves[ChessMaxFormalMoves];
+	int move, n, i;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+	move = aux_read_move(PG_GETARG_DATUM(1));
+
+	n = aux_chess_legal_moves(s, moves);
+	for (i = 0; i < n && moves[i] != move; i++)
+		;
+	if (i == n)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("move %c%d%c%d is not valid in this position",
+						'a' + ChessMoveX1(move), 1 + ChessMoveY1(move),
+						'a' + ChessMoveX2(move), 1 + ChessMoveY2(move))));
+
+	PG_RETURN_INT32(aux_chess_see(s, move));
+}
+
+/*
+ * These functions return the valid moves as an array of int2, with
+ * the same encoding as the %% operator, and the number of valid
+ * moves; they do not build any tuple.
+ */
+
+PG_FUNCTION_INFO_V1(chess_valid_moves_array);
+
+Datum
+chess_valid_moves_array(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	int moves[ChessMaxFormalMoves];
+	Datum values[ChessMaxFormalMoves];
+	int i, n;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_valid_moves_array: null input not allowed")));
+
+	n = aux_chess_valid_moves(s, moves);
+
+	if (n == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT2OID));
+	for (i = 0; i < n; i++)
+		values[i] = Int16GetDatum(moves[i]);
+	PG_RETURN_ARRAYTYPE_P(construct_array(values, n, INT2OID, sizeof(int16), true, 's'));
+}
+
+PG_FUNCTION_INFO_V1(chess_count_valid_moves);
+
+Datum
+chess_count_valid_moves(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	int n = 0;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_count_valid_moves: null input not allowed")));
+
+	n = aux_chess_count_valid_moves(s);
+
+	PG_RETURN_INT32(n);
+}
+
+PG_FUNCTION_INFO_V1(chess_game_to_fen);
+
+Datum
+chess_game_to_fen(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if(aux_read_game_arg(s, fcinfo, 0))
+		{
+			PG_RETURN_NULL();
+		}
+	else
+		{
+			PG_RETURN_TEXT_P(cstring_to_text_with_len(s->fen, aux_chess_update_fen(s)));
+		}
+}
+
+/*
+ * This function converts a FEN into a game. The game type has no room
+ * for the side to move, for the fullmove number and for the en passant
+ * target square, which are implied by "moves": hence we fill it with
+ * void moves, except that the last one is the double pawn push which
+ * made en passant possible, if any.
+ */
+
+Datum
+aux_chess_fen_to_game(TupleDesc tuple_desc, chess_game_status *s, const char *fen)
+{
+	aux_init_chess_game_status(s);
+	aux_chess_read_fen(s, fen);
+
+	return aux_write_game(tuple_desc, s, aux_chess_fen_moves(s), s->previous_moves_n, NULL, 0);
+}
+
+/*
+ * This function returns the moves of a game read from a FEN, as
+ * described above.
+ */
+
+int16 *
+aux_chess_fen_moves(const chess_game_status *s)
+{
+	int16 *moves;
+	int i, sq;
+
+	moves = (int16 *) palloc0(sizeof(int16) * Max(s->previous_moves_n, 1));
+	if (s->ep_square >= 0 && s->previous_moves_n > 0)
+		{
+			/* the ep square lies between the source and the target */
+			sq = s->ep_square;
+			i = ChessSquareY(sq) == 2 ? 8 : -8;
+			moves[s->previous_moves_n - 1] = ChessMoveFromSquares(sq - i, sq + i, 0);
+		}
+
+	return moves;
+}
+
+PG_FUNCTION_INFO_V1(chess_fen_to_game);
+
+Datum
+chess_fen_to_game(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	PG_RETURN_DATUM(aux_chess_fen_to_game(aux_game_tuple_desc(fcinfo), s,
+										  text_to_cstring(PG_GETARG_TEXT_PP(0))));
+}
+
+/*
+ * Array variants, for bulk conversions: the work per element is the
+ * same as above, but the function call overhead is paid only once.
+ * The dimensions of the input array are preserved, as are its nulls.
+ */
+
+PG_FUNCTION_INFO_V1(chess_fen_to_game_array);
+
+Datum
+chess_fen_to_game_array(PG_FUNCTION_ARGS)
+{
+	ArrayType *a = PG_GETARG_ARRAYTYPE_P(0);
+	chess_game_status *s;
+	TupleDesc tuple_desc;
+	Oid game_type;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elems;
+	bool *nulls;
+	int n, i;
+
+	game_type = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+	if (!OidIsValid(game_type))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("could not determine the element type of the result")));
+	tuple_desc = BlessTupleDesc(lookup_rowtype_tupdesc_copy(game_type, -1));
+
+	deconstruct_array(a, TEXTOID, -1, false, 'i', &elems, &nulls, &n);
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	for (i = 0; i < n; i++)
+		if (!nulls[i])
+			elems[i] = aux_chess_fen_to_game(tuple_desc, s, TextDatumGetCString(elems[i]));
+
+	get_typlenbyvalalign(game_type, &typlen, &typbyval, &typalign);
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, nulls, ARR_NDIM(a), ARR_DIMS(a),
+											 ARR_LBOUND(a), game_type,
+											 typlen, typbyval, typalign));
+}
+
+PG_FUNCTION_INFO_V1(chess_game_to_fen_array);
+
+Datum
+chess_game_to_fen_array(PG_FUNCTION_ARGS)
+{
+	ArrayType *a = PG_GETARG_ARRAYTYPE_P(0);
+	chess_game_status *s;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elems;
+	bool *nulls;
+	int n, i;
+
+	get_typlenbyvalalign(ARR_ELEMTYPE(a), &typlen, &typbyval, &typalign);
+	deconstruct_array(a, ARR_ELEMTYPE(a), typlen, typbyval, typalign, &elems, &nulls, &n);
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	for (i = 0; i < n; i++)
+		{
+			if (nulls[i])
+				continue;
+			aux_init_chess_game_status(s);
+			if (aux_read_game(s, elems[i]))
+				nulls[i] = true;
+			else
+				elems[i] = PointerGetDatum(cstring_to_text_with_len(s->fen, aux_chess_update_fen(s)));
+		}
+
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, nulls, ARR_NDIM(a), ARR_DIMS(a),
+											 ARR_LBOUND(a), TEXTOID, -1, false, 'i'));
+}
+
+PG_FUNCTION_INFO_V1(chess_game_score);
+
+Datum
+chess_game_score(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if(aux_read_game_arg(s, fcinfo, 0))
+		{
+			PG_RETURN_NULL();
+		}
+	else
+		PG_RETURN_FLOAT8(aux_chess_cached_score(s));
+}
+
+/*
+ * This function returns the terms of the score of a game, from the
+ * point of view of the side to move: material, piece placement in
+ * centipawns, mobility (ours minus theirs), attacked pieces
+ * and King safety, together with the resulting score.
+ */
+
+PG_FUNCTION_INFO_V1(chess_score_breakdown);
+
+Datum
+chess_score_breakdown(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	TupleDesc tuple_desc;
+	chess_attack_maps m;
+	Datum values[6];
+	bool isnull[6] = { false, false, false, false, false, false };
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tuple_desc = BlessTupleDesc(tuple_desc);
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+
+	aux_chess_attack_maps(s, &m);
+	values[0] = Int32GetDatum(aux_chess_score_available_pieces(s));
+	values[1] = Int32GetDatum(aux_chess_score_piece_squares(s));
+	values[2] = Int32GetDatum(aux_chess_score_mobility(s, &m));
+	values[3] = Int32GetDatum(aux_chess_score_attacked_pieces(s, &m));
+	values[4] = Int32GetDatum(aux_chess_score_king_safety(s, &m));
+	values[5] = Float8GetDatum(aux_chess_score(s));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+/*
+ * This function returns the attack maps of a game as a 2 x 64 array:
+ * the number of White, then Black, pieces attacking each square, in
+ * the order of the board (a1, b1, ..., h8).
+ */
+
+PG_FUNCTION_INFO_V1(chess_attack_map);
+
+Datum
+chess_attack_map(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	chess_attack_maps m;
+	Datum elems[128];
+	int dims[2] = { 2, 64 };
+	int lbs[2] = { 1, 1 };
+	int side, sq;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+
+	aux_chess_attack_maps(s, &m);
+	for (side = ChessWhite; side <= ChessBlack; side++)
+		for (sq = 0; sq < 64; sq++)
+			elems[64 * side + sq] = Int16GetDatum(m.count[side][sq]);
+
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(elems, NULL, 2, dims, lbs,
+											 INT2OID, sizeof(int16), true, 's'));
+}
+
+/*
+ * Input/output functions of the chessboard type; the text
+ * representation is FEN.
+ */
+
+PG_FUNCTION_INFO_V1(chess_chessboard_in);
+
+Datum
+chess_chessboard_in(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	ChessBoard *cb;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_chess_read_fen(s, PG_GETARG_CSTRING(0));
+
+	cb = (ChessBoard *) palloc(sizeof(ChessBoard));
+	aux_write_chessboard(s, cb);
+	PG_RETURN_CHESSBOARD_P(cb);
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_out);
+
+Datum
+chess_chessboard_out(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+	aux_chess_update_fen(s);
+	PG_RETURN_CSTRING(pstrdup(s->fen));
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_recv);
+
+Datum
+chess_chessboard_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	chess_game_status *s;
+	ChessBoard *cb;
+	int sq;
+
+	cb = (ChessBoard *) palloc(sizeof(ChessBoard));
+	memcpy(cb->squares, pq_getmsgbytes(buf, sizeof(cb->squares)), sizeof(cb->squares));
+	cb->side = pq_getmsgbyte(buf);
+	cb->castling = pq_getmsgbyte(buf);
+	cb->ep_square = (int8) pq_getmsgbyte(buf);
+	cb->last_piece_captured = pq_getmsgbyte(buf);
+	cb->halfmove_counter = (int16) pq_getmsgint(buf, 2);
+	cb->fullmove_number = (int16) pq_getmsgint(buf, 2);
+
+	for (sq = 0; sq < 64; sq++)
+		if (ChessBoardGetCode(cb, sq) >= strlen(ChessBoardCodes))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid piece code in external \"chessboard\" value")));
+	if (cb->side > 1 || cb->castling > 15 || cb->ep_square < -1 || cb->ep_square > 63 ||
+		cb->halfmove_counter < 0 || cb->fullmove_number < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid external \"chessboard\" value")));
+
+	/* normalize the en passant target square */
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, cb);
+	if (ChessPopCount(s->pieces[ChessWhite][ChessKing]) != 1 ||
+		ChessPopCount(s->pieces[ChessBlack][ChessKing]) != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid external \"chessboard\" value")));
+	cb->ep_square = s->ep_square;
+
+	PG_RETURN_CHESSBOARD_P(cb);
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_send);
+
+Datum
+chess_chessboard_send(PG_FUNCTION_ARGS)
+{
+	ChessBoard *cb = PG_GETARG_CHESSBOARD_P(0);
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	pq_sendbytes(&buf, (char *) cb->squares, sizeof(cb->squares));
+	pq_sendbyte(&buf, cb->side);
+	pq_sendbyte(&buf, cb->castling);
+	pq_sendbyte(&buf, (uint8) cb->ep_square);
+	pq_sendbyte(&buf, cb->last_piece_captured);
+	pq_sendint16(&buf, cb->halfmove_counter);
+	pq_sendint16(&buf, cb->fullmove_number);
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Casts between game and chessboard
+ */
+
+PG_FUNCTION_INFO_V1(chess_game_to_chessboard);
+
+Datum
+chess_game_to_chessboard(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	ChessBoard *cb;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game(s, PG_GETARG_DATUM(0)))
+		PG_RETURN_NULL();
+
+	cb = (ChessBoard *) palloc(sizeof(ChessBoard));
+	aux_write_chessboard(s, cb);
+	PG_RETURN_CHESSBOARD_P(cb);
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_to_game);
+
+Datum
+chess_chessboard_to_game(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+
+	/*
+	 * The game type has no room for the side to move and for the
+	 * fullmove number, which are implied by the length of "moves":
+	 * hence we fill it with void moves.
+	 */
+	PG_RETURN_DATUM(aux_write_game(aux_game_tuple_desc(fcinfo), s, NULL, s->previous_moves_n, NULL, 0));
+}
+
+/*
+ * These functions apply moves to a game, or to a chessboard. As in
+ * the rest of the engine, they do NOT check whether the moves are
+ * admissible; castling is detected by the movement of the King.
+ */
+
+PG_FUNCTION_INFO_V1(chess_apply_move);
+
+Datum
+chess_apply_move(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	Datum d;
+	bool isnull;
+	int16 *moves;
+	int n, move;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game(s, PG_GETARG_DATUM(0)))
+		ereport(ERROR, (errmsg("chess_apply_move: null input not allowed")));
+	/* a NULL history is read as an empty one, as in aux_read_game */
+	d = GetAttributeByName(PG_GETARG_HEAPTUPLEHEADER(0), "moves", &isnull);
+	moves = NULL;
+	n = isnull ? 0 : aux_read_moves_array(DatumGetArrayTypeP(d), &moves);
+
+	move = aux_read_move(PG_GETARG_DATUM(1));
+	s->candidate_move = move;
+	aux_chess_apply_candidate_move(s);
+
+	PG_RETURN_DATUM(aux_write_game(aux_game_tuple_desc(fcinfo), s, moves, n, &move, 1));
+}
+
+PG_FUNCTION_INFO_V1(chess_apply_moves);
+
+Datum
+chess_apply_moves(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	Datum d;
+	bool isnull;
+	int16 *moves, *new_moves;
+	int *applied;
+	int n, new_n, i;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game(s, PG_GETARG_DATUM(0)))
+		ereport(ERROR, (errmsg("chess_apply_moves: null input not allowed")));
+	d = GetAttributeByName(PG_GETARG_HEAPTUPLEHEADER(0), "moves", &isnull);
+	moves = NULL;
+	n = isnull ? 0 : aux_read_moves_array(DatumGetArrayTypeP(d), &moves);
+
+	new_n = aux_read_moves_array(PG_GETARG_ARRAYTYPE_P(1), &new_moves);
+	applied = (int *) palloc(sizeof(int) * Max(new_n, 1));
+	for (i = 0; i < new_n; i++)
+		{
+			s->candidate_move = applied[i] = new_moves[i];
+			aux_chess_apply_candidate_move(s);
+		}
+
+	PG_RETURN_DATUM(aux_write_game(aux_game_tuple_desc(fcinfo), s, moves, n, applied, new_n));
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_apply_move);
+
+Datum
+chess_chessboard_apply_move(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	ChessBoard *cb;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+
+	s->candidate_move = aux_read_move(PG_GETARG_DATUM(1));
+	aux_chess_apply_candidate_move(s);
+
+	cb = (ChessBoard *) palloc(sizeof(ChessBoard));
+	aux_write_chessboard(s, cb);
+	PG_RETURN_CHESSBOARD_P(cb);
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_apply_moves);
+
+Datum
+chess_chessboard_apply_moves(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	ChessBoard *cb;
+	int16 *moves;
+	int n, i;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+
+	n = aux_read_moves_array(PG_GETARG_ARRAYTYPE_P(1), &moves);
+	for (i = 0; i < n; i++)
+		{
+			s->candidate_move = moves[i];
+			aux_chess_apply_candidate_move(s);
+		}
+
+	cb = (ChessBoard *) palloc(sizeof(ChessBoard));
+	aux_write_chessboard(s, cb);
+	PG_RETURN_CHESSBOARD_P(cb);
+}
+
+/*
+ * This function expands each game of an array by one ply, in one
+ * pass: for each valid move of each game it returns the position of
+ * the game in the array (from 1), the move, the resulting game, its
+ * score as returned by the score function, and whether it is ended.
+ * Null games are skipped.
+ */
+
+PG_FUNCTION_INFO_V1(chess_expand);
+
+Datum
+chess_expand(PG_FUNCTION_ARGS)
+{
+	ArrayType *a = PG_GETARG_ARRAYTYPE_P(0);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	TupleDesc tuple_desc, game_desc;
+	MemoryContext oldcontext, parent_context;
+	chess_game_status *s;
+	chess_undo u;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elems;
+	bool *nulls;
+	Datum d;
+	bool moves_isnull;
+	int16 *parent_moves = NULL;
+	int moves[ChessMaxFormalMoves];
+	Datum values[5];
+	bool isnull[5] = { false, false, false, false, false };
+	int n_elems, n_parent, n, i, j;
+	bool terminal;
+	double score;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	game_desc = BlessTupleDesc(lookup_rowtype_tupdesc_copy(ARR_ELEMTYPE(a), -1));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tuple_desc = CreateTupleDescCopy(tuple_desc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tuple_desc;
+	MemoryContextSwitchTo(oldcontext);
+
+	get_typlenbyvalalign(ARR_ELEMTYPE(a), &typlen, &typbyval, &typalign);
+	deconstruct_array(a, ARR_ELEMTYPE(a), typlen, typbyval, typalign, &elems, &nulls, &n_elems);
+
+	/* the children of each parent are freed once they are stored */
+	parent_context = AllocSetContextCreate(CurrentMemoryContext,
+										   "pgchess expand",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	for (i = 0; i < n_elems; i++)
+		{
+			CHECK_FOR_INTERRUPTS();
+			if (nulls[i])
+				continue;
+			aux_init_chess_game_status(s);
+			if (aux_read_game(s, elems[i]))
+				continue;
+
+			oldcontext = MemoryContextSwitchTo(parent_context);
+			d = GetAttributeByName(DatumGetHeapTupleHeader(elems[i]), "moves", &moves_isnull);
+			n_parent = moves_isnull ? 0 : aux_read_moves_array(DatumGetArrayTypeP(d), &parent_moves);
+
+			n = aux_chess_valid_moves(s, moves);
+			for (j = 0; j < n; j++)
+				{
+					aux_chess_make_legal_move(s, moves[j], &u);
+
+					terminal = (aux_chess_count_valid_moves(s) == 0);
+					if (!terminal)
+						score = aux_chess_cached_score(s);
+					else if (aux_chess_in_check(s))
+						score = -get_float8_infinity();	/* checkmate */
+					else
+						score = get_float8_nan();		/* stalemate */
+
+					values[0] = Int32GetDatum(i + 1);
+					values[1] = Int16GetDatum(moves[j]);
+					values[2] = aux_write_game(game_desc, s, parent_moves, n_parent, &moves[j], 1);
+					values[3] = Float8GetDatum(score);
+					values[4] = BoolGetDatum(terminal);
+					tuplestore_putvalues(tupstore, tuple_desc, values, isnull);
+
+					aux_chess_unmake_move(s, &u);
+				}
+
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(parent_context);
+		}
+
+	MemoryContextDelete(parent_context);
+	aux_destroy_chess_game_status(s);
+	return (Datum) 0;
+}
+
+/*
+ * This function searches the best move, up to the given depth; it
+ * returns the move, its score, the number of nodes searched, the
+ * principal variation and the depth completed.
+ *
+ * time_ms is a soft limit: no iteration starts after half of it,
+ * since it would hardly end in time, and once it is over the search
+ * stops as soon as an iteration is complete. hard_ms, and the
+ * statement_timeout if sooner, stop even the first iteration; the
+ * search then returns what it found so far, or the first valid move
+ * in search order with the score of the position, rather than an
+ * error. Interrupts are checked as usual.
+ */
+
+/* how long before the statement_timeout a search stops, at most */
+#define ChessStatementTimeoutMargin 100
+
+void
+aux_chess_search_deadlines(chess_search *search, TimestampTz start, int time_ms, int hard_ms)
+{
+	TimestampTz timeout;
+
+	if (time_ms > 0)
+		{
+			search->deadline = TimestampTzPlusMilliseconds(start, time_ms);
+			search->next_deadline = TimestampTzPlusMilliseconds(start, time_ms / 2);
+		}
+	if (hard_ms > 0)
+		search->hard_deadline = TimestampTzPlusMilliseconds(start, hard_ms);
+	if (StatementTimeout > 0)
+		{
+			timeout = TimestampTzPlusMilliseconds(GetCurrentStatementStartTimestamp(),
+												  StatementTimeout - Min(StatementTimeout / 10,
+																		 ChessStatementTimeoutMargin));
+			if (search->hard_deadline == 0 || timeout < search->hard_deadline)
+				search->hard_deadline = timeout;
+		}
+}
+
+
+PG_FUNCTION_INFO_V1(chess_best_move);
+
+Datum
+chess_best_move(PG_FUNCTION_ARGS)
+{
+	chess_search *search;
+	int depth = PG_GETARG_INT32(1);
+	int time_ms = PG_GETARG_INT32(2);
+	int hard_ms = PG_GETARG_INT32(3);
+	TupleDesc tuple_desc;
+	Datum values[5];
+	bool isnull[5] = { false, false, false, false, false };
+	Datum *pv_datums;
+	int pv[ChessMaxPly];
+	int moves[ChessMaxFormalMoves];
+	int pv_n, n, i;
+	double score;
+	TimestampTz start = GetCurrentTimestamp();
+
+	if (depth < 1 || depth > ChessMaxPly / 2)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("depth must be between 1 and %d", ChessMaxPly / 2)));
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tuple_desc = BlessTupleDesc(tuple_desc);
+
+	search = (chess_search *) palloc0(sizeof(chess_search));
+	search->s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	aux_init_chess_game_status(search->s);
+	if (aux_read_game_arg(search->s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_best_move: null input not allowed")));
+	aux_chess_search_deadlines(search, start, time_ms, hard_ms);
+
+	pv_n = aux_chess_parallel_best_move(search, depth, &score, pv);
+	if (pv_n == 0 && (n = aux_chess_valid_moves(search->s, moves)) > 0)
+		{
+			aux_chess_order_moves(search->s, moves, n, ChessVoidMove, NULL);
+			pv[pv_n++] = moves[0];
+			score = aux_chess_cached_score(search->s);
+		}
+	ChessStatsAdd(ChessStatSearchNodes, search->nodes);
+	ChessStatsAdd(ChessStatSearchNs, (GetCurrentTimestamp() - start) * 1000);
+
+	if (pv_n > 0)
+		values[0] = Int16GetDatum(pv[0]);
+	else
+		isnull[0] = true;
+	values[1] = Float8GetDatum(score == 0 ? 0 : score);	/* not -0 */
+	values[2] = Int64GetDatum(search->nodes);
+	if (pv_n == 0)
+		values[3] = PointerGetDatum(construct_empty_array(INT2OID));
+	else
+		{
+			pv_datums = (Datum *) palloc(sizeof(Datum) * pv_n);
+			for (i = 0; i < pv_n; i++)
+				pv_datums[i] = Int16GetDatum(pv[i]);
+			values[3] = PointerGetDatum(construct_array(pv_datums, pv_n, INT2OID,
+														sizeof(int16), true, 's'));
+		}
+	values[4] = Int32GetDatum(search->depth);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+
+/*
+ * perft counts the leaf nodes of the tree of valid moves, up to the
+ * given depth; it is the usual way to check (and to time) the move
+ * generator against well-known node counts.
+ *
+ * The elapsed time and the nodes per second are reported at DEBUG1,
+ * and returned by perft_timed.
+ */
+
+double
+aux_chess_perft_report(const char *name, int depth, int64 nodes, TimestampTz start)
+{
+	TimestampTz end = GetCurrentTimestamp();
+	double elapsed_ms = (end - start) / 1000.0;
+
+	ChessStatsAdd(ChessStatPerftNs, (end - start) * 1000);
+	ereport(DEBUG1,
+			(errmsg("%s(%d): " INT64_FORMAT " nodes in %.3f ms (%.0f nodes/s)",
+					name, depth, nodes, elapsed_ms,
+					elapsed_ms > 0 ? nodes * 1000.0 / elapsed_ms : 0)));
+	return elapsed_ms;
+}
+
+chess_game_status *
+aux_chess_perft_args(FunctionCallInfo fcinfo, const char *name, int depth)
+{
+	chess_game_status *s;
+
+	if (depth < 0 || depth > ChessMaxPly)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("depth must be between 0 and %d", ChessMaxPly)));
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	aux_init_chess_game_status(s);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("%s: null input not allowed", name)));
+	return s;
+}
+
+PG_FUNCTION_INFO_V1(chess_perft);
+
+Datum
+chess_perft(PG_FUNCTION_ARGS)
+{
+	int depth = PG_GETARG_INT32(1);
+	chess_game_status *s = aux_chess_perft_args(fcinfo, "chess_perft", depth);
+	TimestampTz start = GetCurrentTimestamp();
+	int64 nodes;
+
+	nodes = aux_chess_parallel_perft(s, depth);
+	aux_chess_perft_report("perft", depth, nodes, start);
+
+	aux_destroy_chess_game_status(s);
+	PG_RETURN_INT64(nodes);
+}
+
+PG_FUNCTION_INFO_V1(chess_perft_timed);
+
+Datum
+chess_perft_timed(PG_FUNCTION_ARGS)
+{
+	int depth = PG_GETARG_INT32(1);
+	chess_game_status *s = aux_chess_perft_args(fcinfo, "chess_perft_timed", depth);
+	TimestampTz start = GetCurrentTimestamp();
+	TupleDesc tuple_desc;
+	Datum values[3];
+	bool isnull[3] = { false, false, false };
+	int64 nodes;
+	double elapsed_ms;
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tuple_desc = BlessTupleDesc(tuple_desc);
+
+	nodes = aux_chess_parallel_perft(s, depth);
+	elapsed_ms = aux_chess_perft_report("perft", depth, nodes, start);
+
+	values[0] = Int64GetDatum(nodes);
+	values[1] = Float8GetDatum(elapsed_ms);
+	values[2] = Int64GetDatum(elapsed_ms > 0 ? (int64) (nodes * 1000.0 / elapsed_ms) : 0);
+
+	aux_destroy_chess_game_status(s);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+/*
+ * perft_divide returns the perft count below each valid move, in the
+ * same order as valid_moves; depth includes the move itself.
+ */
+
+PG_FUNCTION_INFO_V1(chess_perft_divide);
+
+Datum
+chess_perft_divide(PG_FUNCTION_ARGS)
+{
+	int depth = PG_GETARG_INT32(1);
+	chess_game_status *s = aux_chess_perft_args(fcinfo, "chess_perft_divide", depth);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TimestampTz start = GetCurrentTimestamp();
+	Tuplestorestate *tupstore;
+	TupleDesc tuple_desc;
+	MemoryContext oldcontext;
+	Datum values[2];
+	bool isnull[2] = { false, false };
+	int moves[ChessMaxFormalMoves];
+	int64 nodes[ChessMaxFormalMoves];
+	int n, i;
+	int64 total = 0;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (depth < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("depth must be between 1 and %d", ChessMaxPly)));
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tuple_desc = CreateTupleDescCopy(tuple_desc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tuple_desc;
+	MemoryContextSwitchTo(oldcontext);
+
+	n = aux_chess_perft_divide(s, depth, moves, nodes);
+	for (i = 0; i < n; i++)
+		{
+			values[0] = Int16GetDatum(moves[i]);
+			values[1] = Int64GetDatum(nodes[i]);
+			tuplestore_putvalues(tupstore, tuple_desc, values, isnull);
+			total += nodes[i];
+		}
+	aux_chess_perft_report("perft_divide", depth, total, start);
+
+	aux_destroy_chess_game_status(s);
+	return (Datum) 0;
+}
+
+/*
+ * Statistics of the transposition table.
+ */
+
+PG_FUNCTION_INFO_V1(chess_tt_stats);
+
+Datum
+chess_tt_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tuple_desc;
+	Datum values[5];
+	bool isnull[5] = { false, false, false, false, false };
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tuple_desc = BlessTupleDesc(tuple_desc);
+
+	if (chess_tt == NULL)
+		{
+			memset(isnull, true, sizeof(isnull));
+			values[0] = Int64GetDatum(0);
+			isnull[0] = false;
+		}
+	else
+		{
+			values[0] = Int64GetDatum((int64) (2 * chess_tt->n_buckets));
+			values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&chess_tt->hits));
+			values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&chess_tt->misses));
+			values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&chess_tt->stores));
+			values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&chess_tt->replacements));
+		}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+/*
+ * This function empties the transposition table and resets its
+ * statistics. Concurrent searches are not harmed: they just miss.
+ */
+
+PG_FUNCTION_INFO_V1(chess_tt_clear);
+
+Datum
+chess_tt_clear(PG_FUNCTION_ARGS)
+{
+	uint64 i;
+
+	if (chess_tt != NULL)
+		{
+			for (i = 0; i < 2 * chess_tt->n_buckets; i++)
+				pg_atomic_write_u64(&chess_tt->entries[i].info, 0);
+			pg_atomic_write_u64(&chess_tt->hits, 0);
+			pg_atomic_write_u64(&chess_tt->misses, 0);
+			pg_atomic_write_u64(&chess_tt->stores, 0);
+			pg_atomic_write_u64(&chess_tt->replacements, 0);
+		}
+	PG_RETURN_VOID();
+}
+
+/*
+ * Engine statistics: the totals, including the counts of the current
+ * transaction, and their reset.
+ */
+
+PG_FUNCTION_INFO_V1(chess_pgchess_stats);
+
+Datum
+chess_pgchess_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tuple_desc;
+	Datum values[ChessStatN];
+	bool isnull[ChessStatN];
+	int i;
+
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tuple_desc = BlessTupleDesc(tuple_desc);
+
+	aux_chess_stats_flush();
+	for (i = 0; i < ChessStatN; i++)
+		{
+			values[i] = Int64GetDatum((int64) pg_atomic_read_u64(&chess_stats->counters[i]));
+			isnull[i] = false;
+		}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+PG_FUNCTION_INFO_V1(chess_pgchess_stats_reset);
+
+Datum
+chess_pgchess_stats_reset(PG_FUNCTION_ARGS)
+{
+	int i;
+
+	for (i = 0; i < ChessStatN; i++)
+		{
+			pg_atomic_write_u64(&chess_stats->counters[i], 0);
+			chess_stats_pending[i] = 0;
+		}
+	PG_RETURN_VOID();
+}
+
+/*
+ * Opening books. This function maps the book at pgchess.book_path,
+ * unless it is mapped already; a book which is replaced on disk is
+ * mapped again.
+ */
+
+void
+aux_chess_book_map(void)
+{
+	struct stat st;
+	void *data = NULL;
+	int fd, save_errno;
+
+	if (chess_book_path == NULL || chess_book_path[0] == '\0')
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("no opening book is configured"),
+				 errhint("Set pgchess.book_path to the path of a Polyglot book.")));
+	if (stat(chess_book_path, &st) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat opening book \"%s\": %m", chess_book_path)));
+	if (chess_book_mapped_path != NULL &&
+		strcmp(chess_book_mapped_path, chess_book_path) == 0 &&
+		st.st_dev == chess_book_stat.st_dev &&
+		st.st_ino == chess_book_stat.st_ino &&
+		st.st_size == chess_book_stat.st_size &&
+		st.st_mtime == chess_book_stat.st_mtime)
+		return;
+
+	if (chess_book_data != NULL)
+		munmap((void *) chess_book_data, chess_book_n * ChessBookEntrySize);
+	if (chess_book_mapped_path != NULL)
+		pfree(chess_book_mapped_path);
+	chess_book_data = NULL;
+	chess_book_mapped_path = NULL;
+	chess_book_n = 0;
+
+	fd = open(chess_book_path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open opening book \"%s\": %m", chess_book_path)));
+	if (fstat(fd, &st) < 0)
+		{
+			save_errno = errno;
+			close(fd);
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not stat opening book \"%s\": %m", chess_book_path)));
+		}
+	if (st.st_size % ChessBookEntrySize != 0)
+		{
+			close(fd);
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("opening book \"%s\" is not a Polyglot book", chess_book_path),
+					 errdetail("Its size is not a multiple of %d bytes.", ChessBookEntrySize)));
+		}
+	if (st.st_size > 0)
+		{
+			data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED)
+				{
+					save_errno = errno;
+					close(fd);
+					errno = save_errno;
+					ereport(ERROR,
+							(errcode_for_file_access(),
+							 errmsg("could not map opening book \"%s\": %m", chess_book_path)));
+				}
+		}
+	close(fd);
+
+	chess_book_data = data;
+	chess_book_n = st.st_size / ChessBookEntrySize;
+	chess_book_stat = st;
+	chess_book_mapped_path = MemoryContextStrdup(TopMemoryContext, chess_book_path);
+}
+
+/*
+ * This function reads an unsigned big endian integer of n bytes.
+ */
+
+uint64
+aux_chess_book_read(const unsigned char *p, int n)
+{
+	uint64 x = 0;
+
+	while (n-- > 0)
+		x = (x << 8) | *p++;
+	return x;
+}
+
+/*
+ * This function converts a Polyglot move into our encoding. Polyglot
+ * encodes castling as the King capturing its own Rook, and numbers
+ * promotions as knight = 1, bishop, rook, queen = 4; the result is
+ * ChessVoidMove for invalid promotions.
+ */
+
+int
+aux_chess_book_move(const chess_game_status *s, int pm)
+{
+	static const int ppc[5] = { 0, 2, 1, 3, 0 };
+	int sq1 = (pm >> 6) & 63;
+	int sq2 = pm & 63;
+	int promotion = (pm >> 12) & 7;
+	char p = s->b[ChessSquareX(sq1)][ChessSquareY(sq1)];
+
+	if (promotion > 4)
+		return ChessVoidMove;
+	if ((p == 'K' && sq1 == 4 && (sq2 == 0 || sq2 == 7)) ||
+		(p == 'k' && sq1 == 60 && (sq2 == 56 || sq2 == 63)))
+		sq2 = (sq2 > sq1) ? sq1 + 2 : sq1 - 2;
+	return ChessMoveFromSquares(sq1, sq2, ppc[promotion]);
+}
 
-	/* game.halfmove_counter */
-	d = GetAttributeByName(h, "halfmove_counter", &isnull);
-	if (isnull)
-		return 1;
-	s->halfmove_counter = DatumGetInt16(d);
-					
-	/* game.moves */
-	d = GetAttributeByName(h, "moves", &isnull);
+/*
+ * This function returns the moves of the opening book for the given
+ * position, in the order of the book. The entries of the position
+ * are found by binary search on the mapped file; entries whose move
+ * is not valid, which can only come from a key collision or a broken
+ * book, are skipped.
+ */
 
-	if (isnull)
+PG_FUNCTION_INFO_V1(chess_book_moves);
+
+Datum
+chess_book_moves(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	chess_game_status *s;
+	Tuplestorestate *tupstore;
+	TupleDesc tuple_desc;
+	MemoryContext oldcontext;
+	Datum values[3];
+	bool isnull[3] = { false, false, false };
+	int moves[ChessMaxFormalMoves];
+	const unsigned char *e;
+	uint64 key;
+	Size lo, hi, mid;
+	int n, i, move;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	aux_init_chess_game_status(s);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		ereport(ERROR, (errmsg("chess_book_moves: null input not allowed")));
+	aux_chess_book_map();
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tuple_desc = CreateTupleDescCopy(tuple_desc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tuple_desc;
+	MemoryContextSwitchTo(oldcontext);
+
+	key = aux_chess_polyglot_key(s);
+	lo = 0;
+	hi = chess_book_n;
+	while (lo < hi)
 		{
-			s->previous_moves_n = 0;
-			s->previous_moves = NULL;
+			mid = lo + (hi - lo) / 2;
+			if (aux_chess_book_read(chess_book_data + mid * ChessBookEntrySize, 8) < key)
+				lo = mid + 1;
+			else
+				hi = mid;
 		}
-	else
+
+	n = -1;
+	for (; lo < chess_book_n; lo++)
 		{
-			h = DatumGetHeapTupleHeader(d);
-			moves = DatumGetArrayTypeP(d);
-			if (ARR_NDIM(moves) == 1) 
-				{
-					s->previous_moves_n = ARR_DIMS(moves)[0];
-					s->previous_moves = (int *) palloc0(sizeof(int) * s->previous_moves_n);
-					
-					moves_iterator = array_create_iterator(moves, 0, NULL);
-					for (i = 0; array_iterate(moves_iterator, &d, &isnull); i++)
-						{
-							s->previous_moves[i] = DatumGetInt16(d);
-						}
-				}
+			e = chess_book_data + lo * ChessBookEntrySize;
+			if (aux_chess_book_read(e, 8) != key)
+				break;
+			if (n < 0)
+				n = aux_chess_valid_moves(s, moves);
+			move = aux_chess_book_move(s, (int) aux_chess_book_read(e + 8, 2));
+			for (i = 0; i < n && moves[i] != move; i++)
+				;
+			if (i == n)
+				continue;
+			values[0] = Int16GetDatum(move);
+			values[1] = Int32GetDatum((int32) aux_chess_book_read(e + 10, 2));
+			values[2] = Int32GetDatum((int32) aux_chess_book_read(e + 12, 4));
+			tuplestore_putvalues(tupstore, tuple_desc, values, isnull);
 		}
 
-	return 0;
+	aux_destroy_chess_game_status(s);
+	return (Datum) 0;
 }
 
 /*
- * This function reads a "move" argument into an int
+ * The key of a position in Polyglot books.
  */
 
-int aux_read_move(Datum d)
+PG_FUNCTION_INFO_V1(chess_polyglot_key);
+
+Datum
+chess_polyglot_key(PG_FUNCTION_ARGS)
 {
-	HeapTupleHeader h;
-	bool isnull;
+	chess_game_status *s;
 
-	int x1;
-	int x2;
-	int y1;
-	int y2;
-	int ppc;
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+	PG_RETURN_INT64((int64) aux_chess_polyglot_key(s));
+}
 
-	h = DatumGetHeapTupleHeader(d);
+/*
+ * PGN import. The parser is fed one line at a time, so that a file
+ * can be read without loading it whole, and stores each game into the
+ * tuplestore as soon as its result is read. The tags and the moves of
+ * the current game are allocated in game_context, which is reset
+ * after each game. A game with a move which is not valid is skipped
+ * with a warning, so that one bad game does not abort a long import.
+ */
 
-	/*
-	 * SQL object definitions which are relevant here:
-	 *
-	 * CREATE TYPE move AS (x1 int2, y1 int2, x2 int2, y2 int2, ppc int2);
-	 */
+#define ChessStartFen "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+/* the characters which end a token of the movetext */
+#define ChessPGNDelimiters " \t\r\n\f\v{}();"
+
+typedef struct
+{
+	Tuplestorestate *tupstore;
+	TupleDesc tuple_desc;
+	TupleDesc game_desc;
+	MemoryContext game_context;
+	int64 n_games;				/* the games started so far */
+	bool in_game;				/* a tag or a move of this game was read */
+	bool in_moves;				/* the position of this game is set up */
+	bool in_comment;			/* inside {} */
+	int variation_depth;		/* inside () */
+	char *error;				/* why this game is skipped, or NULL */
+	int n_tags;
+	int max_tags;
+	char **tag_names;
+	char **tag_values;
+	chess_game_status s;
+	int16 *fen_moves;
+	int n_moves;
+	int max_moves;
+	int *moves;
+} chess_pgn_parser;
+
+chess_pgn_parser *aux_chess_pgn_begin(FunctionCallInfo);
+void aux_chess_pgn_end(chess_pgn_parser *);
+void aux_chess_pgn_start_game(chess_pgn_parser *);
+void aux_chess_pgn_end_game(chess_pgn_parser *);
+void aux_chess_pgn_setup(chess_pgn_parser *);
+int aux_chess_pgn_tag(chess_pgn_parser *, const char *, int);
+void aux_chess_pgn_token(chess_pgn_parser *, const char *, int);
+void aux_chess_pgn_line(chess_pgn_parser *, const char *, int);
+
+/*
+ * This function prepares the parser, and the tuplestore where the
+ * games are returned.
+ */
+
+chess_pgn_parser *
+aux_chess_pgn_begin(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	chess_pgn_parser *p;
+	TupleDesc tuple_desc;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	p = (chess_pgn_parser *) palloc0(sizeof(chess_pgn_parser));
+	p->game_desc = BlessTupleDesc(lookup_rowtype_tupdesc_copy(TupleDescAttr(tuple_desc, 2)->atttypid, -1));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	p->tuple_desc = CreateTupleDescCopy(tuple_desc);
+	p->tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+										false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = p->tupstore;
+	rsinfo->setDesc = p->tuple_desc;
+	MemoryContextSwitchTo(oldcontext);
+
+	p->game_context = AllocSetContextCreate(CurrentMemoryContext,
+											"pgchess PGN game",
+											ALLOCSET_DEFAULT_SIZES);
+	return p;
+}
+
+/*
+ * This function stores the last game, which may lack its result.
+ */
 
-	x1  = DatumGetInt32(GetAttributeByName(h, "x1",  &isnull));
-	x2  = DatumGetInt32(GetAttributeByName(h, "x2",  &isnull));
-	y1  = DatumGetInt32(GetAttributeByName(h, "y1",  &isnull));
-	y2  = DatumGetInt32(GetAttributeByName(h, "y2",  &isnull));
-	ppc = DatumGetInt32(GetAttributeByName(h, "ppc", &isnull));
+void
+aux_chess_pgn_end(chess_pgn_parser *p)
+{
+	aux_chess_pgn_end_game(p);
+	MemoryContextDelete(p->game_context);
+	pfree(p);
+}
 
-	return ChessMove(x1,x2,y1,y2,ppc);
+void
+aux_chess_pgn_start_game(chess_pgn_parser *p)
+{
+	if (p->in_game)
+		return;
+	p->in_game = true;
+	p->n_games++;
 }
 
-/* Enumeration of moves follows this table:
- *---------+-------------------+-----------------------------------------------------*
- * Id      | Piece             | Moves                                               *
- *---------+-------------------+-----------------------------------------------------*
- *     1-8 | Knight            | Anticlockwise, starting from 2x+y                   *
- *    9-16 | Rook/Bishop/Queen | Anticlockwise, starting from direction x            *
- *      17 | King              | The only available move                             *
- *      18 | Pawn              | Not capturing (forward), promote to Q if rank = max *
- *      19 | Pawn              | Capturing to the left, promote to Q if rank = max   *
- *      20 | Pawn              | Capturing to the right, promote to Q if rank = max  *
- *   21-23 | Pawn              | like 19-21, when rank = max, promote to R           *
- *   24-26 | Pawn              | like 19-21, when rank = max, promote to B           *
- *   27-29 | Pawn              | like 19-21, when rank = max, promote to N           *
- *---------+-------------------+-----------------------------------------------------*/
+/*
+ * This function stores the current game, unless it is skipped, and
+ * forgets it.
+ */
+
+void
+aux_chess_pgn_end_game(chess_pgn_parser *p)
+{
+	MemoryContext oldcontext;
+	JsonbParseState *state = NULL;
+	JsonbValue *tags;
+	JsonbValue k, v;
+	Datum *moves;
+	Datum values[3];
+	bool isnull[3] = { false, false, false };
+	int i;
+
+	if (!p->in_game)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(p->game_context);
+	if (!p->in_moves && p->error == NULL)
+		aux_chess_pgn_setup(p);
+
+	if (p->error != NULL)
+		ereport(WARNING,
+				(errmsg("skipping PGN game %lld: %s", (long long) p->n_games, p->error)));
+	else
+		{
+			pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+			for (i = 0; i < p->n_tags; i++)
+				{
+					k.type = jbvString;
+					k.val.string.val = p->tag_names[i];
+					k.val.string.len = strlen(p->tag_names[i]);
+					pushJsonbValue(&state, WJB_KEY, &k);
+					v.type = jbvString;
+					v.val.string.val = p->tag_values[i];
+					v.val.string.len = strlen(p->tag_values[i]);
+					pushJsonbValue(&state, WJB_VALUE, &v);
+				}
+			tags = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+			values[0] = JsonbPGetDatum(JsonbValueToJsonb(tags));
+
+			moves = (Datum *) palloc(sizeof(Datum) * Max(p->n_moves, 1));
+			for (i = 0; i < p->n_moves; i++)
+				moves[i] = Int16GetDatum(p->moves[i]);
+			values[1] = PointerGetDatum(construct_array(moves, p->n_moves,
+														INT2OID, sizeof(int16), true, 's'));
+
+			values[2] = aux_write_game(p->game_desc, &p->s,
+									   p->fen_moves, p->s.previous_moves_n - p->n_moves,
+									   p->moves, p->n_moves);
+			tuplestore_putvalues(p->tupstore, p->tuple_desc, values, isnull);
+		}
+	MemoryContextSwitchTo(oldcontext);
+
+	MemoryContextReset(p->game_context);
+	p->in_game = false;
+	p->in_moves = false;
+	p->in_comment = false;
+	p->variation_depth = 0;
+	p->error = NULL;
+	p->n_tags = p->max_tags = 0;
+	p->tag_names = p->tag_values = NULL;
+	p->fen_moves = NULL;
+	p->n_moves = p->max_moves = 0;
+	p->moves = NULL;
+
+	CHECK_FOR_INTERRUPTS();
+}
 
 /*
- * This function rewinds the formal move iterator to the start.
+ * This function sets up the position of the current game, from its
+ * FEN tag if any, when its first move is read.
  */
 
-int
-aux_chess_formal_move_rewind(chess_game_status *s)
+void
+aux_chess_pgn_setup(chess_pgn_parser *p)
 {
-	s->move_iterator = 0;
-	return 0;
+	const char *fen = NULL;
+	int i;
+
+	for (i = 0; i < p->n_tags; i++)
+		if (strcmp(p->tag_names[i], "FEN") == 0)
+			fen = p->tag_values[i];
+
+	aux_init_chess_game_status(&p->s);
+	aux_chess_read_fen(&p->s, fen == NULL ? ChessStartFen : fen);
+	p->fen_moves = (fen == NULL) ? NULL : aux_chess_fen_moves(&p->s);
+	p->in_moves = true;
 }
 
 /*
- * This function finds the next formal move available, returning 0
- * iff there is none.
+ * This function reads a tag pair such as [Event "F/S Return Match"],
+ * returning its length, or 0 if it is malformed. Values which are not
+ * in the server encoding are read as ISO 8859-1, the encoding of the
+ * PGN standard.
  */
 
 int
-aux_chess_formal_move_next(chess_game_status *s)
+aux_chess_pgn_tag(chess_pgn_parser *p, const char *line, int len)
 {
+	StringInfoData value;
+	const char *name;
+	int i = 1, name_len;
+	char *v;
+
+	while (i < len && (line[i] == ' ' || line[i] == '\t'))
+		i++;
+	name = line + i;
+	while (i < len && (isalnum((unsigned char) line[i]) || line[i] == '_'))
+		i++;
+	name_len = line + i - name;
+	while (i < len && (line[i] == ' ' || line[i] == '\t'))
+		i++;
+	if (name_len == 0 || i >= len || line[i] != '"')
+		return 0;
+
+	initStringInfo(&value);
+	for (i++; i < len && line[i] != '"'; i++)
+		{
+			if (line[i] == '\\' && i + 1 < len)
+				i++;
+			appendStringInfoChar(&value, line[i]);
+		}
+	for (i++; i < len && (line[i] == ' ' || line[i] == '\t'); i++)
+		;
+	if (i >= len || line[i] != ']')
+		return 0;
 
-	/*
-	 * Chess-specific static data
-	 */
+	v = value.data;
+	if (!pg_verifymbstr(v, value.len, true))
+		v = (char *) pg_any_to_server(v, value.len, PG_LATIN1);
+
+	if (p->n_tags == p->max_tags)
+		{
+			p->max_tags = Max(2 * p->max_tags, 16);
+			if (p->tag_names == NULL)
+				{
+					p->tag_names = (char **) palloc(sizeof(char *) * p->max_tags);
+					p->tag_values = (char **) palloc(sizeof(char *) * p->max_tags);
+				}
+			else
+				{
+					p->tag_names = (char **) repalloc(p->tag_names, sizeof(char *) * p->max_tags);
+					p->tag_values = (char **) repalloc(p->tag_values, sizeof(char *) * p->max_tags);
+				}
+		}
+	p->tag_names[p->n_tags] = pnstrdup(name, name_len);
+	p->tag_values[p->n_tags] = v;
+	p->n_tags++;
 
-	int king_moves[][2] =
-		{ 	
-			{  1,  0 },
-			{  1,  1 },
-			{  0,  1 },
-			{ -1,  1 },
-			{ -1,  0 },
-			{ -1, -1 },
-			{  0, -1 },
-			{  1, -1 },
-			{  2,  0 }, /* castling kingside */
-			{ -2,  0 }  /* castling queenside */
-		};
-	int knight_moves[][2] =
-		{ 
-			{  2,  1 },
-			{  1,  2 },
-			{ -1,  2 },
-			{ -2,  1 },
-			{ -2, -1 },
-			{ -1, -2 },
-			{  1, -2 },
-			{  2, -1 }
-		};
-	int queen_directions[][2] =
-		{
-			{  1,  0 },
-			{  1,  1 },
-			{  0,  1 },
-			{ -1,  1 },
-			{ -1,  0 },
-			{ -1, -1 },
-			{  0, -1 },
-			{  1, -1 }
-		};
+	return i + 1;
+}
 
-	/*
-	 * Dynamic data 
-	 */
+/*
+ * This function reads a token of the movetext: a move number, a move
+ * in SAN, a numeric annotation glyph or a game termination marker.
+ */
 
-	char side = s->previous_moves_n % 2 == 0 ? 'w' : 'b';
-	char my_king   = (side == 'w') ? 'K' : 'k';
-	char my_queen  = (side == 'w') ? 'Q' : 'q';
-	char my_rook   = (side == 'w') ? 'R' : 'r';
-	char my_bishop = (side == 'w') ? 'B' : 'b';
-	char my_knight = (side == 'w') ? 'N' : 'n';
-	char my_pawn   = (side == 'w') ? 'P' : 'p';
+void
+aux_chess_pgn_token(chess_pgn_parser *p, const char *tok, int len)
+{
+	chess_undo u;
+	int move, i;
 
-	int i, j;
-	int x1=0, y1=0, x2, y2, ym, dx, dy, id, tg;
+	aux_chess_pgn_start_game(p);
 
-	if (s->halfmove_counter >= 50)
+	if ((len == 3 && (memcmp(tok, "1-0", 3) == 0 || memcmp(tok, "0-1", 3) == 0)) ||
+		(len == 7 && memcmp(tok, "1/2-1/2", 7) == 0) ||
+		(len == 1 && tok[0] == '*'))
 		{
-			s->candidate_move=ChessEndOfMoves;
-			return 0;
+			aux_chess_pgn_end_game(p);
+			return;
 		}
+	if (tok[0] == '$' || p->error != NULL)
+		return;
 
-	x2 = ChessMoveX2(s->move_iterator);
-	y2 = ChessMoveY2(s->move_iterator);
-	id = ChessMoveID(s->move_iterator);
-	tg = ChessMoveTarget(s->move_iterator);
-	while (s->move_iterator < ChessIteratorEnd)
+	/* "12." and "12..." are move numbers, possibly followed by a move */
+	for (i = 0; i < len && tok[i] >= '0' && tok[i] <= '9'; i++)
+		;
+	if (i == len || tok[i] == '.')
 		{
-			/*
-			 * Change target if the current one has been scanned or is
-			 * not suitable.
-			 */
+			while (i < len && tok[i] == '.')
+				i++;
+			tok += i;
+			len -= i;
+		}
+	/* annotations such as "!?", when separated from the move */
+	for (i = 0; i < len && (tok[i] == '!' || tok[i] == '?'); i++)
+		;
+	if (i == len || (len == 4 && memcmp(tok, "e.p.", 4) == 0))
+		return;
 
-			if (side == aux_chess_side(s->b[x2][y2])
-				||
-				id >= ChessMoveIDMax)
-				{
-					s->move_iterator = ChessMoveNextTarget(s->move_iterator);
-					x2 = ChessMoveX2(s->move_iterator);
-					y2 = ChessMoveY2(s->move_iterator);
-					id = ChessMoveID(s->move_iterator);
-					tg = ChessMoveTarget(s->move_iterator);
+	if (!p->in_moves)
+		aux_chess_pgn_setup(p);
+	move = aux_chess_san_to_move(&p->s, tok, len);
+	if (move < 0)
+		{
+			p->error = psprintf("%s move \"%.*s\" at ply %d",
+								move == ChessSANAmbiguous ? "ambiguous" : "invalid",
+								len, tok, p->n_moves + 1);
+			return;
+		}
 
-					continue;
-				}
+	if (p->n_moves == p->max_moves)
+		{
+			p->max_moves = Max(2 * p->max_moves, 128);
+			if (p->moves == NULL)
+				p->moves = (int *) palloc(sizeof(int) * p->max_moves);
+			else
+				p->moves = (int *) repalloc(p->moves, sizeof(int) * p->max_moves);
+		}
+	p->moves[p->n_moves++] = move;
+	aux_chess_make_move(&p->s, move, &u);
+}
 
-			/* 
-			 * From now on we can assume that the target square does
-			 * not contain a friendly piece, and that the current
-			 * MoveID, if incremented, gives a valid MoveID.
-			 */
+/*
+ * This function reads a line of PGN. Comments and variations may span
+ * several lines; tags are only recognized outside them.
+ */
+
+void
+aux_chess_pgn_line(chess_pgn_parser *p, const char *line, int len)
+{
+	MemoryContext oldcontext;
+	int i = 0, j;
 
-			while (id < ChessMoveIDMax)
+	oldcontext = MemoryContextSwitchTo(p->game_context);
+
+	if (!p->in_comment && p->variation_depth == 0)
+		{
+			/* escaped lines */
+			if (len > 0 && line[0] == '%')
+				len = 0;
+
+			while (i < len && (line[i] == ' ' || line[i] == '\t'))
+				i++;
+			while (i < len && line[i] == '[')
 				{
-					id++;
-					switch (id)
+					/* tags after the movetext start the next game */
+					if (p->in_moves)
+						aux_chess_pgn_end_game(p);
+					aux_chess_pgn_start_game(p);
+					j = aux_chess_pgn_tag(p, line + i, len - i);
+					if (j == 0)
 						{
-							/* 1-8: Knight */
-						case 1:
-						case 2:
-						case 3:
-						case 4:
-						case 5:
-						case 6:
-						case 7:
-						case 8:
-							i = id - 1;
-							x1 = x2 - knight_moves[i][0];
-							y1 = y2 - knight_moves[i][1];
-							if (ChessValidXY(x1,y1) && s->b[x1][y1] == my_knight)
-								{
-									s->move_iterator=ChessIteratorFromTgId(tg,id);
-									s->candidate_move=ChessMove(x1,y1,x2,y2,0);
-									return 1;
-								}
-							break;
-							/* 9-16: Rook, Bishop, Queen */
-						case 9:
-						case 10:
-						case 11:
-						case 12:
-						case 13:
-						case 14:
-						case 15:
-						case 16:
-							i = id - 9;
-							dx = queen_directions[i][0];
-							dy = queen_directions[i][1];
-							x1 = x2;
-							y1 = y2;
-							for (j=1; j<8; j++)
-								{
-									x1 -= dx;
-									y1 -= dy;
-									if (s->b[x1][y1] != ' ')
-										break;
-								}
-							if (ChessValidXY(x1,y1) && 
-								(s->b[x1][y1] == my_queen                  ||
-								 (s->b[x1][y1] == my_rook   && i % 2 == 0) ||
-								 (s->b[x1][y1] == my_bishop && i % 2 == 1)))
-								{
-									s->move_iterator=ChessIteratorFromTgId(tg,id);
-									s->candidate_move=ChessMove(x1,y1,x2,y2,0);
-									return 1;									
-								}
-							break;
-							/* 17: King */
-						case 17:
-							for (i=0;i<10;i++)
-								{
-									x1 = x2 - king_moves[i][0];
-									y1 = y2 - king_moves[i][1];
-									if (ChessValidXY(x1,y1) && s->b[x1][y1] == my_king)
-										{
-											/* Castling kingside */
-											if (king_moves[i][0] == 2)
-												{
-													if (x1 == 4 &&
-														y1 == 0 &&
-														s->b[5][0] == ' ' &&
-														s->b[6][0] == ' ' &&
-														s->c[0] == 'y')
-														break;
-													if (x1 == 4 &&
-														y1 == 7 &&
-														s->b[5][7] == ' ' &&
-														s->b[6][7] == ' ' &&
-														s->c[1] == 'y')
-														break;
-													continue;
-												}
-											/* Castling queenside */
-											if (king_moves[i][0] == -2)
-												{
-													if (x1 == 4 &&
-														y1 == 0 &&
-														s->b[3][0] == ' ' &&
-														s->b[2][0] == ' ' &&
-														s->b[1][0] == ' ' &&
-														s->c[2] == 'y')
-														break;
-													if (x1 == 4 &&
-														y1 == 7 &&
-														s->b[3][7] == ' ' &&
-														s->b[2][7] == ' ' &&
-														s->b[1][7] == ' ' &&
-														s->c[3] == 'y')
-														break;
-													continue;
-												}
-											break;
-										}
-								}
-							if (i<10)
-								{
-									{
-										s->move_iterator=ChessIteratorFromTgId(tg,id);
-										s->candidate_move=ChessMove(x1,y1,x2,y2,0);
-										return 1;
-									}
-								}
-							break;
-							/*
-							 * 18-29: Pawn moves
-							 *
-							 * subcases #1:
-							 * - 18-20: not promoted or promoted to Queen (depending on y2)
-							 * - 21-23: promoted to Rook
-							 * - 24-26: promoted to Bishop
-							 * - 27-29: promoted to Knight
-							 *
-							 * subcases #2:
-							 * - 18,21,24,27: non-capturing forward
-							 * - 19,22,25,28: capturing to the left
-							 * - 20,23,26,29: capturing to the right
-							 */
-						case 18:
-						case 21:
-						case 24:
-						case 27:
-							if (s->b[x2][y2] == ' ') /* only non-capturing */
-								{
-									x1 = x2;
-									y1 = y2 + (side == 'w' ? -1 : 1);
-									if (ChessValidXY(x1,y1) && 
-										s->b[x1][y1] == my_pawn &&
-										(id == 18 || y2 == (side == 'w' ? 7 : 0)))
-										{
-											s->move_iterator=ChessIteratorFromTgId(tg,id);
-											s->candidate_move=ChessMove(x1,y1,x2,y2,
-																		(id == 18 ? 0 :
-																		 (id == 21 ? 1 :
-																		  (id == 24 ? 2 : 3))));
-											return 1;
-										}
-									if (id == 18 &&
-										((y2 == 3 && side == 'w') ||
-										 (y2 == 4 && side == 'b')))
-										{
-											y1 = y2 + (side == 'w' ? -2 : 2);
-											ym = y2 + (side == 'w' ? -1 : 1);
-											if (s->b[x1][y1] == my_pawn &&
-												s->b[x1][ym] == ' ') /* ChessValid not needed here */
-												{
-													s->move_iterator=ChessIteratorFromTgId(tg,id);
-													s->candidate_move=ChessMove(x1,y1,x2,y2,0);
-													return 1;
-												}
-										}
-								}
-							break;
-						case 19:
-						case 20:
-						case 22:
-						case 23:
-						case 25:
-						case 26:
-						case 28:
-						case 29:
-							if (s->b[x2][y2] != ' ') /* only capturing */
-								{
-									x1 = x2 + (id % 3 == 1 ? -1 : 1);
-									y1 = y2 + (side == 'w' ? -1 : 1);
-									if (ChessValidXY(x1,y1) && 
-										s->b[x1][y1] == my_pawn &&
-										(id <= 20 || y2 == (side == 'w' ? 7 : 0)))
-										{
-											s->move_iterator=ChessIteratorFromTgId(tg,id);
-											s->candidate_move=ChessMove(x1,y1,x2,y2,
-																		(id <= 20 ? 0 :
-																		 (id <= 23 ? 1 :
-																		  (id <= 26 ? 2 : 3))));
-											return 1;
-										}
-								}
-							break;
-						default:
-							ereport(ERROR, (errmsg("unsupported move ID %d", id)));
+							if (p->error == NULL)
+								p->error = psprintf("malformed tag pair \"%.*s\"", len - i, line + i);
+							len = 0;
 						}
+					for (i += j; i < len && (line[i] == ' ' || line[i] == '\t'); i++)
+						;
 				}
-			
-			/*
-			 * updating the iterator
-			 */
+		}
 
-			s->move_iterator=ChessIteratorFromTgId(tg,id);
+	while (i < len)
+		{
+			if (p->in_comment)
+				{
+					if (line[i++] == '}')
+						p->in_comment = false;
+					continue;
+				}
+			switch (line[i])
+				{
+				case '{':
+					p->in_comment = true;
+					i++;
+					continue;
+				case ';':
+					i = len;
+					continue;
+				case '(':
+					p->variation_depth++;
+					i++;
+					continue;
+				case ')':
+					if (p->variation_depth > 0)
+						p->variation_depth--;
+					i++;
+					continue;
+				}
+			if (p->variation_depth > 0 || strchr(ChessPGNDelimiters, line[i]) != NULL)
+				{
+					i++;
+					continue;
+				}
+			for (j = i; j < len && strchr(ChessPGNDelimiters, line[j]) == NULL; j++)
+				;
+			aux_chess_pgn_token(p, line + i, j - i);
+			i = j;
 		}
-	/*
-	 * no valid move was found
-	 */
 
-	s->candidate_move=ChessEndOfMoves;
-	return 0;
+	MemoryContextSwitchTo(oldcontext);
 }
 
 /*
- * This function decides whether the candidate move (which is assumed
- * to be a formal move) leaves its own king under attack.
+ * These functions import the games of a PGN text, or file: for each
+ * game they return its tags, its moves and the final game. The file
+ * is read one line at a time.
  */
 
-int
-aux_chess_is_king_safe(const chess_game_status *s0)
-{
-	int move;
-	int x2;
-	int y2;
-	char captured_piece;
-	chess_game_status *s;
-
-	/* clone s0 and apply the candidate move */
-	s = aux_clone_chess_game_status(s0);	
-	aux_chess_update_fen(s);
-	aux_chess_apply_candidate_move(s);
-	aux_chess_update_fen(s);
+PG_FUNCTION_INFO_V1(chess_pgn_import);
 
-	/* check safety by looping over valid moves */
-	aux_chess_formal_move_rewind(s);
-	while (aux_chess_formal_move_next(s))
+Datum
+chess_pgn_import(PG_FUNCTION_ARGS)
+{
+	text *t = PG_GETARG_TEXT_PP(0);
+	const char *data = VARDATA_ANY(t);
+	const char *eol;
+	int len = VARSIZE_ANY_EXHDR(t);
+	int n;
+	chess_pgn_parser *p;
+
+	p = aux_chess_pgn_begin(fcinfo);
+	while (len > 0)
 		{
-			move = s->candidate_move;
-			x2 = ChessMoveX2(move);
-			y2 = ChessMoveY2(move);
-			captured_piece = s->b[x2][y2];
-			if (captured_piece == 'k' || captured_piece == 'K')
-				{
-					aux_destroy_chess_game_status(s);
-					return 0;
-				}
+			eol = memchr(data, '\n', len);
+			n = (eol == NULL) ? len : eol - data;
+			aux_chess_pgn_line(p, data, n);
+			if (eol == NULL)
+				break;
+			data += n + 1;
+			len -= n + 1;
 		}
+	aux_chess_pgn_end(p);
 
-	aux_destroy_chess_game_status(s);
+	return (Datum) 0;
+}
 
-	return 1;
+PG_FUNCTION_INFO_V1(chess_pgn_import_file);
+
+Datum
+chess_pgn_import_file(PG_FUNCTION_ARGS)
+{
+	char *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	chess_pgn_parser *p;
+	StringInfoData line;
+	char buf[8192];
+	FILE *f;
+	int n;
+	bool first = true;
+
+	p = aux_chess_pgn_begin(fcinfo);
+
+	f = AllocateFile(path, PG_BINARY_R);
+	if (f == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open PGN file \"%s\": %m", path)));
+
+	initStringInfo(&line);
+	while (fgets(buf, sizeof(buf), f) != NULL)
+		{
+			n = strlen(buf);
+			appendBinaryStringInfo(&line, buf, n);
+			if (n == 0 || buf[n - 1] != '\n')
+				continue;
+			/* skip the byte order mark of UTF-8 files */
+			if (first && line.len >= 3 && memcmp(line.data, "\xEF\xBB\xBF", 3) == 0)
+				aux_chess_pgn_line(p, line.data + 3, line.len - 4);
+			else
+				aux_chess_pgn_line(p, line.data, line.len - 1);
+			first = false;
+			resetStringInfo(&line);
+		}
+	if (ferror(f))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read PGN file \"%s\": %m", path)));
+	if (line.len > 0)
+		aux_chess_pgn_line(p, line.data, line.len);
+	FreeFile(f);
+
+	aux_chess_pgn_end(p);
+	return (Datum) 0;
 }
 
 /*
- * The following functions compute the score for a given
- * game. Positive scores means that the game is in favour of the
- * player that moves next.
- * 
- * "We" and "our" refer to the player that makes the next move, "They"
- * and "their" refer to the other player.
- *
- * The score that we compute is the combination of three subscores:
- * 
- * (1) the value of our pieces minus the value of their pieces
- * 
- * (2) the number of our available moves minus the number of their
- *      available moves
- * 
- * (3) the number of their pieces that we attack, minus the number of
- *     our pieces that they attack
- * 
- * The number in (3) is computed with multiplicities, e.g. if their
- * Rook is attacked by both our Queen and our Bishop then it is counts
- * as two.
+ * Standard Algebraic Notation: the SAN of a move, the move of a SAN,
+ * and the SANs of a sequence of moves played from a position. The
+ * legal moves of each position are generated once, and used both to
+ * disambiguate its move and to tell check from mate on the move
+ * before.
  */
 
-int
-aux_chess_piece_value(char p)
+PG_FUNCTION_INFO_V1(chess_move_to_san);
+
+Datum
+chess_move_to_san(PG_FUNCTION_ARGS)
 {
-	switch (p)
+	chess_game_status *s;
+	chess_undo u;
+	int moves[ChessMaxFormalMoves];
+	char san[ChessSANSize];
+	int move, n, i;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+	move = aux_read_move(PG_GETARG_DATUM(1));
+
+	n = aux_chess_legal_moves(s, moves);
+	for (i = 0; i < n && moves[i] != move; i++)
+		;
+	if (i == n)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("move %c%d%c%d is not valid in this position",
+						'a' + ChessMoveX1(move), 1 + ChessMoveY1(move),
+						'a' + ChessMoveX2(move), 1 + ChessMoveY2(move))));
+
+	aux_chess_move_to_san(s, move, moves, n, san);
+	aux_chess_make_move(s, move, &u);
+	aux_chess_san_check(s, aux_chess_legal_moves(s, moves), san);
+
+	PG_RETURN_TEXT_P(cstring_to_text(san));
+}
+
+PG_FUNCTION_INFO_V1(chess_san_to_move);
+
+Datum
+chess_san_to_move(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	text *san = PG_GETARG_TEXT_PP(1);
+	TupleDesc tuple_desc;
+	Datum values[5];
+	bool isnull[5] = { false, false, false, false, false };
+	int move;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+
+	move = aux_chess_san_to_move(s, VARDATA_ANY(san), VARSIZE_ANY_EXHDR(san));
+	if (move < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("%s move \"%s\"",
+						move == ChessSANAmbiguous ? "ambiguous" : "invalid",
+						text_to_cstring(san))));
+
+	tuple_desc = aux_game_tuple_desc(fcinfo);
+	values[0] = Int16GetDatum(1 + ChessMoveX1(move));
+	values[1] = Int16GetDatum(1 + ChessMoveY1(move));
+	values[2] = Int16GetDatum(1 + ChessMoveX2(move));
+	values[3] = Int16GetDatum(1 + ChessMoveY2(move));
+	values[4] = Int16GetDatum(ChessMovePPC(move));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tuple_desc, values, isnull)));
+}
+
+PG_FUNCTION_INFO_V1(chess_moves_to_san);
+
+Datum
+chess_moves_to_san(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+	chess_undo u;
+	int moves[ChessMaxFormalMoves];
+	char san[ChessSANSize];
+	int16 *played;
+	Datum *result;
+	int n_played, n, i, j;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+
+	n_played = aux_read_moves_array(PG_GETARG_ARRAYTYPE_P(1), &played);
+	if (n_played == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(TEXTOID));
+
+	result = (Datum *) palloc(sizeof(Datum) * n_played);
+	n = aux_chess_legal_moves(s, moves);
+	for (i = 0; i < n_played; i++)
 		{
-		case 'p':
-		case 'P':
-			return 1;
-		case 'n':
-		case 'N':
-			return 3;
-		case 'b':
-		case 'B':
-			return 3;
-		case 'r':
-		case 'R':
-			return 5;
-		case 'q':
-		case 'Q':
-			return 9;
-		default:
-			return 0;
+			for (j = 0; j < n && moves[j] != played[i]; j++)
+				;
+			if (j == n)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("move %d, %c%d%c%d, is not valid in its position", i + 1,
+								'a' + ChessMoveX1(played[i]), 1 + ChessMoveY1(played[i]),
+								'a' + ChessMoveX2(played[i]), 1 + ChessMoveY2(played[i]))));
+
+			aux_chess_move_to_san(s, played[i], moves, n, san);
+			aux_chess_make_move(s, played[i], &u);
+			n = aux_chess_legal_moves(s, moves);
+			aux_chess_san_check(s, n, san);
+			result[i] = PointerGetDatum(cstring_to_text(san));
 		}
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(result, n_played, TEXTOID, -1, false, 'i'));
+}
+
+/*
+ * Positions: the Zobrist hash, and comparison functions for the hash
+ * and btree operator classes. Two games, or chessboards, are the same
+ * position when they have the same pieces, side to move, castling
+ * rights and en passant target square; the history and the counters
+ * are ignored. The btree ordering is by the packed board, which is
+ * not meaningful but consistent with equality.
+ */
+
+PG_FUNCTION_INFO_V1(chess_position_hash);
+
+Datum
+chess_position_hash(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_NULL();
+	PG_RETURN_INT64((int64) s->hash);
+}
+
+PG_FUNCTION_INFO_V1(chess_position_hash32);
+
+Datum
+chess_position_hash32(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
+
+	s = aux_fn_chess_game_status(fcinfo);
+	if (aux_read_game_arg(s, fcinfo, 0))
+		PG_RETURN_INT32(0);
+	PG_RETURN_INT32((int32) (s->hash ^ (s->hash >> 32)));
 }
 
 int
-aux_chess_score_available_pieces(chess_game_status *s)
+aux_chess_position_cmp(const ChessBoard *cb1, const ChessBoard *cb2)
 {
-	int x,y;
-	char p;
-	char our_side = s->previous_moves_n % 2 == 0 ? 'w' : 'b';
-	int o = 0;
-	for(x=0;x<8;x++)
-		for(y=0;y<8;y++)
-			{
-				p = s->b[x][y];
-				o += (aux_chess_side(p) == our_side ? 1 : -1)
-					* aux_chess_piece_value(p);
-			}
-	return o;
+	return memcmp(cb1, cb2, ChessBoardPositionSize);
 }
 
 int
-aux_chess_score_available_moves(chess_game_status *s)
+aux_chess_position_cmp_args(FunctionCallInfo fcinfo)
 {
-	int o = 0;
-	chess_game_status *s1;
-	int candidate_move;
+	ChessBoard cb1, cb2;
 
-	/* (1) our moves */
-	candidate_move = s->candidate_move;
-	aux_chess_formal_move_rewind(s);
-	while (aux_chess_formal_move_next(s))
-		if (aux_chess_is_king_safe(s))
-			o++;
-	s->candidate_move = candidate_move;
-
-	/* (2) their moves */
-	s1 = aux_clone_chess_game_status(s);
-	s1->candidate_move = ChessVoidMove;
-	aux_chess_apply_candidate_move(s1);
-	aux_chess_formal_move_rewind(s1);
-	while (aux_chess_formal_move_next(s1))
-		if (aux_chess_is_king_safe(s1))
-			o--;
+	return aux_chess_position_cmp(aux_read_position_arg(fcinfo, 0, &cb1),
+								  aux_read_position_arg(fcinfo, 1, &cb2));
+}
 
-	return o;
+PG_FUNCTION_INFO_V1(chess_position_cmp);
+
+Datum
+chess_position_cmp(PG_FUNCTION_ARGS)
+{
+	int c = aux_chess_position_cmp_args(fcinfo);
+
+	PG_RETURN_INT32(c < 0 ? -1 : (c > 0 ? 1 : 0));
 }
 
-int
-aux_chess_score_attacked_pieces(chess_game_status *s)
+PG_FUNCTION_INFO_V1(chess_position_eq);
+
+Datum
+chess_position_eq(PG_FUNCTION_ARGS)
 {
-	/* TODO */
-	return 0;
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) == 0);
 }
 
-double
-aux_chess_score(chess_game_status *s)
+PG_FUNCTION_INFO_V1(chess_position_ne);
+
+Datum
+chess_position_ne(PG_FUNCTION_ARGS)
 {
-	return aux_chess_score_available_pieces(s)
-		+ ChessCoeffScoreMoves * aux_chess_score_available_moves(s)
-/*		+ ChessCoeffScoreAttacked * aux_chess_score_attacked_pieces(s) TODO */
-		;
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) != 0);
 }
 
-void
-aux_chess_update_fen(chess_game_status *s)
+PG_FUNCTION_INFO_V1(chess_position_lt);
+
+Datum
+chess_position_lt(PG_FUNCTION_ARGS)
 {
-	char *p = s->fen;
-	int i, j;
-	int c;
-	for (j = 7; j >= 0; j--)
-		{
-			c = 0;
-			for(i = 0; i < 8; i++)
-				{
-					if (s->b[i][j] == ' ')
-						{
-							c++;
-						}
-					else
-						{
-							if (c > 0)
-								{
-									sprintf(p,"%d",c);
-									p++;
-								}
-							c = 0;
-							sprintf(p,"%c",s->b[i][j]);
-							p++;
-						}
-				}
-			if (c > 0)
-				{
-					sprintf(p,"%d",c);
-					p++;
-				}
-			if (j > 0)
-				{
-					sprintf(p,"/");
-					p++;
-				}
-		}
-	sprintf(p, " %c", s->previous_moves_n % 2 ? 'b' : 'w'); p += 2;
-	if (! strncmp(s->c, "nnnn", 4))
-		{
-			sprintf(p, " -"); p += 2;
-		}
-	else
-		{
-			sprintf(p, " "); p++;
-			if (s->c[0] == 'y') { sprintf(p, "K"); p++; }
-			if (s->c[1] == 'y') { sprintf(p, "Q"); p++; }
-			if (s->c[2] == 'y') { sprintf(p, "k"); p++; }
-			if (s->c[3] == 'y') { sprintf(p, "q"); p++; }
-		}
-	/* FIXME: En passant target square is not implemented */
-	sprintf(p, " - %d %d", s->halfmove_counter, 1 + s->previous_moves_n / 2);
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) < 0);
 }
 
-/*
- * This function checks whether the king of the moving side is safe.
- */
+PG_FUNCTION_INFO_V1(chess_position_le);
 
-PG_FUNCTION_INFO_V1(chess_is_king_safe);
+Datum
+chess_position_le(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) <= 0);
+}
+
+PG_FUNCTION_INFO_V1(chess_position_gt);
 
 Datum
-chess_is_king_safe(PG_FUNCTION_ARGS)
+chess_position_gt(PG_FUNCTION_ARGS)
 {
-	chess_game_status *s;
-	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
-	aux_init_chess_game_status(s);
-	if(aux_read_game(s,PG_GETARG_DATUM(0)))
-		{
-			ereport(ERROR, (errmsg("chess_is_king_safe: null input not allowed")));
-		}
-	s->candidate_move = ChessVoidMove;
-	PG_RETURN_BOOL(aux_chess_is_king_safe(s) ? true : false);
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) > 0);
+}
+
+PG_FUNCTION_INFO_V1(chess_position_ge);
+
+Datum
+chess_position_ge(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chess_position_cmp_args(fcinfo) >= 0);
 }
 
 /*
- * This function checks whether the game is ended.
+ * The same for chessboards. These are separate entry points because
+ * the support functions of an operator class can be called without an
+ * expression tree (in sorts, hash aggregates and joins, and index
+ * builds and scans), when the argument type cannot be looked up.
  */
 
-PG_FUNCTION_INFO_V1(chess_is_game_ended);
+PG_FUNCTION_INFO_V1(chess_chessboard_position_hash);
 
 Datum
-chess_is_game_ended(PG_FUNCTION_ARGS)
+chess_chessboard_position_hash(PG_FUNCTION_ARGS)
 {
 	chess_game_status *s;
 
-	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+	PG_RETURN_INT64((int64) s->hash);
+}
 
-	aux_init_chess_game_status(s);
+PG_FUNCTION_INFO_V1(chess_chessboard_position_hash32);
 
-	if (aux_read_game(s,PG_GETARG_DATUM(0)))
-		ereport(ERROR, (errmsg("chess_is_game_ended: null input not allowed")));
+Datum
+chess_chessboard_position_hash32(PG_FUNCTION_ARGS)
+{
+	chess_game_status *s;
 
-	aux_chess_formal_move_rewind(s);
-	while (aux_chess_formal_move_next(s))
-		if (aux_chess_is_king_safe(s))
-			PG_RETURN_BOOL(false);
+	s = aux_fn_chess_game_status(fcinfo);
+	aux_read_chessboard(s, PG_GETARG_CHESSBOARD_P(0));
+	PG_RETURN_INT32((int32) (s->hash ^ (s->hash >> 32)));
+}
 
-	PG_RETURN_BOOL(true);
+#define aux_chessboard_position_cmp_args(fcinfo)						\
+	aux_chess_position_cmp(PG_GETARG_CHESSBOARD_P(0), PG_GETARG_CHESSBOARD_P(1))
+
+PG_FUNCTION_INFO_V1(chess_chessboard_position_cmp);
+
+Datum
+chess_chessboard_position_cmp(PG_FUNCTION_ARGS)
+{
+	int c = aux_chessboard_position_cmp_args(fcinfo);
+
+	PG_RETURN_INT32(c < 0 ? -1 : (c > 0 ? 1 : 0));
 }
 
-/*
- * This function generates the list of valid moves.
- *
- * (freely inspired by the normal_rand function in the tablefunc
- * extension)
- */
+PG_FUNCTION_INFO_V1(chess_chessboard_position_eq);
 
-PG_FUNCTION_INFO_V1(chess_valid_moves);
+Datum
+chess_chessboard_position_eq(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) == 0);
+}
+
+PG_FUNCTION_INFO_V1(chess_chessboard_position_ne);
 
 Datum
-chess_valid_moves(PG_FUNCTION_ARGS)
+chess_chessboard_position_ne(PG_FUNCTION_ARGS)
 {
-	FuncCallContext	*cctx;
-	MemoryContext	oldcontext;
-    TupleDesc		tuple_desc;
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) != 0);
+}
 
-	chess_game_status *s;
-	int i;
+PG_FUNCTION_INFO_V1(chess_chessboard_position_lt);
 
-	/* stuff done only on the first call of the function */
-	if (SRF_IS_FIRSTCALL())
-	{
+Datum
+chess_chessboard_position_lt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) < 0);
+}
 
-		/* create a function context for cross-call persistence */
-		cctx = SRF_FIRSTCALL_INIT();
+PG_FUNCTION_INFO_V1(chess_chessboard_position_le);
 
-		/*
-		 * switch to memory context appropriate for multiple function calls
-		 */
-		oldcontext = MemoryContextSwitchTo(cctx->multi_call_memory_ctx);
+Datum
+chess_chessboard_position_le(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) <= 0);
+}
 
-		/* allocate memory for user context */
-		s = (chess_game_status *) palloc0(sizeof(chess_game_status));
+PG_FUNCTION_INFO_V1(chess_chessboard_position_gt);
 
-		aux_init_chess_game_status(s);
+Datum
+chess_chessboard_position_gt(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) > 0);
+}
 
-        /* Build a tuple descriptor for our result type */
-        if (get_call_result_type(fcinfo, NULL, &tuple_desc) != TYPEFUNC_COMPOSITE)
-            ereport(ERROR,
-                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                     errmsg("function returning record called in context "
-                            "that cannot accept type record")));
+PG_FUNCTION_INFO_V1(chess_chessboard_position_ge);
 
-        /*
-         * generate attribute metadata needed later to produce tuples
-         * from Datum objects
-         */
-		cctx->tuple_desc = BlessTupleDesc(tuple_desc);
+Datum
+chess_chessboard_position_ge(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(aux_chessboard_position_cmp_args(fcinfo) >= 0);
+}
 
-		/*
-		 * read the input data into s
-		 */
-		if(aux_read_game(s,PG_GETARG_DATUM(0)))
-			{
-				ereport(ERROR, (errmsg("chess_valid_moves: null input not allowed")));
-			}
-		aux_chess_formal_move_rewind(s);
+/*
+ * Piece placement: the @> operator, which tells whether a position
+ * matches a placement pattern, and GIN operator classes indexing the
+ * (piece, square) pairs of positions for it.
+ *
+ * A pattern is a list of terms separated by spaces, all of which must
+ * hold. A term is a piece letter, as in FEN, followed by where one
+ * such piece must be: a square ("Ne5"), a file ("Pe"), a rank ("p2"),
+ * the light or dark squares ("Blight", "bdark"), or nothing for
+ * anywhere ("Q").
+ *
+ * The keys of a position are piece code * 64 + square, where piece
+ * codes are as in ChessBoardCodes; the keys of a term are those of
+ * its squares, and the term holds when one of them is present.
+ */
 
-		/* save s into cctx and switch back to the old context */
-		cctx->user_fctx = s;
-		MemoryContextSwitchTo(oldcontext);
+#define ChessLightSquares UINT64CONST(0x55AA55AA55AA55AA)
+#define ChessPlacementKey(code,sq) ((int32) ((code) * 64 + (sq)))
 
-	}
+typedef struct
+{
+	int code;
+	ChessBitboard squares;
+} chess_placement_term;
 
-	/* stuff done on every call of the function */
-	cctx = SRF_PERCALL_SETUP();
-	s = cctx->user_fctx;
+int aux_chess_read_placement(text *, chess_placement_term **);
+int aux_chess_placement_keys(const ChessBoard *, Datum *);
 
-	/* browse candidate moves */
-	while (aux_chess_formal_move_next(s) &&
-		   (! aux_chess_is_king_safe(s)));
+/*
+ * This function reads a placement pattern into a palloc'd array of
+ * terms, returning their number.
+ */
 
-	if (s->candidate_move >= ChessEndOfMoves) /* no more candidates */
+int
+aux_chess_read_placement(text *pattern, chess_placement_term **terms)
+{
+	const char *p = VARDATA_ANY(pattern);
+	const char *end = p + VARSIZE_ANY_EXHDR(pattern);
+	const char *term;
+	chess_placement_term *t;
+	int n = 0, len;
+
+	*terms = t = (chess_placement_term *) palloc(sizeof(chess_placement_term) * Max((end - p + 1) / 2, 1));
+	for (;;)
 		{
-			SRF_RETURN_DONE(cctx);
+			while (p < end && *p == ' ')
+				p++;
+			if (p == end)
+				break;
+			term = p;
+			while (p < end && *p != ' ')
+				p++;
+			len = p - term;
+
+			t[n].code = strchr(ChessBoardCodes + 1, term[0]) == NULL ? 0 :
+				strchr(ChessBoardCodes + 1, term[0]) - ChessBoardCodes;
+			if (len == 1)
+				t[n].squares = ~(ChessBitboard) 0;
+			else if (len == 3 && term[1] >= 'a' && term[1] <= 'h' && term[2] >= '1' && term[2] <= '8')
+				t[n].squares = ChessBit(ChessSquare(term[1] - 'a', term[2] - '1'));
+			else if (len == 2 && term[1] >= 'a' && term[1] <= 'h')
+				t[n].squares = ChessFileA << (term[1] - 'a');
+			else if (len == 2 && term[1] >= '1' && term[1] <= '8')
+				t[n].squares = ChessRank1 << (8 * (term[1] - '1'));
+			else if (len == 6 && memcmp(term + 1, "light", 5) == 0)
+				t[n].squares = ChessLightSquares;
+			else if (len == 5 && memcmp(term + 1, "dark", 4) == 0)
+				t[n].squares = ~ChessLightSquares;
+			else
+				t[n].code = 0;
+			if (t[n].code == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+						 errmsg("invalid placement pattern: \"%s\"", text_to_cstring(pattern)),
+						 errdetail("Invalid term \"%.*s\".", len, term)));
+			n++;
 		}
-	else /* found a valid move */
-		{
-			Datum *values;
-			HeapTuple tuple;
-			bool *isnull;
-			int move = s->candidate_move;
-			s->candidate_move ++;
-			s->found_moves ++;
 
-			tuple_desc = cctx->tuple_desc;
+	return n;
+}
 
-			values = (Datum *) palloc(5 * sizeof(Datum));
-			isnull = (bool *) palloc(5 * sizeof(bool));
+/*
+ * This function stores the keys of a position into keys, which must
+ * have room for 64 of them, and returns how many they are.
+ */
 
-			values[0] = Int16GetDatum(1 + ChessMoveX1(move));
-			values[1] = Int16GetDatum(1 + ChessMoveY1(move));
-			values[2] = Int16GetDatum(1 + ChessMoveX2(move));
-			values[3] = Int16GetDatum(1 + ChessMoveY2(move));
-			values[4] = Int16GetDatum(ChessMovePPC(move));
-			for (i = 0; i < 5; i++)
-				isnull[i] = false;
+int
+aux_chess_placement_keys(const ChessBoard *cb, Datum *keys)
+{
+	int sq, code, n = 0;
 
-			tuple = heap_form_tuple(tuple_desc,values,isnull);
-			
-			SRF_RETURN_NEXT(cctx, HeapTupleGetDatum(tuple));
-		}			
+	for (sq = 0; sq < 64; sq++)
+		if ((code = ChessBoardGetCode(cb, sq)) != 0)
+			keys[n++] = Int32GetDatum(ChessPlacementKey(code, sq));
+	return n;
 }
 
-PG_FUNCTION_INFO_V1(chess_game_to_fen);
+PG_FUNCTION_INFO_V1(chess_placement_match);
 
 Datum
-chess_game_to_fen(PG_FUNCTION_ARGS)
+chess_placement_match(PG_FUNCTION_ARGS)
+{
+	ChessBoard cb_buf;
+	const ChessBoard *cb = aux_read_position_arg(fcinfo, 0, &cb_buf);
+	chess_placement_term *terms;
+	ChessBitboard pieces[16];
+	int sq, n, i;
+
+	n = aux_chess_read_placement(PG_GETARG_TEXT_PP(1), &terms);
+
+	memset(pieces, 0, sizeof(pieces));
+	for (sq = 0; sq < 64; sq++)
+		pieces[ChessBoardGetCode(cb, sq)] |= ChessBit(sq);
+	for (i = 0; i < n; i++)
+		if ((pieces[terms[i].code] & terms[i].squares) == 0)
+			PG_RETURN_BOOL(false);
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * GIN support: the keys of a chessboard or of a game, the keys of a
+ * pattern, and whether a position with some of them matches. The
+ * keys of a pattern are in the order of its terms, and the extra data
+ * of each key is the number of its term. The result is exact.
+ */
+
+PG_FUNCTION_INFO_V1(chess_chessboard_gin_extract_value);
+
+Datum
+chess_chessboard_gin_extract_value(PG_FUNCTION_ARGS)
 {
+	int32 *nkeys = (int32 *) PG_GETARG_POINTER(1);
+	Datum *keys = (Datum *) palloc(sizeof(Datum) * 64);
+
+	*nkeys = aux_chess_placement_keys(PG_GETARG_CHESSBOARD_P(0), keys);
+	PG_RETURN_POINTER(keys);
+}
+
+PG_FUNCTION_INFO_V1(chess_game_gin_extract_value);
+
+Datum
+chess_game_gin_extract_value(PG_FUNCTION_ARGS)
+{
+	int32 *nkeys = (int32 *) PG_GETARG_POINTER(1);
+	Datum *keys = (Datum *) palloc(sizeof(Datum) * 64);
 	chess_game_status *s;
+	ChessBoard cb;
 
 	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
 	aux_init_chess_game_status(s);
-	if(aux_read_game(s,PG_GETARG_DATUM(0)))
+	if (aux_read_game(s, PG_GETARG_DATUM(0)))
 		{
-			PG_RETURN_NULL();
+			*nkeys = 0;
+			PG_RETURN_POINTER(keys);
 		}
-	else
+	aux_write_chessboard(s, &cb);
+	aux_destroy_chess_game_status(s);
+
+	*nkeys = aux_chess_placement_keys(&cb, keys);
+	PG_RETURN_POINTER(keys);
+}
+
+PG_FUNCTION_INFO_V1(chess_placement_gin_extract_query);
+
+Datum
+chess_placement_gin_extract_query(PG_FUNCTION_ARGS)
+{
+	int32 *nkeys = (int32 *) PG_GETARG_POINTER(1);
+	Pointer **extra_data = (Pointer **) PG_GETARG_POINTER(4);
+	int32 *search_mode = (int32 *) PG_GETARG_POINTER(6);
+	chess_placement_term *terms;
+	ChessBitboard b;
+	Datum *keys;
+	int32 *term_of_key;
+	int n, i, sq;
+
+	n = aux_chess_read_placement(PG_GETARG_TEXT_PP(0), &terms);
+
+	*nkeys = 0;
+	for (i = 0; i < n; i++)
+		*nkeys += ChessPopCount(terms[i].squares);
+	if (*nkeys == 0)
 		{
-			aux_chess_update_fen(s);
-			PG_RETURN_TEXT_P(cstring_to_text(s->fen));
+			*search_mode = GIN_SEARCH_MODE_ALL;
+			PG_RETURN_POINTER(NULL);
 		}
+
+	keys = (Datum *) palloc(sizeof(Datum) * *nkeys);
+	term_of_key = (int32 *) palloc(sizeof(int32) * *nkeys);
+	*extra_data = (Pointer *) palloc(sizeof(Pointer) * *nkeys);
+	*nkeys = 0;
+	for (i = 0; i < n; i++)
+		for (b = terms[i].squares; b != 0; b &= b - 1)
+			{
+				sq = ChessFirstSquare(b);
+				keys[*nkeys] = Int32GetDatum(ChessPlacementKey(terms[i].code, sq));
+				term_of_key[*nkeys] = i;
+				(*extra_data)[*nkeys] = (Pointer) &term_of_key[*nkeys];
+				(*nkeys)++;
+			}
+
+	PG_RETURN_POINTER(keys);
 }
 
-PG_FUNCTION_INFO_V1(chess_game_score);
+PG_FUNCTION_INFO_V1(chess_placement_gin_consistent);
 
 Datum
-chess_game_score(PG_FUNCTION_ARGS)
+chess_placement_gin_consistent(PG_FUNCTION_ARGS)
 {
-	chess_game_status *s;
+	bool *check = (bool *) PG_GETARG_POINTER(0);
+	int32 nkeys = PG_GETARG_INT32(3);
+	Pointer *extra_data = (Pointer *) PG_GETARG_POINTER(4);
+	bool *recheck = (bool *) PG_GETARG_POINTER(5);
+	int term = -1, i;
+	bool holds = true;
 
-	s = (chess_game_status *) palloc0(sizeof(chess_game_status));
-	aux_init_chess_game_status(s);
-	if(aux_read_game(s,PG_GETARG_DATUM(0)))
-		{
-			PG_RETURN_NULL();
-		}
-	else
+	*recheck = false;
+
+	/* the keys of each term are consecutive */
+	for (i = 0; i < nkeys; i++)
 		{
-			PG_RETURN_FLOAT8(aux_chess_score(s));
+			if (*(int32 *) extra_data[i] != term)
+				{
+					if (!holds)
+						PG_RETURN_BOOL(false);
+					term = *(int32 *) extra_data[i];
+					holds = false;
+				}
+			holds |= check[i];
 		}
+
+	PG_RETURN_BOOL(holds);
 }